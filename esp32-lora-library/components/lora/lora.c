@@ -5,6 +5,7 @@
 #include "driver/spi_master.h"
 #include "soc/gpio_struct.h"
 #include "driver/gpio.h"
+#include "esp_attr.h"
 #include <string.h>
 
 /*
@@ -65,8 +66,16 @@
 
 #define TIMEOUT_RESET                  100
 
+/*
+ * FIFO size, the longest burst
+ */
+#define FIFO_SIZE                      256
+
 static spi_device_handle_t __spi;
 
+static WORD_ALIGNED_ATTR uint8_t __burst_out[1 + FIFO_SIZE + 3];
+static WORD_ALIGNED_ATTR uint8_t __burst_in[1 + FIFO_SIZE + 3];
+
 static int __implicit;
 static long __frequency;
 
@@ -117,6 +126,61 @@ lora_read_reg(int reg)
    return in[1];
 }
 
+/**
+ * Write a buffer to a register in a single SPI transaction.
+ * The FIFO address pointer auto-increments, so this fills the FIFO in one burst.
+ * @param reg Register index.
+ * @param val Bytes to write.
+ * @param len Number of bytes (at most FIFO_SIZE).
+ */
+void 
+lora_write_reg_buffer(int reg, const uint8_t *val, int len)
+{
+   assert(len <= FIFO_SIZE);
+
+   __burst_out[0] = 0x80 | reg;
+   memcpy(__burst_out + 1, val, len);
+
+   spi_transaction_t t = {
+      .flags = 0,
+      .length = 8 * (len + 1),
+      .tx_buffer = __burst_out,
+      .rx_buffer = NULL
+   };
+
+   gpio_set_level(CONFIG_CS_GPIO, 0);
+   spi_device_transmit(__spi, &t);
+   gpio_set_level(CONFIG_CS_GPIO, 1);
+}
+
+/**
+ * Read consecutive values of a register in a single SPI transaction.
+ * The FIFO address pointer auto-increments, so this empties the FIFO in one burst.
+ * @param reg Register index.
+ * @param val Buffer for the bytes read.
+ * @param len Number of bytes (at most FIFO_SIZE).
+ */
+void 
+lora_read_reg_buffer(int reg, uint8_t *val, int len)
+{
+   assert(len <= FIFO_SIZE);
+
+   __burst_out[0] = reg;
+   memset(__burst_out + 1, 0xff, len);
+
+   spi_transaction_t t = {
+      .flags = 0,
+      .length = 8 * (len + 1),
+      .tx_buffer = __burst_out,
+      .rx_buffer = __burst_in
+   };
+
+   gpio_set_level(CONFIG_CS_GPIO, 0);
+   spi_device_transmit(__spi, &t);
+   gpio_set_level(CONFIG_CS_GPIO, 1);
+   memcpy(val, __burst_in + 1, len);
+}
+
 /**
  * Perform physical reset on the Lora chip
  */
@@ -330,10 +394,13 @@ lora_init(void)
       .sclk_io_num = CONFIG_SCK_GPIO,
       .quadwp_io_num = -1,
       .quadhd_io_num = -1,
-      .max_transfer_sz = 0
+      .max_transfer_sz = 1 + FIFO_SIZE
    };
            
-   ret = spi_bus_initialize(VSPI_HOST, &bus, 0);
+   /*
+    * FIFO bursts are longer than the 64 bytes a transaction can move without DMA.
+    */
+   ret = spi_bus_initialize(VSPI_HOST, &bus, 1);
    assert(ret == ESP_OK);
 
    spi_device_interface_config_t dev = {
@@ -392,8 +459,7 @@ lora_send_packet(uint8_t *buf, int size)
    lora_idle();
    lora_write_reg(REG_FIFO_ADDR_PTR, 0);
 
-   for(int i=0; i<size; i++) 
-      lora_write_reg(REG_FIFO, *buf++);
+   lora_write_reg_buffer(REG_FIFO, buf, size);
    
    lora_write_reg(REG_PAYLOAD_LENGTH, size);
    
@@ -438,8 +504,7 @@ lora_receive_packet(uint8_t *buf, int size)
    lora_idle();   
    lora_write_reg(REG_FIFO_ADDR_PTR, lora_read_reg(REG_FIFO_RX_CURRENT_ADDR));
    if(len > size) len = size;
-   for(int i=0; i<len; i++) 
-      *buf++ = lora_read_reg(REG_FIFO);
+   lora_read_reg_buffer(REG_FIFO, buf, len);
 
    return len;
 }
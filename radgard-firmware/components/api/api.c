@@ -1,327 +1,322 @@
+#include <stdio.h>
 #include <string.h>
-#include <stdlib.h>
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include <freertos/event_groups.h>
+#include <strings.h>
 
 #include "esp_log.h"
-#include "esp_system.h"
-
-#include "esp_event.h"
-#include "esp_netif.h"
-#include "esp_tls.h"
-#include "esp_http_client.h"
-#include "esp_sntp.h"
-
-#include <cJSON.h>
 
 #include "api.h"
+#include "hal.h"
 #include "storage.h"
+#include "settings.h"
+#include "schedule.h"
+#include "timezone.h"
+#include "wire.h"
+#include "clock.h"
 
-#define MAX_HTTP_OUTPUT_BUFFER 4096
 static const char *TAG = "api";
 
-const int irrigation_settings_fetched_event = BIT0;
-static EventGroupHandle_t irrigation_settings_event_group;
-
-const int firmware_update_url_fetched_event = BIT0;
-static EventGroupHandle_t firmware_update_url_event_group;
-
-static cJSON *firmware_update = NULL;
-
-esp_err_t _http_event_handler(esp_http_client_event_t *evt) {
-    static char *output_buffer;  // Buffer to store response of http request from event handler
-    static int output_len;       // Stores number of bytes read
-    switch(evt->event_id) {
-        case HTTP_EVENT_ERROR:
-            ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
-            break;
-        case HTTP_EVENT_ON_CONNECTED:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
-            break;
-        case HTTP_EVENT_HEADER_SENT:
-            ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
-            break;
-        case HTTP_EVENT_ON_HEADER:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-            break;
-        case HTTP_EVENT_ON_DATA:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            /*
-             *  Check for chunked encoding is added as the URL for chunked encoding used in this example returns binary data.
-             *  However, event handler can also be used in case chunked encoding is used.
-             */
-            if (!esp_http_client_is_chunked_response(evt->client)) {
-                // If user_data buffer is configured, copy the response into the buffer
-                if (evt->user_data) {
-                    memcpy(evt->user_data + output_len, evt->data, evt->data_len);
-                } else {
-                    if (output_buffer == NULL) {
-                        output_buffer = (char *) malloc(esp_http_client_get_content_length(evt->client));
-                        output_len = 0;
-                        if (output_buffer == NULL) {
-                            ESP_LOGE(TAG, "Failed to allocate memory for output buffer");
-                            return ESP_FAIL;
-                        }
-                    }
-
-                    memcpy(output_buffer + output_len, evt->data, evt->data_len);
-                }
-
-                output_len += evt->data_len;
-            }
-
-            break;
-        case HTTP_EVENT_ON_FINISH:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-
-            if (output_buffer != NULL) {
-                // Response is accumulated in output_buffer. Uncomment the below line to print the accumulated response
-                // ESP_LOG_BUFFER_HEX(TAG, output_buffer, output_len);
-                free(output_buffer);
-                output_buffer = NULL;
-            }
-
-            output_len = 0;
+static const char *SYNC_URL = "https://us-central1-animal-farm-e321d.cloudfunctions.net/syncDevice";
+static const char *FIRMWARE_CERT_URL = "https://us-central1-animal-farm-e321d.cloudfunctions.net/firmwareCert";
 
-            break;
-        case HTTP_EVENT_DISCONNECTED:
-            ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
-            int mbedtls_err = 0;
-            esp_err_t err = esp_tls_get_and_clear_last_error(evt->data, &mbedtls_err, NULL);
+// Every API request of an online session shares this connection
+static hal_http_session_t *session = NULL;
 
-            if (err != 0) {
-                if (output_buffer != NULL) {
-                    free(output_buffer);
-                    output_buffer = NULL;
-                }
+typedef struct {
+    wire_decoder_t decoder;
+    char etag[SETTINGS_ETAG_LENGTH];
+    time_t date;
+    bool has_cert;
+    api_firmware_update_t *firmware_update;
+} sync_response_t;
 
-                output_len = 0;
-
-                ESP_LOGI(TAG, "Last esp error code: 0x%x", err);
-                ESP_LOGI(TAG, "Last mbedtls failure: 0x%x", mbedtls_err);
-            }
-
-            break;
+static esp_err_t api_perform(const hal_http_request_t *request, int *status_code) {
+    if (session == NULL) {
+        return hal_http_perform(request, status_code);
     }
-    
-    return ESP_OK;
-}
-
-static void reset_sig_rains() {
-    ESP_LOGI(TAG, "Failed to get latest irrigation settings -- resetting sig_rains");
 
-    size_t sig_rains_size = 7 * sizeof(uint8_t);
-    uint8_t *sig_rains = malloc(sig_rains_size);
+    return hal_http_session_perform(session, request, status_code);
+}
 
-    for (int i = 0; i < 7; i++) {
-        sig_rains[i] = 0;
+static void copy_header(char *destination, size_t capacity, const char *key, const char *value) {
+    if (strlen(value) < capacity) {
+        strcpy(destination, value);
+    } else {
+        ESP_LOGE(TAG, "Ignoring %s header longer than %d bytes", key, (int) capacity - 1);
     }
-
-    storage_set_blob(STORAGE_SIG_RAINS, sig_rains, sig_rains_size);
-
-    free(sig_rains);
 }
 
-static void get_irrigation_settings() {
-    size_t size;
-    esp_err_t size_err = storage_get_str_size(STORAGE_USER_ID, &size);
-    if (size_err != ESP_OK) {
-        ESP_LOGE(TAG, "Error getting user_id size from storage: %s", esp_err_to_name(size_err));
-        
-        vTaskDelete(NULL);
+static bool parse_sha256(const char *hex, uint8_t digest[CHECKSUM_SHA256_LENGTH]) {
+    if (strlen(hex) != 2 * CHECKSUM_SHA256_LENGTH) {
+        return false;
     }
 
-    char *user_id = malloc(size);
-    esp_err_t get_err = storage_get_str(STORAGE_USER_ID, user_id, &size);
-    if (get_err != ESP_OK) {
-        ESP_LOGE(TAG, "Error getting user_id from storage: %s", esp_err_to_name(get_err));
-        
-        vTaskDelete(NULL);
-    }
+    for (int i = 0; i < 2 * CHECKSUM_SHA256_LENGTH; i++) {
+        char c = hex[i];
+        int nibble = c >= '0' && c <= '9' ? c - '0' :
+                     c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                     c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (nibble < 0) {
+            return false;
+        }
 
-    size_err = storage_get_str_size(STORAGE_ZONE_ID, &size);
-    if (size_err != ESP_OK) {
-        ESP_LOGE(TAG, "Error getting zone_id size from storage: %s", esp_err_to_name(size_err));
-        
-        vTaskDelete(NULL);
+        digest[i / 2] = (i % 2 == 0) ? nibble << 4 : digest[i / 2] | nibble;
     }
 
-    char *zone_id = malloc(size);
-    get_err = storage_get_str(STORAGE_ZONE_ID, zone_id, &size);
-    if (get_err != ESP_OK) {
-        ESP_LOGE(TAG, "Error getting zone_id from storage: %s", esp_err_to_name(get_err));
+    return true;
+}
 
-        vTaskDelete(NULL);
+static void format_sha256(const uint8_t digest[CHECKSUM_SHA256_LENGTH], char hex[2 * CHECKSUM_SHA256_LENGTH + 1]) {
+    for (int i = 0; i < CHECKSUM_SHA256_LENGTH; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
     }
+}
 
-    ESP_LOGI(TAG, "Fetched user_id and zone_id from NVS; attempting to get irrigation settings from server");
+static bool cert_matches(const uint8_t *der, size_t length, const uint8_t sha256[CHECKSUM_SHA256_LENGTH]) {
+    checksum_sha256_t sha;
+    uint8_t digest[CHECKSUM_SHA256_LENGTH];
 
-    const char *URL = "https://us-central1-animal-farm-e321d.cloudfunctions.net/getIrrigationSettings2";
-    const char *data_holder = "{\"userId\":\"%s\",\"zoneId\":\"%s\"}";
+    checksum_sha256_begin(&sha);
+    checksum_sha256_update(&sha, der, length);
+    checksum_sha256_end(&sha, digest);
 
-    char *DATA = malloc(strlen(data_holder) + strlen(user_id) + strlen(zone_id) + 1);
-    sprintf(DATA, data_holder, user_id, zone_id);
-    free(user_id);
-    free(zone_id);
+    return memcmp(digest, sha256, CHECKSUM_SHA256_LENGTH) == 0;
+}
 
-    ESP_LOGI(TAG, "Posting data to getIrrigationSettings: %s", DATA);
+/* The firmware update comes in headers rather than the body so that it
+ * still arrives when the settings are unchanged and the reply is a 304 */
+static void sync_header(void *user_data, const char *key, const char *value) {
+    sync_response_t *response = user_data;
+    api_firmware_update_t *firmware_update = response->firmware_update;
+
+    if (strcasecmp(key, "Content-Type") == 0) {
+        wire_decoder_set_content_type(&response->decoder, value);
+    } else if (strcasecmp(key, "ETag") == 0) {
+        // An ETag that is not kept only costs the next fetch its condition
+        copy_header(response->etag, sizeof(response->etag), key, value);
+    } else if (strcasecmp(key, "Date") == 0) {
+        if (wire_parse_http_date(value, &response->date) != ESP_OK) {
+            ESP_LOGW(TAG, "Ignoring malformed Date header: %s", value);
+            response->date = 0;
+        }
+    } else if (strcasecmp(key, "X-Firmware-Url") == 0) {
+        copy_header(firmware_update->url, sizeof(firmware_update->url), key, value);
+    } else if (strcasecmp(key, "X-Firmware-Patch-Url") == 0) {
+        copy_header(firmware_update->patch_url, sizeof(firmware_update->patch_url), key, value);
+    } else if (strcasecmp(key, "X-Firmware-Cert-Sha256") == 0) {
+        response->has_cert = parse_sha256(value, firmware_update->cert_sha256);
+        if (!response->has_cert) {
+            ESP_LOGE(TAG, "Ignoring malformed %s header: %s", key, value);
+        }
+    }
+}
 
-    char irrigation_settings[MAX_HTTP_OUTPUT_BUFFER] = {0};
+static esp_err_t feed_settings(void *user_data, const char *data, size_t length) {
+    sync_response_t *response = user_data;
 
-    esp_http_client_config_t config = {
-        .url = URL,
-        .method = HTTP_METHOD_POST,
-        .event_handler = _http_event_handler,
-        .user_data = irrigation_settings,
-        .timeout_ms = 10000
-    };
+    return wire_decoder_feed(&response->decoder, data, length);
+}
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+static void reset_sig_rains(radgard_settings_t *settings) {
+    ESP_LOGI(TAG, "Failed to get latest irrigation settings -- resetting sig_rains");
 
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_field(client, DATA, strlen(DATA));
+    memset(settings->schedule.sig_rains, 0, sizeof(settings->schedule.sig_rains));
+    settings->schedule_etag[0] = '\0';
+    settings_save(settings);
 
-    esp_err_t http_err = esp_http_client_perform(client);
-    if (http_err == ESP_OK) {
-        int status_code = esp_http_client_get_status_code(client);
-        ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %d",
-                status_code,
-                esp_http_client_get_content_length(client));
+    schedule_t schedule;
+    if (schedule_cache_load(&schedule)) {
+        memset(schedule.sig_rains, 0, sizeof(schedule.sig_rains));
+        schedule_cache_store(&schedule);
+    }
+}
 
-        if (status_code == 200) {
-            ESP_LOGI(TAG, "HTTP DATA = %s", irrigation_settings);
+void api_sync(api_firmware_update_t *firmware_update, time_t *server_time) {
+    memset(firmware_update, 0, sizeof(api_firmware_update_t));
+    *server_time = 0;
 
-            cJSON *json = cJSON_Parse(irrigation_settings);
-            cJSON *time_zone_json = cJSON_GetObjectItem(json, "time_zone");
-            cJSON *times_json = cJSON_GetObjectItem(json, "times");
-            cJSON *sig_rains_json = cJSON_GetObjectItem(json, "sig_rains");
+    radgard_settings_t settings;
+    esp_err_t load_err = settings_load(&settings);
+    if (load_err != ESP_OK || settings.user_id[0] == '\0' || settings.zone_id[0] == '\0') {
+        ESP_LOGE(TAG, "Error getting user_id and zone_id from storage: %s", esp_err_to_name(load_err));
 
-            uint32_t time_zone = (uint32_t) time_zone_json->valuedouble;
+        return;
+    }
 
-            storage_set_u32(STORAGE_TIME_ZONE, time_zone);
+    ESP_LOGI(TAG, "Fetched version, user_id and zone_id from NVS; attempting to sync with server");
 
-            uint32_t times_length = cJSON_GetArraySize(times_json);
+    // A build booted from a background download skipped the power-on boot that records its version
+    if (settings.firmware_version != SETTINGS_FIRMWARE_VERSION) {
+        ESP_LOGI(TAG, "Recording firmware version %d in place of %d", SETTINGS_FIRMWARE_VERSION, settings.firmware_version);
+        settings.firmware_version = SETTINGS_FIRMWARE_VERSION;
+        settings_save(&settings);
+    }
 
-            for (int i = 0; i < times_length; i++) {
-                cJSON *day_times_json = cJSON_GetArrayItem(times_json, i);
+    const char *data_holder = "{\"version\":\"%d\",\"userId\":\"%s\",\"zoneId\":\"%s\",\"rtcDriftPpm\":%d}";
+
+    // Telemetry: the RTC correction as of the last sync
+    clock_drift_t drift;
+    clock_get_drift(&drift);
+
+    char DATA[80 + 2 * SETTINGS_ID_LENGTH];
+    snprintf(DATA, sizeof(DATA), data_holder, settings.firmware_version, settings.user_id, settings.zone_id,
+             (int) drift.correction_ppm);
+
+    ESP_LOGI(TAG, "Posting data to syncDevice: %s", DATA);
+
+    // The response is compiled into the schedule as it streams in; nothing is buffered
+    schedule_t schedule;
+    sync_response_t response = { .firmware_update = firmware_update };
+    wire_decoder_begin(&response.decoder, &schedule);
+
+    bool conditional = settings.has_schedule && settings.schedule_etag[0] != '\0';
+
+    hal_http_request_t request = {
+        .url = SYNC_URL,
+        .post = true,
+        .content_type = "application/json",
+        .accept = WIRE_ACCEPT,
+        .if_none_match = conditional ? settings.schedule_etag : NULL,
+        .body = DATA,
+        .body_length = strlen(DATA),
+        .timeout_ms = 10000,
+        .on_header = sync_header,
+        .on_data = feed_settings,
+        .user_data = &response
+    };
 
-                uint32_t day_times_length = cJSON_GetArraySize(day_times_json);
-                size_t day_times_size = day_times_length * sizeof(uint32_t);
+    int status_code = 0;
+    esp_err_t http_err = api_perform(&request, &status_code);
 
-                uint32_t *day_times = malloc(day_times_size);
+    // Any reply's Date is the server's clock, error statuses included
+    if (http_err == ESP_OK) {
+        *server_time = response.date;
+    }
 
-                for (int j = 0; j < day_times_length; j++) {
-                    uint32_t day_time = (uint32_t) cJSON_GetArrayItem(day_times_json, j)->valuedouble;
-                    day_times[j] = day_time;
-                }
+    // Firmware headers on an error reply are not an update
+    firmware_update->available = http_err == ESP_OK && (status_code == 200 || status_code == 304) &&
+                                 firmware_update->url[0] != '\0' && response.has_cert;
 
-                char *day_times_key = malloc(strlen(STORAGE_TIME_BASE));
-                sprintf(day_times_key, STORAGE_TIME_BASE, i);
+    if (http_err == ESP_OK && status_code == 304) {
+        // Nothing to parse and nothing to write; the stored and cached schedules are current
+        ESP_LOGI(TAG, "Irrigation settings unchanged (%s)", settings.schedule_etag);
+    } else if (http_err == ESP_OK) {
+        ESP_LOGI(TAG, "HTTP POST Status = %d, format = %s", status_code,
+                 response.decoder.format == WIRE_FORMAT_BINARY ? "binary" : "json");
 
-                storage_set_blob(day_times_key, day_times, day_times_size);
+        esp_err_t parse_err = wire_decoder_end(&response.decoder);
+        bool schedule_valid = wire_decoder_schedule_valid(&response.decoder);
 
-                free(day_times);
-                free(day_times_key);
+        if (status_code == 200 && parse_err == ESP_OK) {
+            if (!schedule_valid) {
+                ESP_LOGE(TAG, "A day has more than %d times; cannot store schedule", SCHEDULE_MAX_DAY_TIMES);
             }
 
-            uint32_t sig_rains_length = cJSON_GetArraySize(sig_rains_json);
-            size_t sig_rains_size = sig_rains_length * sizeof(uint8_t);
-            uint8_t *sig_rains = malloc(sig_rains_size);
+            memcpy(&settings.schedule, &schedule, sizeof(schedule_t));
+            settings.has_schedule = schedule_valid;
+            strcpy(settings.schedule_etag, schedule_valid ? response.etag : "");
+            settings_save(&settings);
 
-            for (int i = 0; i < sig_rains_length; i++) {
-                uint8_t sig_rain = (uint8_t) cJSON_IsTrue(cJSON_GetArrayItem(sig_rains_json, i));
-                sig_rains[i] = sig_rain;
+            if (schedule_valid) {
+                schedule_cache_store(&schedule);
+            } else {
+                schedule_cache_invalidate();
             }
-
-            storage_set_blob(STORAGE_SIG_RAINS, sig_rains, sig_rains_size);
-
-            free(sig_rains);
-            cJSON_Delete(json);
         } else {
-            reset_sig_rains();
+            if (status_code == 200) {
+                ESP_LOGE(TAG, "Malformed irrigation settings: %s", esp_err_to_name(parse_err));
+            }
+
+            reset_sig_rains(&settings);
         }
     } else {
         ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(http_err));
-        reset_sig_rains();
+        reset_sig_rains(&settings);
     }
-
-    free(DATA);
-    esp_http_client_cleanup(client);
-    xEventGroupSetBits(irrigation_settings_event_group, irrigation_settings_fetched_event);
-    vTaskDelete(NULL);
 }
 
-void api_get_irrigation_settings() {
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    irrigation_settings_event_group = xEventGroupCreate();
+typedef struct {
+    uint8_t *der;
+    size_t capacity;
+    size_t length;
+} cert_download_t;
 
-    xTaskCreate(&get_irrigation_settings, "get_irrigation_settings", 8192, NULL, 5, NULL);
-    xEventGroupWaitBits(irrigation_settings_event_group, irrigation_settings_fetched_event, false, true, portMAX_DELAY);
-    ESP_ERROR_CHECK(esp_event_loop_delete_default());
-}
+static esp_err_t feed_cert(void *user_data, const char *data, size_t length) {
+    cert_download_t *download = user_data;
 
-static void get_firmware_update_url() {
-    uint8_t version;
-    esp_err_t version_err = storage_get_u8(STORAGE_VERSION, &version);
-    if (version_err != ESP_OK) {
-        ESP_LOGE(TAG, "Error getting version from storage: %s", esp_err_to_name(version_err));
-        
-        vTaskDelete(NULL);
+    if (download->length + length > download->capacity) {
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    ESP_LOGI(TAG, "Fetched version from NVS; attempting to get firmware update url from server");
+    memcpy(download->der + download->length, data, length);
+    download->length += length;
 
-    const char *URL = "https://us-central1-animal-farm-e321d.cloudfunctions.net/getFirmwareUpdateUrl";
-    const char *data_holder = "{\"version\":\"%d\"}";
+    return ESP_OK;
+}
 
-    char *DATA = malloc(strlen(data_holder) + sizeof(uint8_t) + 1);
-    sprintf(DATA, data_holder, version);
+esp_err_t api_get_firmware_cert(const api_firmware_update_t *firmware_update, uint8_t *der, size_t *length) {
+    // The stored CA is checked against the fingerprint, so a changed CA is noticed without a request
+    size_t stored_length = *length;
+    if (storage_get_blob(STORAGE_OTA_CERT, der, &stored_length) == ESP_OK &&
+        cert_matches(der, stored_length, firmware_update->cert_sha256)) {
+        *length = stored_length;
 
-    ESP_LOGI(TAG, "Posting data to getFirmwareUpdateUrl: %s", DATA);
+        return ESP_OK;
+    }
 
-    char firmware_update_buffer[MAX_HTTP_OUTPUT_BUFFER] = {0};
+    char fingerprint[2 * CHECKSUM_SHA256_LENGTH + 1];
+    format_sha256(firmware_update->cert_sha256, fingerprint);
 
-    esp_http_client_config_t config = {
-        .url = URL,
-        .method = HTTP_METHOD_POST,
-        .event_handler = _http_event_handler,
-        .user_data = firmware_update_buffer,
-        .timeout_ms = 10000
+    char url[192];
+    snprintf(url, sizeof(url), "%s?sha256=%s", FIRMWARE_CERT_URL, fingerprint);
+
+    ESP_LOGI(TAG, "Firmware CA changed; downloading %s", fingerprint);
+
+    cert_download_t download = {
+        .der = der,
+        .capacity = *length
     };
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    hal_http_request_t request = {
+        .url = url,
+        .post = false,
+        .timeout_ms = 10000,
+        .on_data = feed_cert,
+        .user_data = &download
+    };
 
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_field(client, DATA, strlen(DATA));
+    int status_code = 0;
+    esp_err_t http_err = api_perform(&request, &status_code);
+    if (http_err != ESP_OK) {
+        ESP_LOGE(TAG, "Firmware CA request failed: %s", esp_err_to_name(http_err));
 
-    esp_err_t http_err = esp_http_client_perform(client);
-    if (http_err == ESP_OK) {
-        int status_code = esp_http_client_get_status_code(client);
-        int content_length = esp_http_client_get_content_length(client);
-        ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %d", status_code, content_length);
+        return http_err;
+    }
 
-        if (status_code == 200) {
-            ESP_LOGI(TAG, "HTTP DATA = %s", firmware_update_buffer);
+    if (status_code != 200) {
+        ESP_LOGE(TAG, "Firmware CA request returned status %d", status_code);
 
-            firmware_update = cJSON_Parse(firmware_update_buffer);
-        }
+        return ESP_ERR_INVALID_RESPONSE;
     }
 
-    free(DATA);
-    esp_http_client_cleanup(client);
-    xEventGroupSetBits(firmware_update_url_event_group, firmware_update_url_fetched_event);
-    vTaskDelete(NULL);
-}
+    if (!cert_matches(der, download.length, firmware_update->cert_sha256)) {
+        ESP_LOGE(TAG, "Firmware CA does not match its fingerprint");
 
-cJSON *api_get_firmware_update_url() {
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    firmware_update_url_event_group = xEventGroupCreate();
+        return ESP_ERR_INVALID_CRC;
+    }
 
-    xTaskCreate(&get_firmware_update_url, "get_firmware_update_url", 8192, NULL, 5, NULL);
-    xEventGroupWaitBits(firmware_update_url_event_group, firmware_update_url_fetched_event, false, true, portMAX_DELAY);
-    ESP_ERROR_CHECK(esp_event_loop_delete_default());
+    storage_set_blob(STORAGE_OTA_CERT, der, download.length);
+    *length = download.length;
 
-    return firmware_update;
-}
\ No newline at end of file
+    return ESP_OK;
+}
+
+void api_open_session() {
+    if (session == NULL) {
+        session = hal_http_session_open();
+    }
+}
+
+void api_close_session() {
+    hal_http_session_close(session);
+    session = NULL;
+}
@@ -1,5 +1,46 @@
-#include <cJSON.h>
+#ifndef __API_H__
+#define __API_H__
 
-void api_get_irrigation_settings();
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
-cJSON *api_get_firmware_update_url();
\ No newline at end of file
+#include "esp_err.h"
+
+#include "checksum.h"
+
+#define API_FIRMWARE_URL_LENGTH 256
+#define API_FIRMWARE_CERT_LENGTH 2048
+
+/* Where to get a newer firmware, when the server has one. `patch_url`, when
+ * not empty, is a patch against the running firmware (see delta.h). The
+ * firmware host's CA comes only as the SHA-256 of its DER; see
+ * api_get_firmware_cert. */
+typedef struct {
+    bool available;
+    char url[API_FIRMWARE_URL_LENGTH];
+    char patch_url[API_FIRMWARE_URL_LENGTH];
+    uint8_t cert_sha256[CHECKSUM_SHA256_LENGTH];
+} api_firmware_update_t;
+
+/* Brackets the API requests of one online session, which then share a
+ * kept-alive connection. Requests outside a session connect on their own. */
+void api_open_session();
+
+void api_close_session();
+
+/*
+ * The online wake's settings and firmware round trip: posts the firmware version, user
+ * and zone (and the applied schedule's ETag), stores any new irrigation
+ * settings and fills in `firmware_update`. `server_time` is the response's
+ * Date, or 0 without a usable response.
+ */
+void api_sync(api_firmware_update_t *firmware_update, time_t *server_time);
+
+/* The DER of the CA named by `firmware_update`, from NVS when the stored one
+ * has that fingerprint, and otherwise downloaded once and stored. `length` is
+ * der's capacity on the way in. */
+esp_err_t api_get_firmware_cert(const api_firmware_update_t *firmware_update, uint8_t *der, size_t *length);
+
+#endif
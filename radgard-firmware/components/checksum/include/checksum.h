@@ -0,0 +1,35 @@
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CHECKSUM_CRC32_INIT 0
+
+/*
+ * CRC-32 (IEEE 802.3, reflected). Pass CHECKSUM_CRC32_INIT as `crc` for the
+ * first chunk and the previous result for every following chunk.
+ */
+uint32_t checksum_crc32(uint32_t crc, const void *data, size_t size);
+
+/*
+ * SHA-256 (FIPS 180-4). In software rather than the hardware engine, so that
+ * a hash in progress is a plain struct that can wait in RTC memory for the
+ * next wake.
+ */
+
+#define CHECKSUM_SHA256_LENGTH 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t size;
+    uint8_t block[64];
+} checksum_sha256_t;
+
+void checksum_sha256_begin(checksum_sha256_t *sha);
+
+void checksum_sha256_update(checksum_sha256_t *sha, const void *data, size_t size);
+
+void checksum_sha256_end(checksum_sha256_t *sha, uint8_t digest[CHECKSUM_SHA256_LENGTH]);
+
+#endif
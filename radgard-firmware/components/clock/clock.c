@@ -0,0 +1,118 @@
+#include <stddef.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+// Host builds keep the "RTC" region in ordinary memory
+#define RTC_DATA_ATTR
+#endif
+
+#include <esp_log.h>
+
+#include "checksum.h"
+#include "hal.h"
+#include "clock.h"
+
+static const char *TAG = "clock";
+
+// Before its first sync the RTC counts from 1970
+#define CLOCK_VALID_AFTER 1704067200 // 2024-01-01
+// The Date header has a one second resolution
+#define CLOCK_TOLERANCE_S 2
+// Over shorter spans the one second resolution swamps the drift
+#define CLOCK_MIN_MEASURE_S (6 * 3600)
+// The 150 kHz RC oscillator is specified to ±5%
+#define CLOCK_MAX_CORRECTION_PPM 50000
+// How far the RTC may be off between syncs, before and after the first measurement
+#define CLOCK_UNCALIBRATED_DRIFT_PPM 500
+#define CLOCK_CALIBRATED_DRIFT_PPM 100
+#define CLOCK_MAX_DRIFT_S 30
+
+typedef struct {
+    time_t last_sync;
+    int32_t offset_s; // true time minus the clock, left in place by the last sync
+    int32_t correction_ppm;
+    int32_t residual_ppm;
+    bool calibrated;
+    uint32_t crc;
+} clock_state_t;
+
+static RTC_DATA_ATTR clock_state_t state;
+
+static uint32_t state_crc() {
+    return checksum_crc32(CHECKSUM_CRC32_INIT, &state, offsetof(clock_state_t, crc));
+}
+
+void clock_restore() {
+    // Power-on: RTC memory holds garbage and the clock is unset
+    if (state.crc != state_crc()) {
+        memset(&state, 0, sizeof(clock_state_t));
+        state.crc = state_crc();
+    }
+
+    if (state.correction_ppm != 0) {
+        hal_clock_set_rtc_correction(state.correction_ppm);
+    }
+}
+
+void clock_sync(time_t true_time) {
+    time_t now = hal_clock_now();
+    int64_t offset = (int64_t) true_time - now;
+    int64_t elapsed = (int64_t) true_time - state.last_sync;
+
+    if (state.last_sync >= CLOCK_VALID_AFTER && now >= CLOCK_VALID_AFTER && elapsed >= CLOCK_MIN_MEASURE_S) {
+        // The RTC ran fast when the clock is ahead of true time
+        int64_t drift_s = state.offset_s - offset;
+        state.residual_ppm = (int32_t) (drift_s * 1000000 / elapsed);
+
+        // The first measurement is taken whole; later ones are averaged in against the one second resolution
+        int32_t correction = state.correction_ppm + (state.calibrated ? state.residual_ppm / 2 : state.residual_ppm);
+        if (correction > CLOCK_MAX_CORRECTION_PPM) {
+            correction = CLOCK_MAX_CORRECTION_PPM;
+        } else if (correction < -CLOCK_MAX_CORRECTION_PPM) {
+            correction = -CLOCK_MAX_CORRECTION_PPM;
+        }
+
+        ESP_LOGI(TAG, "RTC drifted %+lld s in %lld s (%+d ppm); correction %+d -> %+d ppm", (long long) drift_s,
+                 (long long) elapsed, state.residual_ppm, state.correction_ppm, correction);
+
+        state.correction_ppm = correction;
+        state.calibrated = true;
+        hal_clock_set_rtc_correction(correction);
+    }
+
+    if (offset >= CLOCK_TOLERANCE_S || offset <= -CLOCK_TOLERANCE_S) {
+        ESP_LOGI(TAG, "Setting the clock (%+lld s)", (long long) offset);
+        hal_clock_set(true_time);
+        offset = 0;
+    }
+
+    state.last_sync = true_time;
+    state.offset_s = (int32_t) offset;
+    state.crc = state_crc();
+}
+
+bool clock_sync_due() {
+    time_t now = hal_clock_now();
+    if (now < CLOCK_VALID_AFTER || state.last_sync == 0) {
+        return true;
+    }
+
+    int64_t drift_ppm = state.calibrated ? CLOCK_CALIBRATED_DRIFT_PPM : CLOCK_UNCALIBRATED_DRIFT_PPM;
+
+    return (int64_t) (now - state.last_sync) * drift_ppm / 1000000 > CLOCK_MAX_DRIFT_S;
+}
+
+void clock_get_drift(clock_drift_t *drift) {
+    drift->correction_ppm = state.correction_ppm;
+    drift->residual_ppm = state.residual_ppm;
+    drift->last_sync = state.last_sync;
+}
+
+void clock_reset() {
+    memset(&state, 0, sizeof(clock_state_t));
+    state.crc = state_crc();
+
+    hal_clock_set_rtc_correction(0);
+}
@@ -0,0 +1,32 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Keeps the RTC on time across deep sleep. Every sync with a true time
+ * measures how far the RTC drifted since the previous one and refines a
+ * correction, which the HAL applies to the clock and so to every sleep. */
+
+typedef struct {
+    int32_t correction_ppm; // how much faster than real time the uncorrected RTC runs
+    int32_t residual_ppm;   // drift measured at the last sync, with the correction applied
+    time_t last_sync;
+} clock_drift_t;
+
+// Re-applies the correction, which the boot-time calibration of the RTC replaces
+void clock_restore();
+
+// Sets the clock to `true_time`, first measuring the drift when the last sync is long enough ago
+void clock_sync(time_t true_time);
+
+// Whether the RTC is unset or may have drifted too far since the last sync
+bool clock_sync_due();
+
+void clock_get_drift(clock_drift_t *drift);
+
+// Forgets the syncs and the correction, as at power-on
+void clock_reset();
+
+#endif
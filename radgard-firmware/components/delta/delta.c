@@ -0,0 +1,300 @@
+#include <string.h>
+
+#include "delta.h"
+
+/*
+ * Like the binary settings decoder, a walk along the patch's fields with
+ * varints carried over between chunks in `varint`/`varint_shift`. Copies
+ * from the old image go through a block on the stack.
+ */
+
+#define DELTA_BLOCK_LENGTH 256
+
+typedef enum {
+    FIELD_HEADER,
+    FIELD_COPY_LENGTH,
+    FIELD_EXTRA_LENGTH,
+    FIELD_SEEK,
+    FIELD_SAME,
+    FIELD_CHANGED,
+    FIELD_CHANGED_BYTES,
+    FIELD_EXTRA_BYTES,
+    FIELD_DONE
+} field_t;
+
+static int32_t unzigzag(uint32_t value) {
+    return (int32_t) ((value >> 1) ^ -(value & 1));
+}
+
+static uint32_t get_u32(const uint8_t *bytes) {
+    return bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+static void fail(delta_patcher_t *patcher, esp_err_t err) {
+    if (patcher->err == ESP_OK) {
+        patcher->err = err;
+    }
+}
+
+static void write_target(delta_patcher_t *patcher, const delta_io_t *io, const uint8_t *data, size_t length) {
+    checksum_sha256_update(&patcher->target_sha256, data, length);
+    patcher->target_written += length;
+
+    esp_err_t err = io->write_target(io->user_data, data, length);
+    if (err != ESP_OK) {
+        fail(patcher, err);
+    }
+}
+
+// Reads the next `length` bytes of the old image into `block`, at most DELTA_BLOCK_LENGTH
+static bool read_source(delta_patcher_t *patcher, const delta_io_t *io, uint8_t *block, size_t length) {
+    if (length > patcher->source_length - patcher->source_position) {
+        fail(patcher, ESP_ERR_INVALID_SIZE);
+        return false;
+    }
+
+    esp_err_t err = io->read_source(io->user_data, patcher->source_position, block, length);
+    if (err != ESP_OK) {
+        fail(patcher, err);
+        return false;
+    }
+
+    patcher->source_position += length;
+
+    return true;
+}
+
+static void copy_same(delta_patcher_t *patcher, const delta_io_t *io, uint32_t length) {
+    uint8_t block[DELTA_BLOCK_LENGTH];
+
+    while (length > 0 && patcher->err == ESP_OK) {
+        size_t take = length < DELTA_BLOCK_LENGTH ? length : DELTA_BLOCK_LENGTH;
+        if (read_source(patcher, io, block, take)) {
+            write_target(patcher, io, block, take);
+        }
+
+        length -= take;
+    }
+}
+
+static void header_done(delta_patcher_t *patcher, const delta_io_t *io) {
+    const uint8_t *header = patcher->header;
+
+    if (memcmp(header, DELTA_MAGIC, 4) != 0) {
+        fail(patcher, ESP_ERR_INVALID_RESPONSE);
+        return;
+    }
+
+    if (header[4] != DELTA_VERSION) {
+        fail(patcher, ESP_ERR_INVALID_VERSION);
+        return;
+    }
+
+    patcher->source_length = get_u32(header + 8);
+    patcher->target_length = get_u32(header + 12);
+
+    // A patch only fits the image it was made against
+    checksum_sha256_t source_sha256;
+    checksum_sha256_begin(&source_sha256);
+
+    uint8_t block[DELTA_BLOCK_LENGTH];
+    while (patcher->source_position < patcher->source_length && patcher->err == ESP_OK) {
+        uint32_t remaining = patcher->source_length - patcher->source_position;
+        size_t take = remaining < DELTA_BLOCK_LENGTH ? remaining : DELTA_BLOCK_LENGTH;
+        if (read_source(patcher, io, block, take)) {
+            checksum_sha256_update(&source_sha256, block, take);
+        }
+    }
+
+    uint8_t digest[CHECKSUM_SHA256_LENGTH];
+    checksum_sha256_end(&source_sha256, digest);
+    if (patcher->err == ESP_OK && memcmp(digest, header + 16, CHECKSUM_SHA256_LENGTH) != 0) {
+        fail(patcher, ESP_ERR_INVALID_CRC);
+    }
+
+    patcher->source_position = 0;
+    patcher->field = patcher->target_length == 0 ? FIELD_DONE : FIELD_COPY_LENGTH;
+}
+
+static void record_done(delta_patcher_t *patcher) {
+    patcher->field = patcher->target_written == patcher->target_length ? FIELD_DONE : FIELD_COPY_LENGTH;
+}
+
+static void copy_done(delta_patcher_t *patcher) {
+    int64_t position = (int64_t) patcher->source_position + patcher->seek;
+    if (position < 0 || position > patcher->source_length) {
+        fail(patcher, ESP_ERR_INVALID_SIZE);
+        return;
+    }
+
+    patcher->source_position = (uint32_t) position;
+
+    if (patcher->extra_remaining > 0) {
+        patcher->field = FIELD_EXTRA_BYTES;
+    } else {
+        record_done(patcher);
+    }
+}
+
+static void run_done(delta_patcher_t *patcher) {
+    if (patcher->copy_remaining > 0) {
+        patcher->field = FIELD_SAME;
+    } else {
+        copy_done(patcher);
+    }
+}
+
+static void varint_done(delta_patcher_t *patcher, const delta_io_t *io, uint32_t value) {
+    switch (patcher->field) {
+        case FIELD_COPY_LENGTH:
+            patcher->copy_remaining = value;
+            patcher->field = FIELD_EXTRA_LENGTH;
+            break;
+        case FIELD_EXTRA_LENGTH:
+            patcher->extra_remaining = value;
+            if ((uint64_t) patcher->target_written + patcher->copy_remaining + value > patcher->target_length) {
+                fail(patcher, ESP_ERR_INVALID_SIZE);
+            }
+
+            patcher->field = FIELD_SEEK;
+            break;
+        case FIELD_SEEK:
+            patcher->seek = unzigzag(value);
+            run_done(patcher);
+            break;
+        case FIELD_SAME:
+            if (value > patcher->copy_remaining) {
+                fail(patcher, ESP_ERR_INVALID_SIZE);
+                break;
+            }
+
+            patcher->copy_remaining -= value;
+            copy_same(patcher, io, value);
+            patcher->field = FIELD_CHANGED;
+            break;
+        case FIELD_CHANGED:
+            if (value > patcher->copy_remaining) {
+                fail(patcher, ESP_ERR_INVALID_SIZE);
+                break;
+            }
+
+            patcher->copy_remaining -= value;
+            patcher->changed_remaining = value;
+            if (value > 0) {
+                patcher->field = FIELD_CHANGED_BYTES;
+            } else {
+                run_done(patcher);
+            }
+
+            break;
+        default:
+            break;
+    }
+}
+
+void delta_patcher_begin(delta_patcher_t *patcher) {
+    memset(patcher, 0, sizeof(delta_patcher_t));
+    patcher->field = FIELD_HEADER;
+    patcher->err = ESP_OK;
+    checksum_sha256_begin(&patcher->target_sha256);
+}
+
+esp_err_t delta_patcher_feed(delta_patcher_t *patcher, const delta_io_t *io, const uint8_t *data, size_t length) {
+    size_t i = 0;
+
+    while (i < length && patcher->err == ESP_OK) {
+        size_t available = length - i;
+
+        switch (patcher->field) {
+            case FIELD_HEADER: {
+                size_t take = DELTA_HEADER_LENGTH - patcher->header_length;
+                take = take < available ? take : available;
+
+                memcpy(patcher->header + patcher->header_length, data + i, take);
+                patcher->header_length += take;
+                i += take;
+
+                if (patcher->header_length == DELTA_HEADER_LENGTH) {
+                    header_done(patcher, io);
+                }
+
+                continue;
+            }
+            case FIELD_CHANGED_BYTES: {
+                uint8_t block[DELTA_BLOCK_LENGTH];
+                size_t take = patcher->changed_remaining < available ? patcher->changed_remaining : available;
+                take = take < DELTA_BLOCK_LENGTH ? take : DELTA_BLOCK_LENGTH;
+
+                if (read_source(patcher, io, block, take)) {
+                    for (size_t j = 0; j < take; j++) {
+                        block[j] += data[i + j];
+                    }
+
+                    write_target(patcher, io, block, take);
+                }
+
+                i += take;
+                patcher->changed_remaining -= take;
+                if (patcher->changed_remaining == 0) {
+                    run_done(patcher);
+                }
+
+                continue;
+            }
+            case FIELD_EXTRA_BYTES: {
+                size_t take = patcher->extra_remaining < available ? patcher->extra_remaining : available;
+
+                write_target(patcher, io, data + i, take);
+
+                i += take;
+                patcher->extra_remaining -= take;
+                if (patcher->extra_remaining == 0) {
+                    record_done(patcher);
+                }
+
+                continue;
+            }
+            case FIELD_DONE:
+                fail(patcher, ESP_ERR_INVALID_SIZE);
+                continue;
+            default:
+                break;
+        }
+
+        uint8_t byte = data[i++];
+
+        // At most 5 bytes, the last carrying the top 4 bits
+        if (patcher->varint_shift == 28 && (byte & 0xf0) != 0) {
+            fail(patcher, ESP_ERR_INVALID_SIZE);
+            continue;
+        }
+
+        patcher->varint |= (uint32_t) (byte & 0x7f) << patcher->varint_shift;
+        if (byte & 0x80) {
+            patcher->varint_shift += 7;
+            continue;
+        }
+
+        uint32_t value = patcher->varint;
+        patcher->varint = 0;
+        patcher->varint_shift = 0;
+        varint_done(patcher, io, value);
+    }
+
+    return patcher->err;
+}
+
+esp_err_t delta_patcher_end(delta_patcher_t *patcher) {
+    if (patcher->err != ESP_OK) {
+        return patcher->err;
+    }
+
+    if (patcher->field != FIELD_DONE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t digest[CHECKSUM_SHA256_LENGTH];
+    checksum_sha256_end(&patcher->target_sha256, digest);
+
+    return memcmp(digest, patcher->header + 48, CHECKSUM_SHA256_LENGTH) == 0 ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
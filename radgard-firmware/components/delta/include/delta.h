@@ -0,0 +1,88 @@
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <esp_err.h>
+
+#include "checksum.h"
+
+/*
+ * Applies a firmware patch: rebuilds the new image from the running one and
+ * a patch fed chunk by chunk as it downloads. The new image is written
+ * strictly in order and the old one is read through small blocks, so the
+ * only state is the patcher struct itself, which may be kept in RTC memory
+ * to continue the patch on a later wake.
+ *
+ * Patch format, little-endian, numbers after the header LEB128 varints
+ * (signed ones zigzag encoded first), in the spirit of bsdiff:
+ *
+ *   "RDLT"                 magic
+ *   byte version           DELTA_VERSION
+ *   3 bytes                zero
+ *   u32 source_length      old image the patch was made against
+ *   u32 target_length
+ *   32 bytes               SHA-256 of the old image
+ *   32 bytes               SHA-256 of the new image
+ *   records, until target_length bytes are written:
+ *     copy_length          bytes taken from the old image, at the source position...
+ *     extra_length         ...then bytes taken from the patch
+ *     zigzag seek          moves the source position, after the copy
+ *     runs, until copy_length bytes are covered:
+ *       same               bytes copied from the old image as they are
+ *       changed            bytes of the old image with a difference added...
+ *       changed x byte     ...each modulo 256
+ *     extra_length x byte
+ */
+
+#define DELTA_MAGIC "RDLT"
+#define DELTA_VERSION 1
+#define DELTA_HEADER_LENGTH 80
+
+typedef struct {
+    // Reads the old image
+    esp_err_t (*read_source)(void *user_data, uint32_t offset, uint8_t *data, size_t length);
+    // Appends to the new image
+    esp_err_t (*write_target)(void *user_data, const uint8_t *data, size_t length);
+    void *user_data;
+} delta_io_t;
+
+typedef struct {
+    uint8_t field;
+    uint32_t varint;
+    uint8_t varint_shift;
+
+    uint8_t header[DELTA_HEADER_LENGTH];
+    uint8_t header_length;
+    uint32_t source_length;
+    uint32_t target_length;
+
+    uint32_t copy_remaining;
+    uint32_t extra_remaining;
+    uint32_t same_remaining;
+    uint32_t changed_remaining;
+    int32_t seek;
+    uint32_t source_position;
+
+    uint32_t target_written;
+    checksum_sha256_t target_sha256;
+
+    esp_err_t err;
+} delta_patcher_t;
+
+void delta_patcher_begin(delta_patcher_t *patcher);
+
+/*
+ * Consumes the patch, writing out the new image as far as it goes. The old
+ * image is checked against the header before the first record. Stops
+ * consuming input once an error is hit; the error is reported again by
+ * delta_patcher_end.
+ */
+esp_err_t delta_patcher_feed(delta_patcher_t *patcher, const delta_io_t *io, const uint8_t *data, size_t length);
+
+// ESP_OK once the whole new image was written and matches the header's SHA-256
+esp_err_t delta_patcher_end(delta_patcher_t *patcher);
+
+#endif
@@ -0,0 +1,358 @@
+#include <string.h>
+#include <math.h>
+
+#include <esp_log.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_attr.h>
+#else
+// Host builds keep the "RTC" region in ordinary memory
+#define RTC_DATA_ATTR
+#endif
+
+#include "hal.h"
+#include "storage.h"
+#include "settings.h"
+#include "schedule.h"
+#include "profile.h"
+#include "clock.h"
+
+#include "board.h"
+#include "device.h"
+
+static const char *TAG = "device";
+
+static const uint8_t GPIO_SD_IN1 = BOARD_GPIO_SD_IN1;
+static const uint8_t GPIO_SD_IN2 = BOARD_GPIO_SD_IN2;
+static const uint8_t GPIO_BSTC = BOARD_GPIO_BSTC;
+static const uint8_t GPIO_S_OPEN = BOARD_GPIO_S_OPEN;
+static const uint8_t GPIO_MAN = BOARD_GPIO_MAN;
+static const uint8_t GPIO_RST = BOARD_GPIO_RST;
+
+#define GPIO_WAKEUP_PINS_BITMASK 0x300000000
+
+// Background work ends this long before the valve closes, so the close never waits on it
+#define BACKGROUND_CLOSE_MARGIN_S 30
+// How long background work that overran the close may hold off deep sleep
+#define BACKGROUND_OVERRUN_MS 30000
+
+// Cleared once manual_on is known to be off in the settings record so valve closes skip flash
+static RTC_DATA_ATTR bool manual_on_stored = true;
+
+static void forget_rtc_state() {
+    manual_on_stored = true;
+    clock_reset();
+}
+
+static void hold_en_gpio_pins() {
+    hal_gpio_hold(GPIO_SD_IN1, true);
+    hal_gpio_hold(GPIO_SD_IN2, true);
+    hal_gpio_hold(GPIO_BSTC, true);
+    hal_gpio_hold(GPIO_S_OPEN, true);
+
+    hal_gpio_deep_sleep_hold();
+}
+
+static void hold_dis_gpio_pins() {
+    hal_gpio_hold(GPIO_SD_IN1, false);
+    hal_gpio_hold(GPIO_SD_IN2, false);
+    hal_gpio_hold(GPIO_BSTC, false);
+    hal_gpio_hold(GPIO_S_OPEN, false);
+}
+
+static void setup_gpio_pins() {
+    hal_gpio_set_output(GPIO_SD_IN1);
+    hal_gpio_set_output(GPIO_SD_IN2);
+    hal_gpio_set_output(GPIO_BSTC);
+    hal_gpio_set_output(GPIO_S_OPEN);
+    hal_gpio_set_input(GPIO_MAN);
+    hal_gpio_set_input(GPIO_RST);
+
+    hal_gpio_set_level(GPIO_SD_IN1, 0);
+    hal_gpio_set_level(GPIO_SD_IN2, 0);
+    hal_gpio_set_level(GPIO_BSTC, 0);
+    hal_gpio_set_level(GPIO_S_OPEN, 0);
+}
+
+static bool load_schedule(schedule_t *schedule) {
+    if (schedule_cache_load(schedule)) {
+        return true;
+    }
+
+    ESP_LOGI(TAG, "Schedule not in RTC memory - loading irrigation settings from NVS");
+
+    radgard_settings_t settings;
+    if (settings_load(&settings) != ESP_OK || !settings.has_schedule) {
+        return false;
+    }
+
+    memcpy(schedule, &settings.schedule, sizeof(schedule_t));
+    schedule_cache_store(schedule);
+
+    return true;
+}
+
+static uint64_t determine_sleep_time() {
+    uint64_t sleep_time_secs = 0;
+
+    time_t now = hal_clock_now();
+
+    schedule_t schedule;
+    bool schedule_loaded = load_schedule(&schedule);
+
+    schedule_event_t next_event;
+
+    // System time hasn't been configured properly
+    if (now < 946684800 || !schedule_loaded) {
+        // Wake up again in 30 minutes to set system time or get irrigation settings
+        sleep_time_secs = 1800;
+
+        next_event.time = now + sleep_time_secs;
+        next_event.action = SCHEDULE_ACTION_NONE;
+        schedule_cache_set_next_event(&next_event);
+
+        ESP_LOGI(TAG, "Sleep time: %llu", (unsigned long long) sleep_time_secs);
+    } else {
+        schedule_next_event(&schedule, now, &next_event);
+
+        // Wake up at 01:30 for irrigation fetch, consuming today's sig_rains flag
+        uint8_t day = schedule_get_day(&schedule, now);
+        if (next_event.action == SCHEDULE_ACTION_NONE && schedule.sig_rains[day]) {
+            schedule.sig_rains[day] = 0;
+
+            radgard_settings_t settings;
+            if (settings_load(&settings) == ESP_OK && settings.has_schedule) {
+                settings.schedule.sig_rains[day] = 0;
+                // The schedule no longer matches the server's copy, so the next fetch must not be conditional
+                settings.schedule_etag[0] = '\0';
+                settings_save(&settings);
+            }
+
+            schedule_cache_store(&schedule);
+        }
+
+        schedule_cache_set_next_event(&next_event);
+
+        sleep_time_secs = next_event.time - now;
+        ESP_LOGI(TAG, "Sleep time: %u - %llu = %llu", next_event.time, (unsigned long long) now, (unsigned long long) sleep_time_secs);
+    }
+
+    return sleep_time_secs * 1000000;
+}
+
+static void open_solenoid() {
+    hal_gpio_set_level(GPIO_BSTC, 1);
+
+    hal_delay_ms(BOARD_SOLENOID_PULSE_MS);
+
+    hal_gpio_set_level(GPIO_BSTC, 0);
+    hal_gpio_set_level(GPIO_SD_IN1, 1);
+    
+    hal_delay_ms(BOARD_SOLENOID_PULSE_MS);
+
+    hal_gpio_set_level(GPIO_SD_IN1, 0);
+    hal_gpio_set_level(GPIO_S_OPEN, 1);
+}
+
+static void close_solenoid() {
+    hal_gpio_set_level(GPIO_BSTC, 1);
+
+    hal_delay_ms(BOARD_SOLENOID_PULSE_MS);
+
+    hal_gpio_set_level(GPIO_BSTC, 0);
+    hal_gpio_set_level(GPIO_SD_IN2, 1);
+
+    hal_delay_ms(BOARD_SOLENOID_PULSE_MS);
+
+    hal_gpio_set_level(GPIO_SD_IN2, 0);
+    hal_gpio_set_level(GPIO_S_OPEN, 0);
+
+    if (manual_on_stored) {
+        radgard_settings_t settings;
+        if (settings_load(&settings) == ESP_OK && settings.manual_on) {
+            settings.manual_on = 0;
+            settings_save(&settings);
+        }
+
+        manual_on_stored = false;
+    }
+}
+
+/* Runs `background` while the valve that was just opened is open. The close
+ * is this wake's to fire if the work is still going when it falls due.
+ * Returns false if the work would not stop. */
+static bool run_background(const device_background_t *background, const schedule_t *schedule) {
+    time_t now = hal_clock_now();
+
+    schedule_event_t close;
+    schedule_next_event(schedule, now, &close);
+    if (close.action != SCHEDULE_ACTION_CLOSE || close.time <= now + BACKGROUND_CLOSE_MARGIN_S) {
+        return true;
+    }
+
+    int64_t close_us = hal_clock_monotonic_us() + (int64_t) (close.time - now) * 1000000;
+    if (!background->start(close_us - (int64_t) BACKGROUND_CLOSE_MARGIN_S * 1000000)) {
+        return true;
+    }
+
+    ESP_LOGI(TAG, "Running background work until the valve closes at %u", close.time);
+
+    if (background->wait(close_us)) {
+        return true;
+    }
+
+    ESP_LOGW(TAG, "Background work still running at the valve's close; stopping it and closing on time");
+    background->stop();
+
+    setup_gpio_pins();
+    hold_dis_gpio_pins();
+    close_solenoid();
+    hold_en_gpio_pins();
+
+    if (!background->wait(hal_clock_monotonic_us() + (int64_t) BACKGROUND_OVERRUN_MS * 1000)) {
+        ESP_LOGE(TAG, "Background work did not stop; sleeping anyway");
+
+        return false;
+    }
+
+    return true;
+}
+
+void device_wake(device_online_t go_online, const device_background_t *background, device_sleep_t *sleep) {
+    bool background_stopped = true;
+
+    storage_add_reset_hook(forget_rtc_state);
+
+    hal_wake_cause_t wakeup_cause = hal_sleep_wake_cause();
+    profile_begin_wake(wakeup_cause);
+
+    // Boot recalibrated the RTC; correct it again before this wake times its sleep
+    clock_restore();
+
+    time_t now = hal_clock_now();
+    ESP_LOGI(TAG, "Current time: %ld", (long) now);
+
+    if (wakeup_cause == HAL_WAKE_GPIO) {
+        uint64_t gpio_wakeup_pin_mask = hal_sleep_wake_gpio_mask();
+        uint64_t gpio_wakeup_pin = log(gpio_wakeup_pin_mask) / log(2);
+
+        ESP_LOGI(TAG, "Starting system from deep sleep - wake up from GPIO %llu", (unsigned long long) gpio_wakeup_pin);
+
+        if (gpio_wakeup_pin == GPIO_MAN) {
+            // GPIO 32 (MAN pin) -- enable/disable manual mode
+            radgard_settings_t settings;
+            esp_err_t load_err = settings_load(&settings);
+
+            setup_gpio_pins();
+            hold_dis_gpio_pins();
+            
+            // Check if manual mode is already on
+            if (settings.manual_on == 1) {
+                ESP_LOGI(TAG, "MAN button triggered - turning off manual mode");
+                manual_on_stored = true;
+                close_solenoid();
+            } else {
+                ESP_LOGI(TAG, "MAN button triggered - turning on manual mode");
+                if (settings_can_save(load_err)) {
+                    settings.manual_on = 1;
+                    settings_save(&settings);
+                    manual_on_stored = true;
+                } else {
+                    ESP_LOGE(TAG, "Settings unreadable (%s); manual mode lasts until the next close", esp_err_to_name(load_err));
+                }
+                open_solenoid();
+            }
+
+            hold_en_gpio_pins();
+        } else if (gpio_wakeup_pin == GPIO_RST) {
+            // GPIO 33 (RST pin) - reset the device
+            storage_reset();
+        }
+    } else if (wakeup_cause == HAL_WAKE_TIMER) {
+        // System time hasn't been configured properly
+        if (now < 946684800) {
+            ESP_LOGI(TAG, "Starting system from deep sleep - system time has not been initially set");
+            go_online();
+        } else {
+            schedule_t schedule;
+
+            if (load_schedule(&schedule)) {
+                if (schedule_in_fetch_window(&schedule, now)) {
+                    // Within daily update period [00:00 - 2:30]
+                    ESP_LOGI(TAG, "Starting system from deep sleep - fetching latest irrigation settings");
+                    go_online();
+                } else {
+                    // Turn on/off solenoid
+                    schedule_event_t pending;
+
+                    if (schedule_cache_get_next_event(&pending) && pending.action != SCHEDULE_ACTION_NONE) {
+                        setup_gpio_pins();
+                        hold_dis_gpio_pins();
+
+                        if (pending.action == SCHEDULE_ACTION_OPEN) {
+                            // Turn on solenoid
+                            ESP_LOGI(TAG, "Starting system from deep sleep - turning on solenoid");
+                            open_solenoid();
+                        } else {
+                            // Turn off solenoid
+                            ESP_LOGI(TAG, "Starting system from deep sleep - turning off solenoid");
+                            close_solenoid();
+                        }
+
+                        hold_en_gpio_pins();
+
+                        if (pending.action == SCHEDULE_ACTION_OPEN && background != NULL) {
+                            background_stopped = run_background(background, &schedule);
+                        }
+                    } else {
+                        ESP_LOGI(TAG, "Starting system from deep sleep - didn't have solenoid configuration");
+                        go_online();
+                    }
+                }
+            } else {
+                ESP_LOGI(TAG, "Starting system from deep sleep - didn't have initial server update, fetching latest irrigation settings");
+                go_online();
+            }
+        }
+    } else {
+        // Did not wake from deep sleep [physical start of system]
+        ESP_LOGI(TAG, "Starting system from physical start");
+        radgard_settings_t settings;
+        esp_err_t load_err = settings_load(&settings);
+        if (settings_can_save(load_err)) {
+            settings.firmware_version = SETTINGS_FIRMWARE_VERSION;
+            settings_save(&settings);
+        } else {
+            ESP_LOGE(TAG, "Not recording firmware version over unreadable settings: %s", esp_err_to_name(load_err));
+        }
+
+        setup_gpio_pins();
+        hold_dis_gpio_pins();
+
+        close_solenoid();
+
+        hold_en_gpio_pins();
+        go_online();
+    }
+
+    profile_phase_start(PROFILE_PHASE_SLEEP_TIME);
+    uint64_t sleep_time = determine_sleep_time();
+    profile_phase_end(PROFILE_PHASE_SLEEP_TIME);
+
+    // Work that would not stop may still be in NVS; deep sleep cuts it off like a power loss, which NVS survives
+    if (background_stopped) {
+        storage_deinit_nvs();
+    }
+    hal_sleep_enable_gpio_wake(GPIO_WAKEUP_PINS_BITMASK);
+
+    // Background work needs the next valve-open wake to be a full boot
+    schedule_event_t next_event;
+    bool background_next = background != NULL && schedule_cache_get_next_event(&next_event) &&
+                           next_event.action == SCHEDULE_ACTION_OPEN && background->pending();
+
+    sleep->time_us = sleep_time;
+    // Closing the solenoid in manual mode erases manual_on, which needs a full boot
+    sleep->stub_enabled = !manual_on_stored && !background_next;
+
+    profile_end_wake();
+}
@@ -0,0 +1,15 @@
+#ifndef __BOARD_H__
+#define __BOARD_H__
+
+// Shared with the wake stub, which cannot read constants from flash
+#define BOARD_GPIO_SD_IN1 18
+#define BOARD_GPIO_SD_IN2 19
+#define BOARD_GPIO_BSTC 5
+#define BOARD_GPIO_S_OPEN 23
+#define BOARD_GPIO_MAN 32
+#define BOARD_GPIO_RST 33
+
+// Boost converter charge and H-bridge pulse length for the latching solenoid
+#define BOARD_SOLENOID_PULSE_MS 55
+
+#endif
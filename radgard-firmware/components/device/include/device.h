@@ -0,0 +1,38 @@
+#ifndef __DEVICE_H__
+#define __DEVICE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Brings the device online and fetches the latest irrigation settings
+typedef void (*device_online_t)();
+
+/*
+ * Work that fills a scheduled irrigation wake that has the valve open: a
+ * paused firmware download. `start` runs it on another core and returns false
+ * when there is nothing to do; it gives up by `deadline_us`. `stop` asks it
+ * to give up now. `wait` returns whether it has finished by `until_us`. Times
+ * are hal_clock_monotonic_us.
+ */
+typedef struct {
+    bool (*pending)();
+    bool (*start)(int64_t deadline_us);
+    void (*stop)();
+    bool (*wait)(int64_t until_us);
+} device_background_t;
+
+typedef struct {
+    uint64_t time_us;
+    // Whether the next timer wake may be served by the wake stub
+    bool stub_enabled;
+} device_sleep_t;
+
+/*
+ * One full boot: acts on the wake cause (solenoid, MAN/RST buttons, daily
+ * fetch through `go_online`) and works out how long to sleep. The caller
+ * arms the wake stub and enters deep sleep. `background`, when not NULL, runs
+ * on valve-open wakes, which then skip the wake stub while it has work.
+ */
+void device_wake(device_online_t go_online, const device_background_t *background, device_sleep_t *sleep);
+
+#endif
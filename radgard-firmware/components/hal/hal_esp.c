@@ -0,0 +1,196 @@
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include <esp_log.h>
+#include <esp_sleep.h>
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_private/esp_clk.h"
+
+#include "driver/gpio.h"
+
+#include "nvs_flash.h"
+#include "nvs.h"
+
+#include "hal.h"
+
+static const char *TAG = "hal";
+
+int64_t hal_clock_monotonic_us() {
+    return esp_timer_get_time();
+}
+
+time_t hal_clock_now() {
+    time_t now;
+    time(&now);
+
+    return now;
+}
+
+void hal_clock_set(time_t now) {
+    struct timeval tv = { .tv_sec = now, .tv_usec = 0 };
+    settimeofday(&tv, NULL);
+}
+
+// Slow clock period measured against the crystal at boot, before any correction
+static uint32_t rtc_boot_cal = 0;
+
+void hal_clock_set_rtc_correction(int32_t ppm) {
+    if (rtc_boot_cal == 0) {
+        rtc_boot_cal = esp_clk_slowclk_cal_get();
+    }
+
+    // A longer period per tick slows the clock; the sleep timer and the wake stub read the same value
+    esp_clk_slowclk_cal_set((uint32_t) ((uint64_t) rtc_boot_cal * 1000000 / (1000000 + ppm)));
+}
+
+void hal_delay_ms(uint32_t ms) {
+    vTaskDelay(ms / portTICK_RATE_MS);
+}
+
+hal_wake_cause_t hal_sleep_wake_cause() {
+    switch (esp_sleep_get_wakeup_cause()) {
+        case ESP_SLEEP_WAKEUP_EXT1:
+            return HAL_WAKE_GPIO;
+        case ESP_SLEEP_WAKEUP_TIMER:
+            return HAL_WAKE_TIMER;
+        default:
+            return HAL_WAKE_POWER_ON;
+    }
+}
+
+uint64_t hal_sleep_wake_gpio_mask() {
+    return esp_sleep_get_ext1_wakeup_status();
+}
+
+void hal_sleep_enable_gpio_wake(uint64_t gpio_mask) {
+    esp_sleep_enable_ext1_wakeup(gpio_mask, ESP_EXT1_WAKEUP_ANY_HIGH);
+}
+
+void hal_sleep_deep(uint64_t time_us) {
+    esp_deep_sleep(time_us);
+}
+
+void hal_restart() {
+    esp_restart();
+}
+
+void hal_gpio_set_output(uint8_t gpio_num) {
+    gpio_pad_select_gpio(gpio_num);
+    gpio_set_direction(gpio_num, GPIO_MODE_OUTPUT);
+}
+
+void hal_gpio_set_input(uint8_t gpio_num) {
+    gpio_pad_select_gpio(gpio_num);
+    gpio_set_direction(gpio_num, GPIO_MODE_INPUT);
+}
+
+void hal_gpio_set_level(uint8_t gpio_num, uint8_t level) {
+    gpio_set_level(gpio_num, level);
+}
+
+void hal_gpio_hold(uint8_t gpio_num, bool enable) {
+    if (enable) {
+        gpio_hold_en(gpio_num);
+    } else {
+        gpio_hold_dis(gpio_num);
+    }
+}
+
+void hal_gpio_deep_sleep_hold() {
+    gpio_deep_sleep_hold_en();
+}
+
+static StaticSemaphore_t kv_lock_buffer;
+static SemaphoreHandle_t kv_lock = NULL;
+static portMUX_TYPE kv_lock_create = portMUX_INITIALIZER_UNLOCKED;
+
+void hal_kv_lock() {
+    taskENTER_CRITICAL(&kv_lock_create);
+    if (kv_lock == NULL) {
+        kv_lock = xSemaphoreCreateRecursiveMutexStatic(&kv_lock_buffer);
+    }
+    taskEXIT_CRITICAL(&kv_lock_create);
+
+    xSemaphoreTakeRecursive(kv_lock, portMAX_DELAY);
+}
+
+void hal_kv_unlock() {
+    xSemaphoreGiveRecursive(kv_lock);
+}
+
+esp_err_t hal_kv_init() {
+    return nvs_flash_init();
+}
+
+esp_err_t hal_kv_deinit() {
+    return nvs_flash_deinit();
+}
+
+esp_err_t hal_kv_erase_all() {
+    return nvs_flash_erase();
+}
+
+esp_err_t hal_kv_open(const char *name, bool writable, hal_kv_handle_t *handle) {
+    return nvs_open(name, writable ? NVS_READWRITE : NVS_READONLY, handle);
+}
+
+esp_err_t hal_kv_commit(hal_kv_handle_t handle) {
+    return nvs_commit(handle);
+}
+
+void hal_kv_close(hal_kv_handle_t handle) {
+    nvs_close(handle);
+}
+
+esp_err_t hal_kv_set_u8(hal_kv_handle_t handle, const char *key, uint8_t value) {
+    return nvs_set_u8(handle, key, value);
+}
+
+esp_err_t hal_kv_set_u32(hal_kv_handle_t handle, const char *key, uint32_t value) {
+    return nvs_set_u32(handle, key, value);
+}
+
+esp_err_t hal_kv_set_str(hal_kv_handle_t handle, const char *key, const char *value) {
+    return nvs_set_str(handle, key, value);
+}
+
+esp_err_t hal_kv_set_blob(hal_kv_handle_t handle, const char *key, const void *value, size_t size) {
+    return nvs_set_blob(handle, key, value, size);
+}
+
+esp_err_t hal_kv_get_u8(hal_kv_handle_t handle, const char *key, uint8_t *value) {
+    return nvs_get_u8(handle, key, value);
+}
+
+esp_err_t hal_kv_get_u32(hal_kv_handle_t handle, const char *key, uint32_t *value) {
+    return nvs_get_u32(handle, key, value);
+}
+
+esp_err_t hal_kv_get_str(hal_kv_handle_t handle, const char *key, char *value, size_t *size) {
+    return nvs_get_str(handle, key, value, size);
+}
+
+esp_err_t hal_kv_get_blob(hal_kv_handle_t handle, const char *key, void *value, size_t *size) {
+    return nvs_get_blob(handle, key, value, size);
+}
+
+esp_err_t hal_kv_erase_key(hal_kv_handle_t handle, const char *key) {
+    return nvs_erase_key(handle, key);
+}
+
+esp_err_t hal_wifi_connect() {
+    return esp_wifi_connect();
+}
+
+void hal_wifi_stop() {
+    ESP_ERROR_CHECK(esp_wifi_stop());
+    ESP_ERROR_CHECK(esp_wifi_deinit());
+    esp_netif_deinit();
+}
@@ -0,0 +1,720 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <esp_log.h>
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_crt_bundle.h"
+
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+
+#include "checksum.h"
+#include "hal.h"
+
+/*
+ * hal_http_perform: a small HTTP/1.1 client over mbedTLS. esp_http_client
+ * cannot be handed a saved TLS session, and resuming one skips the
+ * handshake's certificate verification and key exchange, the slowest single
+ * step of an online wake at 160 MHz. The last session with each host is kept
+ * in RTC memory across deep sleep and in NVS across power loss, and within a
+ * wake a session keeps its connection open between requests (keep-alive).
+ */
+
+static const char *TAG = "hal_http";
+
+#define HTTP_HOST_LENGTH 64
+#define HTTP_PORT_LENGTH 6
+// Long enough for the X-Firmware-Url headers
+#define HTTP_LINE_LENGTH 512
+#define HTTP_READ_LENGTH 512
+
+#define TLS_SESSION_SLOTS 2
+// Sessions are saved without the peer certificate (CONFIG_MBEDTLS_SSL_KEEP_PEER_CERTIFICATE off)
+#define TLS_SESSION_MAX_SIZE 512
+#define TLS_SESSION_NAMESPACE "tls"
+
+typedef struct {
+    char host[HTTP_HOST_LENGTH];
+    uint16_t length;
+    uint8_t data[TLS_SESSION_MAX_SIZE];
+    uint32_t crc;
+} tls_session_t;
+
+static RTC_DATA_ATTR tls_session_t sessions[TLS_SESSION_SLOTS];
+static RTC_DATA_ATTR uint8_t next_session;
+static RTC_DATA_ATTR hal_tls_stats_t tls_stats;
+
+static mbedtls_entropy_context entropy;
+static mbedtls_ctr_drbg_context ctr_drbg;
+static bool rng_seeded = false;
+
+typedef struct {
+    char host[HTTP_HOST_LENGTH];
+    char port[HTTP_PORT_LENGTH];
+    const char *path;
+} url_t;
+
+typedef struct {
+    mbedtls_net_context net;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_x509_crt ca;
+} tls_connection_t;
+
+typedef enum {
+    RESPONSE_STATUS,
+    RESPONSE_HEADERS,
+    RESPONSE_BODY,
+    RESPONSE_CHUNK_SIZE,
+    RESPONSE_CHUNK_DATA,
+    RESPONSE_CHUNK_END,
+    RESPONSE_TRAILERS,
+    RESPONSE_DONE
+} response_state_t;
+
+typedef struct {
+    const hal_http_request_t *request;
+    response_state_t state;
+    int status_code;
+    bool chunked;
+    bool has_length;
+    size_t remaining;
+    char line[HTTP_LINE_LENGTH];
+    size_t line_length;
+    bool line_overflowed;
+    bool keep_alive;
+    size_t received;
+    esp_err_t err;
+} response_t;
+
+struct hal_http_session {
+    // One-shot sessions close their connection after the request
+    bool persistent;
+    bool connected;
+    char host[HTTP_HOST_LENGTH];
+    char port[HTTP_PORT_LENGTH];
+    uint32_t cert_crc;
+    tls_connection_t connection;
+    response_t response;
+};
+
+/* Session cache */
+
+static uint32_t session_crc(const tls_session_t *session) {
+    return checksum_crc32(CHECKSUM_CRC32_INIT, session, offsetof(tls_session_t, crc));
+}
+
+static bool session_valid(const tls_session_t *session, const char *host) {
+    return session->crc == session_crc(session) && session->length <= TLS_SESSION_MAX_SIZE &&
+           strcmp(session->host, host) == 0;
+}
+
+static void session_key(const char *host, char *key) {
+    sprintf(key, "%08x", checksum_crc32(CHECKSUM_CRC32_INIT, host, strlen(host)));
+}
+
+static tls_session_t *session_find(const char *host) {
+    for (int i = 0; i < TLS_SESSION_SLOTS; i++) {
+        if (session_valid(&sessions[i], host)) {
+            return &sessions[i];
+        }
+    }
+
+    // RTC memory did not survive (power loss); NVS may still have the session
+    tls_session_t *slot = &sessions[next_session];
+
+    char key[9];
+    session_key(host, key);
+
+    // The background firmware download may be writing NVS through storage
+    hal_kv_lock();
+
+    hal_kv_handle_t handle;
+    if (hal_kv_open(TLS_SESSION_NAMESPACE, false, &handle) != ESP_OK) {
+        hal_kv_unlock();
+        return NULL;
+    }
+
+    size_t size = sizeof(tls_session_t);
+    esp_err_t get_err = hal_kv_get_blob(handle, key, slot, &size);
+    hal_kv_close(handle);
+
+    hal_kv_unlock();
+
+    if (get_err != ESP_OK || size != sizeof(tls_session_t) || !session_valid(slot, host)) {
+        memset(slot, 0, sizeof(tls_session_t));
+
+        return NULL;
+    }
+
+    next_session = (next_session + 1) % TLS_SESSION_SLOTS;
+
+    return slot;
+}
+
+static void session_store(const char *host, const mbedtls_ssl_session *ssl_session, bool full_handshake) {
+    tls_session_t *slot = NULL;
+    for (int i = 0; i < TLS_SESSION_SLOTS && slot == NULL; i++) {
+        if (session_valid(&sessions[i], host)) {
+            slot = &sessions[i];
+        }
+    }
+
+    if (slot == NULL) {
+        slot = &sessions[next_session];
+        next_session = (next_session + 1) % TLS_SESSION_SLOTS;
+    }
+
+    size_t length = 0;
+    int ret = mbedtls_ssl_session_save(ssl_session, slot->data, sizeof(slot->data), &length);
+    if (ret != 0) {
+        ESP_LOGW(TAG, "Cannot cache TLS session with %s: -0x%04x", host, -ret);
+        memset(slot, 0, sizeof(tls_session_t));
+
+        return;
+    }
+
+    strcpy(slot->host, host);
+    slot->length = length;
+    slot->crc = session_crc(slot);
+
+    // Resumed handshakes only rotate the ticket, so NVS is written once per full handshake
+    if (!full_handshake) {
+        return;
+    }
+
+    char key[9];
+    session_key(host, key);
+
+    hal_kv_lock();
+
+    hal_kv_handle_t handle;
+    if (hal_kv_open(TLS_SESSION_NAMESPACE, true, &handle) == ESP_OK) {
+        if (hal_kv_set_blob(handle, key, slot, sizeof(tls_session_t)) == ESP_OK) {
+            hal_kv_commit(handle);
+        }
+
+        hal_kv_close(handle);
+    }
+
+    hal_kv_unlock();
+}
+
+/* Connection */
+
+static esp_err_t parse_url(const char *url, url_t *parsed) {
+    const char *scheme = "https://";
+    if (strncmp(url, scheme, strlen(scheme)) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const char *host = url + strlen(scheme);
+    size_t host_length = strcspn(host, ":/?");
+    if (host_length == 0 || host_length >= HTTP_HOST_LENGTH) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(parsed->host, host, host_length);
+    parsed->host[host_length] = '\0';
+
+    const char *rest = host + host_length;
+    strcpy(parsed->port, "443");
+
+    if (*rest == ':') {
+        size_t port_length = strcspn(rest + 1, "/?");
+        if (port_length == 0 || port_length >= HTTP_PORT_LENGTH) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        memcpy(parsed->port, rest + 1, port_length);
+        parsed->port[port_length] = '\0';
+        rest += 1 + port_length;
+    }
+
+    parsed->path = *rest == '\0' ? "/" : rest;
+
+    return ESP_OK;
+}
+
+static void tls_close(tls_connection_t *connection) {
+    mbedtls_ssl_close_notify(&connection->ssl);
+    mbedtls_net_free(&connection->net);
+    mbedtls_ssl_free(&connection->ssl);
+    mbedtls_ssl_config_free(&connection->conf);
+    mbedtls_x509_crt_free(&connection->ca);
+}
+
+static esp_err_t tls_handshake(tls_connection_t *connection, const char *host) {
+    tls_session_t *cached = session_find(host);
+    if (cached != NULL) {
+        mbedtls_ssl_session ssl_session;
+        mbedtls_ssl_session_init(&ssl_session);
+
+        if (mbedtls_ssl_session_load(&ssl_session, cached->data, cached->length) == 0) {
+            mbedtls_ssl_set_session(&connection->ssl, &ssl_session);
+        }
+
+        mbedtls_ssl_session_free(&ssl_session);
+    }
+
+    // A resumed handshake goes straight from ServerHello to ChangeCipherSpec
+    bool full_handshake = false;
+    int64_t start_us = esp_timer_get_time();
+
+    while (connection->ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        int ret = mbedtls_ssl_handshake_step(&connection->ssl);
+        if (ret != 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            ESP_LOGE(TAG, "TLS handshake with %s failed: -0x%04x", host, -ret);
+
+            return ret == MBEDTLS_ERR_SSL_TIMEOUT ? ESP_ERR_TIMEOUT : ESP_FAIL;
+        }
+
+        if (connection->ssl.state == MBEDTLS_SSL_SERVER_CERTIFICATE) {
+            full_handshake = true;
+        }
+    }
+
+    uint32_t handshake_ms = (uint32_t) ((esp_timer_get_time() - start_us) / 1000);
+    if (full_handshake) {
+        tls_stats.full += 1;
+        tls_stats.full_ms += handshake_ms;
+    } else {
+        tls_stats.resumed += 1;
+        tls_stats.resumed_ms += handshake_ms;
+    }
+
+    ESP_LOGI(TAG, "TLS handshake with %s: %u ms, %s", host, handshake_ms,
+             full_handshake ? (cached != NULL ? "full (session not resumed)" : "full") : "resumed");
+
+    mbedtls_ssl_session ssl_session;
+    mbedtls_ssl_session_init(&ssl_session);
+    if (mbedtls_ssl_get_session(&connection->ssl, &ssl_session) == 0) {
+        session_store(host, &ssl_session, full_handshake);
+    }
+    mbedtls_ssl_session_free(&ssl_session);
+
+    return ESP_OK;
+}
+
+static esp_err_t tls_connect(tls_connection_t *connection, const url_t *url, const hal_http_request_t *request) {
+    mbedtls_net_init(&connection->net);
+    mbedtls_ssl_init(&connection->ssl);
+    mbedtls_ssl_config_init(&connection->conf);
+    mbedtls_x509_crt_init(&connection->ca);
+
+    if (!rng_seeded) {
+        mbedtls_entropy_init(&entropy);
+        mbedtls_ctr_drbg_init(&ctr_drbg);
+        if (mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, NULL, 0) != 0) {
+            return ESP_FAIL;
+        }
+
+        rng_seeded = true;
+    }
+
+    int ret = mbedtls_ssl_config_defaults(&connection->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                          MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        return ESP_FAIL;
+    }
+
+    if (request->cert_der != NULL) {
+        ret = mbedtls_x509_crt_parse_der(&connection->ca, request->cert_der, request->cert_der_length);
+        if (ret != 0) {
+            ESP_LOGE(TAG, "Invalid CA certificate for %s: -0x%04x", url->host, -ret);
+
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        mbedtls_ssl_conf_ca_chain(&connection->conf, &connection->ca, NULL);
+    } else {
+        esp_crt_bundle_attach(&connection->conf);
+    }
+
+    mbedtls_ssl_conf_authmode(&connection->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_rng(&connection->conf, mbedtls_ctr_drbg_random, &ctr_drbg);
+    mbedtls_ssl_conf_session_tickets(&connection->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+    mbedtls_ssl_conf_read_timeout(&connection->conf, request->timeout_ms);
+
+    if (mbedtls_ssl_setup(&connection->ssl, &connection->conf) != 0 ||
+        mbedtls_ssl_set_hostname(&connection->ssl, url->host) != 0) {
+        return ESP_FAIL;
+    }
+
+    ret = mbedtls_net_connect(&connection->net, url->host, url->port, MBEDTLS_NET_PROTO_TCP);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Cannot connect to %s:%s: -0x%04x", url->host, url->port, -ret);
+
+        return ESP_FAIL;
+    }
+
+    mbedtls_ssl_set_bio(&connection->ssl, &connection->net, mbedtls_net_send, NULL, mbedtls_net_recv_timeout);
+
+    return tls_handshake(connection, url->host);
+}
+
+static esp_err_t tls_write(tls_connection_t *connection, const char *data, size_t length) {
+    while (length > 0) {
+        int written = mbedtls_ssl_write(&connection->ssl, (const unsigned char *) data, length);
+        if (written == MBEDTLS_ERR_SSL_WANT_READ || written == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        } else if (written < 0) {
+            ESP_LOGE(TAG, "TLS write failed: -0x%04x", -written);
+
+            return ESP_FAIL;
+        }
+
+        data += written;
+        length -= written;
+    }
+
+    return ESP_OK;
+}
+
+/* Request and response */
+
+static esp_err_t send_request(tls_connection_t *connection, const url_t *url, const hal_http_request_t *request,
+                              bool keep_alive, char *buffer, size_t capacity) {
+    size_t length = snprintf(buffer, capacity,
+                             "%s %s HTTP/1.1\r\n"
+                             "Host: %s\r\n"
+                             "User-Agent: radgard\r\n"
+                             "Connection: %s\r\n",
+                             request->post ? "POST" : "GET", url->path, url->host, keep_alive ? "keep-alive" : "close");
+
+    if (request->content_type != NULL) {
+        length += snprintf(buffer + length, capacity - length, "Content-Type: %s\r\n", request->content_type);
+    }
+
+    if (request->accept != NULL) {
+        length += snprintf(buffer + length, capacity - length, "Accept: %s\r\n", request->accept);
+    }
+
+    if (request->if_none_match != NULL) {
+        length += snprintf(buffer + length, capacity - length, "If-None-Match: %s\r\n", request->if_none_match);
+    }
+
+    if (request->range_start > 0) {
+        length += snprintf(buffer + length, capacity - length, "Range: bytes=%u-\r\n", (unsigned) request->range_start);
+
+        if (request->if_range != NULL) {
+            length += snprintf(buffer + length, capacity - length, "If-Range: %s\r\n", request->if_range);
+        }
+    }
+
+    if (request->post) {
+        length += snprintf(buffer + length, capacity - length, "Content-Length: %u\r\n", (unsigned) request->body_length);
+    }
+
+    length += snprintf(buffer + length, capacity - length, "\r\n");
+    if (length >= capacity) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t write_err = tls_write(connection, buffer, length);
+    if (write_err == ESP_OK && request->body_length > 0) {
+        write_err = tls_write(connection, request->body, request->body_length);
+    }
+
+    return write_err;
+}
+
+static void header_line(response_t *response) {
+    char *value = strchr(response->line, ':');
+    if (value == NULL) {
+        return;
+    }
+
+    *value++ = '\0';
+    value += strspn(value, " \t");
+
+    const char *key = response->line;
+    if (strcasecmp(key, "Content-Length") == 0) {
+        response->has_length = true;
+        response->remaining = strtoul(value, NULL, 10);
+    } else if (strcasecmp(key, "Transfer-Encoding") == 0 && strcasecmp(value, "chunked") == 0) {
+        response->chunked = true;
+    } else if (strcasecmp(key, "Connection") == 0) {
+        response->keep_alive = strcasecmp(value, "close") != 0;
+    }
+
+    if (response->request->on_header != NULL) {
+        response->request->on_header(response->request->user_data, key, value);
+    }
+}
+
+static void headers_done(response_t *response) {
+    bool bodiless = response->status_code == 204 || response->status_code == 304 || response->status_code < 200;
+
+    if (bodiless) {
+        response->state = RESPONSE_DONE;
+    } else if (response->chunked) {
+        response->state = RESPONSE_CHUNK_SIZE;
+    } else if (response->has_length) {
+        response->state = response->remaining == 0 ? RESPONSE_DONE : RESPONSE_BODY;
+    } else {
+        // Body runs until the server closes the connection
+        response->state = RESPONSE_BODY;
+        response->keep_alive = false;
+    }
+}
+
+static void line_done(response_t *response) {
+    int major, minor;
+
+    switch (response->state) {
+        case RESPONSE_STATUS:
+            if (response->line_overflowed ||
+                sscanf(response->line, "HTTP/%d.%d %d", &major, &minor, &response->status_code) != 3) {
+                response->err = ESP_ERR_INVALID_RESPONSE;
+                return;
+            }
+
+            // HTTP/1.1 connections stay open unless the server says otherwise
+            response->keep_alive = major > 1 || (major == 1 && minor >= 1);
+
+            if (response->request->on_status != NULL) {
+                response->request->on_status(response->request->user_data, response->status_code);
+            }
+
+            response->state = RESPONSE_HEADERS;
+            break;
+        case RESPONSE_HEADERS:
+            if (response->line_length == 0 && !response->line_overflowed) {
+                headers_done(response);
+            } else if (!response->line_overflowed) {
+                header_line(response);
+            } else {
+                ESP_LOGW(TAG, "Skipping header longer than %d bytes", HTTP_LINE_LENGTH - 1);
+            }
+
+            break;
+        case RESPONSE_CHUNK_SIZE:
+            response->remaining = strtoul(response->line, NULL, 16);
+            response->state = response->remaining == 0 ? RESPONSE_TRAILERS : RESPONSE_CHUNK_DATA;
+            break;
+        case RESPONSE_CHUNK_END:
+            response->state = RESPONSE_CHUNK_SIZE;
+            break;
+        case RESPONSE_TRAILERS:
+            if (response->line_length == 0) {
+                response->state = RESPONSE_DONE;
+            }
+
+            break;
+        default:
+            break;
+    }
+}
+
+static void parse_response(response_t *response, const char *data, size_t length) {
+    size_t i = 0;
+
+    while (i < length && response->state != RESPONSE_DONE && response->err == ESP_OK) {
+        if (response->state == RESPONSE_BODY || response->state == RESPONSE_CHUNK_DATA) {
+            size_t available = length - i;
+            size_t take = response->has_length || response->chunked ?
+                          (available < response->remaining ? available : response->remaining) : available;
+
+            if (response->request->on_data != NULL) {
+                response->err = response->request->on_data(response->request->user_data, data + i, take);
+            }
+
+            i += take;
+
+            if (response->has_length || response->chunked) {
+                response->remaining -= take;
+                if (response->remaining == 0) {
+                    response->state = response->state == RESPONSE_CHUNK_DATA ? RESPONSE_CHUNK_END : RESPONSE_DONE;
+                }
+            }
+
+            continue;
+        }
+
+        char c = data[i++];
+        if (c == '\r') {
+            continue;
+        }
+
+        if (c == '\n') {
+            response->line[response->line_length] = '\0';
+            line_done(response);
+            response->line_length = 0;
+            response->line_overflowed = false;
+        } else if (response->line_length < HTTP_LINE_LENGTH - 1) {
+            response->line[response->line_length++] = c;
+        } else {
+            response->line_overflowed = true;
+        }
+    }
+}
+
+static esp_err_t read_response(tls_connection_t *connection, response_t *response) {
+    unsigned char buffer[HTTP_READ_LENGTH];
+
+    while (response->state != RESPONSE_DONE && response->err == ESP_OK) {
+        int read = mbedtls_ssl_read(&connection->ssl, buffer, sizeof(buffer));
+
+        if (read == MBEDTLS_ERR_SSL_WANT_READ || read == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        } else if (read == 0 || read == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+            bool until_close = response->state == RESPONSE_BODY && !response->has_length;
+
+            return until_close ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+        } else if (read == MBEDTLS_ERR_SSL_TIMEOUT) {
+            return ESP_ERR_TIMEOUT;
+        } else if (read < 0) {
+            ESP_LOGE(TAG, "TLS read failed: -0x%04x", -read);
+
+            return ESP_FAIL;
+        }
+
+        response->received += read;
+        parse_response(response, (const char *) buffer, read);
+    }
+
+    return response->err;
+}
+
+/* Sessions */
+
+static uint32_t cert_crc(const hal_http_request_t *request) {
+    return request->cert_der == NULL ? 0 :
+        checksum_crc32(CHECKSUM_CRC32_INIT, request->cert_der, request->cert_der_length);
+}
+
+static bool session_matches(const hal_http_session_t *session, const url_t *url, const hal_http_request_t *request) {
+    return session->connected && strcmp(session->host, url->host) == 0 && strcmp(session->port, url->port) == 0 &&
+           session->cert_crc == cert_crc(request);
+}
+
+static void session_disconnect(hal_http_session_t *session) {
+    if (session->connected) {
+        tls_close(&session->connection);
+        session->connected = false;
+    }
+}
+
+static esp_err_t session_connect(hal_http_session_t *session, const url_t *url, const hal_http_request_t *request) {
+    session_disconnect(session);
+
+    esp_err_t err = tls_connect(&session->connection, url, request);
+    if (err != ESP_OK) {
+        tls_close(&session->connection);
+
+        return err;
+    }
+
+    session->connected = true;
+    strcpy(session->host, url->host);
+    strcpy(session->port, url->port);
+    session->cert_crc = cert_crc(request);
+
+    return ESP_OK;
+}
+
+static esp_err_t session_request(hal_http_session_t *session, const url_t *url, const hal_http_request_t *request) {
+    response_t *response = &session->response;
+    memset(response, 0, sizeof(response_t));
+
+    response->request = request;
+    response->state = RESPONSE_STATUS;
+    response->err = ESP_OK;
+
+    mbedtls_ssl_conf_read_timeout(&session->connection.conf, request->timeout_ms);
+
+    esp_err_t err = send_request(&session->connection, url, request, session->persistent, response->line,
+                                 sizeof(response->line));
+    if (err == ESP_OK) {
+        err = read_response(&session->connection, response);
+    }
+
+    return err;
+}
+
+hal_http_session_t *hal_http_session_open() {
+    hal_http_session_t *session = calloc(1, sizeof(hal_http_session_t));
+    if (session != NULL) {
+        session->persistent = true;
+    }
+
+    return session;
+}
+
+void hal_http_session_close(hal_http_session_t *session) {
+    if (session != NULL) {
+        session_disconnect(session);
+        free(session);
+    }
+}
+
+esp_err_t hal_http_session_perform(hal_http_session_t *session, const hal_http_request_t *request, int *status_code) {
+    url_t url;
+    esp_err_t err = parse_url(request->url, &url);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unsupported URL %s", request->url);
+
+        return err;
+    }
+
+    bool reused = session_matches(session, &url, request);
+    if (reused) {
+        ESP_LOGD(TAG, "Reusing the connection to %s", url.host);
+    } else {
+        err = session_connect(session, &url, request);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    err = session_request(session, &url, request);
+
+    // The server may have dropped the idle connection; retry once on a new one if nothing came back
+    if (err != ESP_OK && reused && session->response.received == 0) {
+        ESP_LOGI(TAG, "Kept-alive connection to %s was closed, reconnecting", url.host);
+
+        err = session_connect(session, &url, request);
+        if (err == ESP_OK) {
+            err = session_request(session, &url, request);
+        }
+    }
+
+    if (session->response.status_code != 0) {
+        *status_code = session->response.status_code;
+    }
+
+    if (err != ESP_OK || !session->persistent || !session->response.keep_alive) {
+        session_disconnect(session);
+    }
+
+    return err;
+}
+
+esp_err_t hal_http_perform(const hal_http_request_t *request, int *status_code) {
+    // Heap rather than stack: the line buffer alone is larger than some callers' stacks can spare
+    hal_http_session_t *session = calloc(1, sizeof(hal_http_session_t));
+    if (session == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = hal_http_session_perform(session, request, status_code);
+    hal_http_session_close(session);
+
+    return err;
+}
+
+void hal_tls_get_stats(hal_tls_stats_t *stats) {
+    memcpy(stats, &tls_stats, sizeof(hal_tls_stats_t));
+}
+
+void hal_http_forget_sessions() {
+    memset(sessions, 0, sizeof(sessions));
+    next_session = 0;
+}
@@ -0,0 +1,561 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "hal_linux.h"
+
+/* Clock: time only moves when the firmware waits or sleeps */
+
+static int64_t uptime_us = 0;
+static int64_t wall_us = 0;
+// Real time, which the RTC drifts from over deep sleep unless corrected
+static int64_t true_us = 0;
+static int32_t rtc_error_ppm = 0;
+static int32_t rtc_correction_ppm = 0;
+
+int64_t hal_clock_monotonic_us() {
+    return uptime_us;
+}
+
+time_t hal_clock_now() {
+    return (time_t) (wall_us / 1000000);
+}
+
+void hal_clock_set(time_t now) {
+    hal_linux_set_time(now);
+}
+
+void hal_clock_set_rtc_correction(int32_t ppm) {
+    rtc_correction_ppm = ppm;
+}
+
+void hal_delay_ms(uint32_t ms) {
+    hal_linux_advance_us((int64_t) ms * 1000);
+}
+
+void hal_linux_set_time(time_t now) {
+    wall_us = (int64_t) now * 1000000;
+}
+
+void hal_linux_advance_us(int64_t time_us) {
+    uptime_us += time_us;
+    wall_us += time_us;
+    true_us += time_us;
+}
+
+void hal_linux_set_true_time(time_t now) {
+    true_us = (int64_t) now * 1000000;
+}
+
+time_t hal_linux_true_time() {
+    return (time_t) (true_us / 1000000);
+}
+
+void hal_linux_set_rtc_error_ppm(int32_t ppm) {
+    rtc_error_ppm = ppm;
+}
+
+/* Sleep and reset */
+
+static hal_wake_cause_t wake_cause = HAL_WAKE_POWER_ON;
+static uint64_t wake_gpio_mask = 0;
+
+static bool next_wake_set = false;
+static hal_wake_cause_t next_wake_cause;
+static uint64_t next_wake_gpio_mask;
+
+static uint64_t last_sleep_us = 0;
+
+hal_wake_cause_t hal_sleep_wake_cause() {
+    return wake_cause;
+}
+
+uint64_t hal_sleep_wake_gpio_mask() {
+    return wake_gpio_mask;
+}
+
+void hal_sleep_enable_gpio_wake(uint64_t gpio_mask) {
+    (void) gpio_mask;
+}
+
+static void wake(hal_wake_cause_t default_cause) {
+    if (next_wake_set) {
+        wake_cause = next_wake_cause;
+        wake_gpio_mask = next_wake_gpio_mask;
+        next_wake_set = false;
+    } else {
+        wake_cause = default_cause;
+        wake_gpio_mask = 0;
+    }
+
+    uptime_us = 0;
+}
+
+void hal_sleep_deep(uint64_t time_us) {
+    last_sleep_us = time_us;
+    wall_us += time_us;
+    true_us += (int64_t) time_us * 1000000 / (1000000 + rtc_error_ppm - rtc_correction_ppm);
+
+    wake(HAL_WAKE_TIMER);
+}
+
+void hal_restart() {
+    wake(HAL_WAKE_POWER_ON);
+}
+
+void hal_linux_set_wake(hal_wake_cause_t cause, uint64_t gpio_mask) {
+    next_wake_set = true;
+    next_wake_cause = cause;
+    next_wake_gpio_mask = gpio_mask;
+}
+
+uint64_t hal_linux_last_sleep_us() {
+    return last_sleep_us;
+}
+
+/* GPIO: a held pin ignores level changes, as on the ESP32 */
+
+#define GPIO_COUNT 40
+
+static uint8_t gpio_levels[GPIO_COUNT];
+static bool gpio_holds[GPIO_COUNT];
+
+void hal_gpio_set_output(uint8_t gpio_num) {
+    (void) gpio_num;
+}
+
+void hal_gpio_set_input(uint8_t gpio_num) {
+    (void) gpio_num;
+}
+
+void hal_gpio_set_level(uint8_t gpio_num, uint8_t level) {
+    if (gpio_num < GPIO_COUNT && !gpio_holds[gpio_num]) {
+        gpio_levels[gpio_num] = level ? 1 : 0;
+    }
+}
+
+void hal_gpio_hold(uint8_t gpio_num, bool enable) {
+    if (gpio_num < GPIO_COUNT) {
+        gpio_holds[gpio_num] = enable;
+    }
+}
+
+void hal_gpio_deep_sleep_hold() {
+}
+
+uint8_t hal_linux_gpio_level(uint8_t gpio_num) {
+    return gpio_num < GPIO_COUNT ? gpio_levels[gpio_num] : 0;
+}
+
+/* Key-value store: an in-memory NVS that survives deinit and deep sleep */
+
+#define KV_NAME_LENGTH 16
+#define KV_MAX_NAMESPACES 4
+#define KV_MAX_ENTRIES 64
+#define KV_MAX_HANDLES 8
+
+typedef enum {
+    KV_U8,
+    KV_U32,
+    KV_STR,
+    KV_BLOB
+} kv_type_t;
+
+typedef struct {
+    bool used;
+    uint8_t namespace_index;
+    char key[KV_NAME_LENGTH];
+    kv_type_t type;
+    size_t size;
+    uint8_t *data;
+} kv_entry_t;
+
+typedef struct {
+    bool open;
+    bool writable;
+    uint8_t namespace_index;
+} kv_handle_t;
+
+static bool kv_initialized = false;
+static char kv_namespaces[KV_MAX_NAMESPACES][KV_NAME_LENGTH];
+static uint8_t kv_namespaces_length = 0;
+static kv_entry_t kv_entries[KV_MAX_ENTRIES];
+static kv_handle_t kv_handles[KV_MAX_HANDLES];
+static hal_linux_kv_stats_t kv_stats;
+static esp_err_t kv_commit_error = ESP_OK;
+
+// Everything runs on one thread
+void hal_kv_lock() {
+}
+
+void hal_kv_unlock() {
+}
+
+esp_err_t hal_kv_init() {
+    kv_initialized = true;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_kv_deinit() {
+    if (!kv_initialized) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    memset(kv_handles, 0, sizeof(kv_handles));
+    kv_initialized = false;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_kv_erase_all() {
+    for (int i = 0; i < KV_MAX_ENTRIES; i++) {
+        free(kv_entries[i].data);
+    }
+
+    memset(kv_entries, 0, sizeof(kv_entries));
+    kv_namespaces_length = 0;
+    kv_stats.erases += 1;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_kv_open(const char *name, bool writable, hal_kv_handle_t *handle) {
+    if (!kv_initialized) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    if (strlen(name) >= KV_NAME_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    int namespace_index = -1;
+    for (int i = 0; i < kv_namespaces_length; i++) {
+        if (strcmp(kv_namespaces[i], name) == 0) {
+            namespace_index = i;
+        }
+    }
+
+    if (namespace_index < 0) {
+        // As with NVS, only a read-write open creates the namespace
+        if (!writable) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+
+        if (kv_namespaces_length == KV_MAX_NAMESPACES) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+
+        namespace_index = kv_namespaces_length++;
+        strcpy(kv_namespaces[namespace_index], name);
+    }
+
+    for (int i = 0; i < KV_MAX_HANDLES; i++) {
+        if (!kv_handles[i].open) {
+            kv_handles[i].open = true;
+            kv_handles[i].writable = writable;
+            kv_handles[i].namespace_index = namespace_index;
+            *handle = i + 1;
+
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+static kv_handle_t *get_handle(hal_kv_handle_t handle) {
+    if (!kv_initialized || handle == 0 || handle > KV_MAX_HANDLES || !kv_handles[handle - 1].open) {
+        return NULL;
+    }
+
+    return &kv_handles[handle - 1];
+}
+
+esp_err_t hal_kv_commit(hal_kv_handle_t handle) {
+    if (get_handle(handle) == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    kv_stats.commits += 1;
+
+    esp_err_t err = kv_commit_error;
+    kv_commit_error = ESP_OK;
+
+    return err;
+}
+
+void hal_kv_close(hal_kv_handle_t handle) {
+    kv_handle_t *kv_handle = get_handle(handle);
+
+    if (kv_handle != NULL) {
+        kv_handle->open = false;
+    }
+}
+
+static kv_entry_t *find_entry(const kv_handle_t *kv_handle, const char *key) {
+    for (int i = 0; i < KV_MAX_ENTRIES; i++) {
+        kv_entry_t *entry = &kv_entries[i];
+
+        if (entry->used && entry->namespace_index == kv_handle->namespace_index && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static esp_err_t set_entry(hal_kv_handle_t handle, const char *key, kv_type_t type, const void *value, size_t size) {
+    kv_handle_t *kv_handle = get_handle(handle);
+    if (kv_handle == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    if (!kv_handle->writable) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+
+    if (strlen(key) >= KV_NAME_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    kv_entry_t *entry = find_entry(kv_handle, key);
+
+    for (int i = 0; entry == NULL && i < KV_MAX_ENTRIES; i++) {
+        if (!kv_entries[i].used) {
+            entry = &kv_entries[i];
+        }
+    }
+
+    if (entry == NULL) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    uint8_t *data = malloc(size);
+    if (data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(data, value, size);
+    free(entry->data);
+
+    entry->used = true;
+    entry->namespace_index = kv_handle->namespace_index;
+    strcpy(entry->key, key);
+    entry->type = type;
+    entry->size = size;
+    entry->data = data;
+
+    kv_stats.writes += 1;
+    kv_stats.bytes_written += size;
+
+    return ESP_OK;
+}
+
+static esp_err_t get_entry(hal_kv_handle_t handle, const char *key, kv_type_t type, void *value, size_t *size) {
+    kv_handle_t *kv_handle = get_handle(handle);
+    if (kv_handle == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    kv_entry_t *entry = find_entry(kv_handle, key);
+    if (entry == NULL || entry->type != type) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    if (value == NULL) {
+        *size = entry->size;
+
+        return ESP_OK;
+    }
+
+    if (*size < entry->size) {
+        *size = entry->size;
+
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    memcpy(value, entry->data, entry->size);
+    *size = entry->size;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_kv_set_u8(hal_kv_handle_t handle, const char *key, uint8_t value) {
+    return set_entry(handle, key, KV_U8, &value, sizeof(value));
+}
+
+esp_err_t hal_kv_set_u32(hal_kv_handle_t handle, const char *key, uint32_t value) {
+    return set_entry(handle, key, KV_U32, &value, sizeof(value));
+}
+
+esp_err_t hal_kv_set_str(hal_kv_handle_t handle, const char *key, const char *value) {
+    return set_entry(handle, key, KV_STR, value, strlen(value) + 1);
+}
+
+esp_err_t hal_kv_set_blob(hal_kv_handle_t handle, const char *key, const void *value, size_t size) {
+    return set_entry(handle, key, KV_BLOB, value, size);
+}
+
+esp_err_t hal_kv_get_u8(hal_kv_handle_t handle, const char *key, uint8_t *value) {
+    size_t size = sizeof(uint8_t);
+
+    return get_entry(handle, key, KV_U8, value, &size);
+}
+
+esp_err_t hal_kv_get_u32(hal_kv_handle_t handle, const char *key, uint32_t *value) {
+    size_t size = sizeof(uint32_t);
+
+    return get_entry(handle, key, KV_U32, value, &size);
+}
+
+esp_err_t hal_kv_get_str(hal_kv_handle_t handle, const char *key, char *value, size_t *size) {
+    return get_entry(handle, key, KV_STR, value, size);
+}
+
+esp_err_t hal_kv_get_blob(hal_kv_handle_t handle, const char *key, void *value, size_t *size) {
+    return get_entry(handle, key, KV_BLOB, value, size);
+}
+
+esp_err_t hal_kv_erase_key(hal_kv_handle_t handle, const char *key) {
+    kv_handle_t *kv_handle = get_handle(handle);
+    if (kv_handle == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    if (!kv_handle->writable) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+
+    kv_entry_t *entry = find_entry(kv_handle, key);
+    if (entry == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    free(entry->data);
+    memset(entry, 0, sizeof(kv_entry_t));
+    kv_stats.erases += 1;
+
+    return ESP_OK;
+}
+
+void hal_linux_kv_get_stats(hal_linux_kv_stats_t *stats) {
+    memcpy(stats, &kv_stats, sizeof(hal_linux_kv_stats_t));
+}
+
+void hal_linux_fail_next_kv_commit(esp_err_t err) {
+    kv_commit_error = err;
+}
+
+/* HTTP and Wi-Fi are whatever the host program says they are */
+
+static hal_linux_http_handler_t http_handler = NULL;
+
+static bool wifi_available = true;
+static uint32_t wifi_connect_ms = 0;
+
+esp_err_t hal_http_perform(const hal_http_request_t *request, int *status_code) {
+    if (http_handler == NULL) {
+        return ESP_FAIL;
+    }
+
+    return http_handler(request, status_code);
+}
+
+// Connections are free on the host, so a session only has to exist
+struct hal_http_session {
+    uint32_t requests;
+};
+
+hal_http_session_t *hal_http_session_open() {
+    return calloc(1, sizeof(hal_http_session_t));
+}
+
+esp_err_t hal_http_session_perform(hal_http_session_t *session, const hal_http_request_t *request, int *status_code) {
+    session->requests += 1;
+
+    return hal_http_perform(request, status_code);
+}
+
+void hal_http_session_close(hal_http_session_t *session) {
+    free(session);
+}
+
+void hal_linux_set_http_handler(hal_linux_http_handler_t handler) {
+    http_handler = handler;
+}
+
+// There is no TLS on the host
+void hal_tls_get_stats(hal_tls_stats_t *stats) {
+    memset(stats, 0, sizeof(hal_tls_stats_t));
+}
+
+void hal_http_forget_sessions() {
+}
+
+esp_err_t hal_wifi_connect() {
+    hal_delay_ms(wifi_connect_ms);
+
+    return wifi_available ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+void hal_wifi_stop() {
+}
+
+void hal_linux_set_wifi(bool available, uint32_t connect_ms) {
+    wifi_available = available;
+    wifi_connect_ms = connect_ms;
+}
+
+/* Logging and error names for the host esp_err.h and esp_log.h */
+
+static esp_log_level_t log_level = ESP_LOG_INFO;
+
+void hal_linux_set_log_level(esp_log_level_t level) {
+    log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    static const char LEVEL_LETTERS[] = "NEWIDV";
+
+    if (level > log_level) {
+        return;
+    }
+
+    fprintf(stderr, "%c (%lld) %s: ", LEVEL_LETTERS[level], (long long) (uptime_us / 1000), tag);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+        case ESP_ERR_NVS_NOT_INITIALIZED: return "ESP_ERR_NVS_NOT_INITIALIZED";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_TYPE_MISMATCH: return "ESP_ERR_NVS_TYPE_MISMATCH";
+        case ESP_ERR_NVS_READ_ONLY: return "ESP_ERR_NVS_READ_ONLY";
+        case ESP_ERR_NVS_NOT_ENOUGH_SPACE: return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+        case ESP_ERR_NVS_INVALID_NAME: return "ESP_ERR_NVS_INVALID_NAME";
+        case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+        case ESP_ERR_NVS_KEY_TOO_LONG: return "ESP_ERR_NVS_KEY_TOO_LONG";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+        default: return "UNKNOWN ERROR";
+    }
+}
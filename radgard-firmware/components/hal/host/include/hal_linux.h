@@ -0,0 +1,63 @@
+#ifndef __HAL_LINUX_H__
+#define __HAL_LINUX_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "hal.h"
+
+/* Controls for the host backend, used by simulators and host tools to play
+ * the part of the board, the network and the passage of time. */
+
+void hal_linux_set_log_level(esp_log_level_t level);
+
+/* Virtual clock. Nothing advances it except delays, deep sleep and these calls. */
+
+void hal_linux_set_time(time_t now);
+
+void hal_linux_advance_us(int64_t time_us);
+
+/* Real time, as opposed to the device's clock. The two only part over deep
+ * sleep, when the RTC runs `ppm` fast less the firmware's correction. */
+
+void hal_linux_set_true_time(time_t now);
+
+time_t hal_linux_true_time();
+
+void hal_linux_set_rtc_error_ppm(int32_t ppm);
+
+/* Wake cause reported after the next hal_sleep_deep() or hal_restart() */
+
+void hal_linux_set_wake(hal_wake_cause_t cause, uint64_t gpio_mask);
+
+// Duration passed to the last hal_sleep_deep()
+uint64_t hal_linux_last_sleep_us();
+
+uint8_t hal_linux_gpio_level(uint8_t gpio_num);
+
+typedef struct {
+    uint32_t writes;
+    uint32_t erases;
+    uint32_t commits;
+    uint32_t bytes_written;
+} hal_linux_kv_stats_t;
+
+void hal_linux_kv_get_stats(hal_linux_kv_stats_t *stats);
+
+// The next hal_kv_commit() returns `err`; the writes before it stay in place, as they may on flash
+void hal_linux_fail_next_kv_commit(esp_err_t err);
+
+/* HTTP requests are served by this handler, which streams the response body
+ * through request->on_data. Without one every request fails. */
+typedef esp_err_t (*hal_linux_http_handler_t)(const hal_http_request_t *request, int *status_code);
+
+void hal_linux_set_http_handler(hal_linux_http_handler_t handler);
+
+// hal_wifi_connect() takes `connect_ms` of virtual time and fails if the network is unavailable
+void hal_linux_set_wifi(bool available, uint32_t connect_ms);
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef __HAL_H__
+#define __HAL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <esp_err.h>
+
+#ifdef ESP_PLATFORM
+// ESP_ERR_NVS_* codes; the host esp_err.h defines them itself
+#include <nvs.h>
+#endif
+
+/* Hardware abstraction for everything the firmware core needs from the
+ * platform. hal_esp.c maps it onto ESP-IDF; hal_linux.c emulates it on a
+ * host with a virtual clock, so the core can be built and run off-target. */
+
+/* Clock */
+
+int64_t hal_clock_monotonic_us();
+
+time_t hal_clock_now();
+
+void hal_clock_set(time_t now);
+
+/* Scales the RTC, which keeps time across deep sleep, for running `ppm` faster
+ * than real time. Covers the clock and deep sleep durations; lasts until reset. */
+void hal_clock_set_rtc_correction(int32_t ppm);
+
+void hal_delay_ms(uint32_t ms);
+
+/* Sleep and reset */
+
+typedef enum {
+    HAL_WAKE_POWER_ON = 0,
+    HAL_WAKE_GPIO,
+    HAL_WAKE_TIMER
+} hal_wake_cause_t;
+
+hal_wake_cause_t hal_sleep_wake_cause();
+
+// Bitmask of the GPIOs that triggered a HAL_WAKE_GPIO wake
+uint64_t hal_sleep_wake_gpio_mask();
+
+void hal_sleep_enable_gpio_wake(uint64_t gpio_mask);
+
+// Does not return on target; on the host the clock advances by `time_us` and it returns
+void hal_sleep_deep(uint64_t time_us);
+
+void hal_restart();
+
+/* GPIO */
+
+void hal_gpio_set_output(uint8_t gpio_num);
+
+void hal_gpio_set_input(uint8_t gpio_num);
+
+void hal_gpio_set_level(uint8_t gpio_num, uint8_t level);
+
+// Latch the pin's level through resets and deep sleep
+void hal_gpio_hold(uint8_t gpio_num, bool enable);
+
+void hal_gpio_deep_sleep_hold();
+
+/* Key-value store. Errors use the NVS codes on both backends. */
+
+typedef uint32_t hal_kv_handle_t;
+
+esp_err_t hal_kv_init();
+
+esp_err_t hal_kv_deinit();
+
+esp_err_t hal_kv_erase_all();
+
+esp_err_t hal_kv_open(const char *name, bool writable, hal_kv_handle_t *handle);
+
+esp_err_t hal_kv_commit(hal_kv_handle_t handle);
+
+void hal_kv_close(hal_kv_handle_t handle);
+
+esp_err_t hal_kv_set_u8(hal_kv_handle_t handle, const char *key, uint8_t value);
+
+esp_err_t hal_kv_set_u32(hal_kv_handle_t handle, const char *key, uint32_t value);
+
+esp_err_t hal_kv_set_str(hal_kv_handle_t handle, const char *key, const char *value);
+
+esp_err_t hal_kv_set_blob(hal_kv_handle_t handle, const char *key, const void *value, size_t size);
+
+esp_err_t hal_kv_get_u8(hal_kv_handle_t handle, const char *key, uint8_t *value);
+
+esp_err_t hal_kv_get_u32(hal_kv_handle_t handle, const char *key, uint32_t *value);
+
+// As with NVS, a NULL `value` only reports the stored size (including the terminator for strings)
+esp_err_t hal_kv_get_str(hal_kv_handle_t handle, const char *key, char *value, size_t *size);
+
+esp_err_t hal_kv_get_blob(hal_kv_handle_t handle, const char *key, void *value, size_t *size);
+
+esp_err_t hal_kv_erase_key(hal_kv_handle_t handle, const char *key);
+
+/* NVS is shared by storage and the TLS session cache, and the background
+ * firmware download uses both on another task. Each holds this recursive
+ * lock around its accesses; a no-op on the single-threaded host. */
+void hal_kv_lock();
+
+void hal_kv_unlock();
+
+/* HTTP */
+
+typedef esp_err_t (*hal_http_data_cb_t)(void *user_data, const char *data, size_t length);
+
+typedef void (*hal_http_header_cb_t)(void *user_data, const char *key, const char *value);
+
+typedef void (*hal_http_status_cb_t)(void *user_data, int status_code);
+
+typedef struct {
+    const char *url;
+    bool post;
+    const char *content_type;
+    const char *accept;
+    const char *if_none_match;
+    // Nonzero asks for the body from this byte on (Range), unless it no longer matches `if_range`
+    uint32_t range_start;
+    const char *if_range;
+    // DER of the CA to trust, NULL for the built-in certificate bundle
+    const uint8_t *cert_der;
+    size_t cert_der_length;
+    const char *body;
+    size_t body_length;
+    uint32_t timeout_ms;
+    // The response's status code, before its headers
+    hal_http_status_cb_t on_status;
+    // Response headers, all before the first body chunk
+    hal_http_header_cb_t on_header;
+    // Response body chunks are handed over as they arrive and are not buffered
+    hal_http_data_cb_t on_data;
+    void *user_data;
+} hal_http_request_t;
+
+esp_err_t hal_http_perform(const hal_http_request_t *request, int *status_code);
+
+/* A connection kept open with HTTP keep-alive across requests, for the
+ * requests of one online wake. It reconnects when the host changes or the
+ * server closes it. */
+typedef struct hal_http_session hal_http_session_t;
+
+hal_http_session_t *hal_http_session_open();
+
+esp_err_t hal_http_session_perform(hal_http_session_t *session, const hal_http_request_t *request, int *status_code);
+
+void hal_http_session_close(hal_http_session_t *session);
+
+/* TLS handshakes since power-on; resumed ones reuse a session cached across deep sleep */
+typedef struct {
+    uint32_t full;
+    uint32_t resumed;
+    uint32_t full_ms;
+    uint32_t resumed_ms;
+} hal_tls_stats_t;
+
+void hal_tls_get_stats(hal_tls_stats_t *stats);
+
+// Drops the sessions cached in RTC memory, for a factory reset; NVS goes with the erase
+void hal_http_forget_sessions();
+
+/* Wi-Fi (provisioning stays in the network component) */
+
+esp_err_t hal_wifi_connect();
+
+void hal_wifi_stop();
+
+#endif
@@ -1,5 +1,31 @@
 
 
+#include "api.h"
+
 bool network_start_provision_connect_wifi();
 
-void network_disconnect_wifi();
\ No newline at end of file
+/* Syncs the clock, and so the RTC drift correction, to the API response's Date
+ * (`server_time`), or with SNTP when there is none and a sync is due */
+void network_set_time(time_t server_time);
+
+// Downloads and applies the update, restarting on success; returns only if it failed
+void network_update_firmware(api_firmware_update_t *firmware_update);
+
+/* A download an online wake paused continues while a scheduled irrigation
+ * wake has the valve open, in a low-priority task on the second core that
+ * connects, downloads until `deadline_us` or a stop, and disconnects. A
+ * finished image is booted at the next full boot rather than by a restart.
+ * These fill in a device_background_t. */
+bool network_background_update_pending();
+
+bool network_start_background_update(int64_t deadline_us);
+
+// Asks the task to pause the download and disconnect now
+void network_stop_background_update();
+
+bool network_wait_background_update(int64_t until_us);
+
+void network_disconnect_wifi();
+
+// Drops the access point, lease and download progress kept in RTC memory; a storage reset hook
+void network_reset_caches();
\ No newline at end of file
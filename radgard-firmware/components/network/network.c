@@ -1,15 +1,20 @@
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
+#include <freertos/semphr.h>
 
 #include <esp_log.h>
+#include "esp_attr.h"
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include "esp_sntp.h"
-#include <esp_https_ota.h>
+#include <esp_ota_ops.h>
 
 #include <wifi_provisioning/manager.h>
 
@@ -18,8 +23,14 @@
 #include <cJSON.h>
 
 #include "network.h"
+#include "hal.h"
+#include "checksum.h"
 #include "storage.h"
+#include "settings.h"
 #include "api.h"
+#include "profile.h"
+#include "clock.h"
+#include "delta.h"
 
 static const char *TAG = "network";
 
@@ -30,14 +41,92 @@ static const char *ENDPOINT = "setup";
 /* Signal Wi-Fi events on this event-group */
 const int WIFI_CONNECTED_EVENT = BIT0;
 const int WIFI_DISCONNECTED_EVENT = BIT1;
-const int WIFI_STATUS_EVENT = BIT0 | BIT1;
+const int WIFI_ASSOCIATED_EVENT = BIT2;
 static EventGroupHandle_t wifi_event_group;
 
-const int firmware_sync_completed = BIT0;
-static EventGroupHandle_t firmware_sync_event_group;
+// Most routers keep a lease for a day or more and offer the same address again to the same MAC
+#define WIFI_CACHE_IP_MAX_AGE_S (3 * 24 * 3600)
+
+/* The last association and DHCP lease, so the next online wake can connect
+ * straight to the access point's BSSID and channel and skip DHCP */
+typedef struct {
+    uint32_t ssid_crc;
+    uint8_t bssid[6];
+    uint8_t channel;
+    esp_netif_ip_info_t ip_info;
+    esp_netif_dns_info_t dns;
+    uint32_t cached_at;
+    uint32_t crc;
+} wifi_cache_t;
+
+static RTC_DATA_ATTR wifi_cache_t wifi_cache;
+
+static esp_netif_t *sta_netif = NULL;
+static bool use_cached_ap = false;
+static bool use_cached_ip = false;
 
 static int disconnect_count = 0;
 
+static uint32_t wifi_ssid_crc(const wifi_config_t *config) {
+    const char *ssid = (const char *) config->sta.ssid;
+
+    return checksum_crc32(CHECKSUM_CRC32_INIT, ssid, strnlen(ssid, sizeof(config->sta.ssid)));
+}
+
+static uint32_t wifi_cache_crc() {
+    return checksum_crc32(CHECKSUM_CRC32_INIT, &wifi_cache, offsetof(wifi_cache_t, crc));
+}
+
+static void wifi_cache_store(const esp_netif_ip_info_t *ip_info) {
+    wifi_ap_record_t ap;
+    wifi_config_t config;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK || esp_wifi_get_config(WIFI_IF_STA, &config) != ESP_OK) {
+        return;
+    }
+
+    memset(&wifi_cache, 0, sizeof(wifi_cache_t));
+    wifi_cache.ssid_crc = wifi_ssid_crc(&config);
+    memcpy(wifi_cache.bssid, ap.bssid, sizeof(wifi_cache.bssid));
+    wifi_cache.channel = ap.primary;
+    wifi_cache.ip_info = *ip_info;
+    esp_netif_get_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &wifi_cache.dns);
+    wifi_cache.cached_at = hal_clock_now();
+    wifi_cache.crc = wifi_cache_crc();
+}
+
+/* Called on association: the cached lease replaces DHCP, and setting it raises IP_EVENT_STA_GOT_IP */
+static void wifi_cache_apply_ip() {
+    esp_netif_dhcpc_stop(sta_netif);
+
+    if (esp_netif_set_ip_info(sta_netif, &wifi_cache.ip_info) != ESP_OK) {
+        ESP_LOGW(TAG, "Cannot reuse the cached IP address; starting DHCP");
+        use_cached_ip = false;
+        esp_netif_dhcpc_start(sta_netif);
+
+        return;
+    }
+
+    esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &wifi_cache.dns);
+}
+
+/* The cached access point did not answer: forget it and scan like a first connection */
+static void wifi_cache_fall_back() {
+    ESP_LOGI(TAG, "Cached access point unavailable; scanning and using DHCP");
+
+    memset(&wifi_cache, 0, sizeof(wifi_cache_t));
+    use_cached_ap = false;
+    use_cached_ip = false;
+
+    wifi_config_t config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK) {
+        config.sta.bssid_set = false;
+        config.sta.channel = 0;
+        esp_wifi_set_config(WIFI_IF_STA, &config);
+    }
+
+    esp_netif_dhcpc_start(sta_netif);
+}
+
 /* Event handler for catching system events */
 static void event_handler(void* arg, esp_event_base_t event_base, int event_id, void* event_data) {
     if (event_base == WIFI_PROV_EVENT) {
@@ -74,16 +163,32 @@ static void event_handler(void* arg, esp_event_base_t event_base, int event_id,
                 break;
         }
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
+        hal_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        if (use_cached_ip) {
+            wifi_cache_apply_ip();
+        }
+
+        xEventGroupSetBits(wifi_event_group, WIFI_ASSOCIATED_EVENT);
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "Connected with IP Address:" IPSTR, IP2STR(&event->ip_info.ip));
+        ESP_LOGI(TAG, "Connected with IP Address:" IPSTR "%s", IP2STR(&event->ip_info.ip),
+                 use_cached_ip ? " (cached)" : "");
+
+        if (!use_cached_ip) {
+            wifi_cache_store(&event->ip_info);
+        }
+
         /* Signal main application to continue execution */
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_EVENT);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (disconnect_count < 3) {
+        if (use_cached_ap) {
+            // Falling back does not count against the reconnect attempts
+            wifi_cache_fall_back();
+            hal_wifi_connect();
+        } else if (disconnect_count < 3) {
             ESP_LOGI(TAG, "Disconnected. Connecting to the AP again...");
-            esp_wifi_connect();
+            hal_wifi_connect();
             disconnect_count += 1;
         } else {
             ESP_LOGI(TAG, "Disconnected. Skipping network init...");
@@ -95,6 +200,28 @@ static void event_handler(void* arg, esp_event_base_t event_base, int event_id,
 static void wifi_init_sta(void) {
     /* Start Wi-Fi in station mode */
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+    wifi_config_t config;
+    ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &config));
+
+    use_cached_ap = wifi_cache.crc == wifi_cache_crc() && wifi_cache.ssid_crc == wifi_ssid_crc(&config);
+
+    if (use_cached_ap) {
+        uint32_t now = hal_clock_now();
+        use_cached_ip = now >= wifi_cache.cached_at && now - wifi_cache.cached_at < WIFI_CACHE_IP_MAX_AGE_S;
+
+        ESP_LOGI(TAG, "Connecting to cached access point " MACSTR " on channel %u%s", MAC2STR(wifi_cache.bssid),
+                 wifi_cache.channel, use_cached_ip ? " with cached IP address" : "");
+
+        // The directed connection is for this wake only; the stored credentials stay as provisioned
+        ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+
+        config.sta.bssid_set = true;
+        memcpy(config.sta.bssid, wifi_cache.bssid, sizeof(config.sta.bssid));
+        config.sta.channel = wifi_cache.channel;
+        ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &config));
+    }
+
     ESP_ERROR_CHECK(esp_wifi_start());
 }
 
@@ -120,16 +247,23 @@ esp_err_t setup_handler(uint32_t session_id, const uint8_t *inbuf, ssize_t inlen
         char *zone_id = zone_id_json->valuestring;
         free(setup);
 
-        // Store `user_id` in NVS
-        esp_err_t set_err = storage_set_str(STORAGE_USER_ID, user_id);
-        if (set_err != ESP_OK) {
-            ESP_LOGE(TAG, "Error saving user_id to storage: %s", esp_err_to_name(set_err));
+        radgard_settings_t settings;
+        esp_err_t load_err = settings_load(&settings);
+        if (!settings_can_save(load_err)) {
+            ESP_LOGE(TAG, "Not storing /setup data over unreadable settings: %s", esp_err_to_name(load_err));
+            cJSON_Delete(json);
+
+            return ESP_FAIL;
         }
 
-        // Store `zone_id` in NVS
-        set_err = storage_set_str(STORAGE_ZONE_ID, zone_id);
+        strncpy(settings.user_id, user_id, SETTINGS_ID_LENGTH - 1);
+        settings.user_id[SETTINGS_ID_LENGTH - 1] = '\0';
+        strncpy(settings.zone_id, zone_id, SETTINGS_ID_LENGTH - 1);
+        settings.zone_id[SETTINGS_ID_LENGTH - 1] = '\0';
+
+        esp_err_t set_err = settings_save(&settings);
         if (set_err != ESP_OK) {
-            ESP_LOGE(TAG, "Error saving zone_id to storage: %s", esp_err_to_name(set_err));
+            ESP_LOGE(TAG, "Error saving /setup data to storage: %s", esp_err_to_name(set_err));
         }
 
         ESP_LOGI(TAG, "Stored /setup data in NVS");
@@ -141,87 +275,456 @@ esp_err_t setup_handler(uint32_t session_id, const uint8_t *inbuf, ssize_t inlen
     return ESP_FAIL;
 }
 
-static void time_sync_notification_cb(struct timeval *tv) {
-    ESP_LOGI(TAG, "Notification of a time synchronization event");
-}
+static time_t sntp_time;
 
-static void network_sync_time() {
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+// Replaces ESP-IDF's default, which sets the clock: clock_sync measures the RTC's drift first
+void sntp_sync_time(struct timeval *tv) {
+    sntp_time = tv->tv_sec;
+    sntp_set_sync_status(SNTP_SYNC_STATUS_COMPLETED);
+}
 
+static bool network_sync_time() {
     sntp_setoperatingmode(SNTP_OPMODE_POLL);
     sntp_setservername(0, "pool.ntp.org");
-    sntp_set_time_sync_notification_cb(time_sync_notification_cb);
-    sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
     sntp_init();
 
-    // Wait for time to be set
-    int retry = 0;
-    const int retry_count = 15;
-    while (sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET && ++retry < retry_count) {
-        ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
+    // Wait up to 10 s for the time; reading a completed status resets it
+    bool synced = false;
+    for (int retry = 0; retry < 100 && !synced; retry++) {
+        vTaskDelay(100 / portTICK_PERIOD_MS);
+        synced = sntp_get_sync_status() == SNTP_SYNC_STATUS_COMPLETED;
     }
 
-    ESP_ERROR_CHECK(esp_event_loop_delete_default());
+    sntp_stop();
+
+    return synced;
 }
 
-static char *replace_char(char* str, char find, char replace) {
-    char *current_pos = strchr(str, find);
+void network_set_time(time_t server_time) {
+    profile_phase_start(PROFILE_PHASE_TIME_SYNC);
+
+    if (server_time != 0) {
+        ESP_LOGI(TAG, "Syncing the clock to the server's Date header");
+        clock_sync(server_time);
+    } else if (clock_sync_due()) {
+        ESP_LOGI(TAG, "No time from the server; falling back to SNTP");
 
-    while (current_pos) {
-        *current_pos = replace;
-        current_pos = strchr(current_pos, find);
+        if (network_sync_time()) {
+            clock_sync(sntp_time);
+        } else {
+            ESP_LOGE(TAG, "SNTP did not answer; the clock is unchanged");
+        }
     }
 
-    return str;
+    profile_phase_end(PROFILE_PHASE_TIME_SYNC);
 }
 
-static void network_firmware_sync() {
-    ESP_LOGI(TAG, "Checking for firmware update");
+/* Firmware download, resumed across online wakes */
+
+// Awake time one wake spends downloading firmware; the rest waits for the next online wake
+#define OTA_WAKE_BUDGET_MS 60000
+#define OTA_SECTOR_SIZE 4096
+#define OTA_ETAG_LENGTH 64
+
+/* How far the download got. The image itself stays in the update
+ * partition, which is only erased a sector at a time as the image reaches
+ * it. A patch is applied as it arrives, so its patcher is kept too. */
+typedef struct {
+    uint32_t url_crc;
+    uint32_t partition_address;
+    uint32_t written; // bytes of the download
+    uint32_t length;  // 0 while unknown
+    char etag[OTA_ETAG_LENGTH];
+    bool patch;
+    delta_patcher_t patcher;
+    uint32_t crc;
+} ota_progress_t;
+
+static RTC_DATA_ATTR ota_progress_t ota_progress;
+// A patch that failed, so later wakes go straight to the whole image
+static RTC_DATA_ATTR uint32_t rejected_patch_crc;
+
+// The update a paused download belongs to, for irrigation wakes to continue
+typedef struct {
+    api_firmware_update_t firmware_update;
+    uint32_t crc;
+} pending_update_t;
+
+static RTC_DATA_ATTR pending_update_t pending_update;
+
+// Set when the valve's close is due and the background download has to end now
+static volatile bool background_stop = false;
+
+typedef struct {
+    const esp_partition_t *partition;
+    delta_io_t io;
+    int status_code;
+    uint32_t range_start; // first byte of a 206
+    uint32_t length;
+    char etag[OTA_ETAG_LENGTH];
+    bool started;
+    uint32_t image_written;
+    uint32_t erased;
+    int64_t deadline_us;
+    bool paused;
+} ota_download_t;
+
+static uint32_t ota_progress_crc() {
+    return checksum_crc32(CHECKSUM_CRC32_INIT, &ota_progress, offsetof(ota_progress_t, crc));
+}
 
-    cJSON *firmware_update = api_get_firmware_update_url();
+static uint32_t pending_update_crc() {
+    return checksum_crc32(CHECKSUM_CRC32_INIT, &pending_update, offsetof(pending_update_t, crc));
+}
 
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+static void ota_status(void *user_data, int status_code) {
+    ((ota_download_t *) user_data)->status_code = status_code;
+}
+
+static void ota_header(void *user_data, const char *key, const char *value) {
+    ota_download_t *download = user_data;
+
+    if (strcasecmp(key, "Content-Range") == 0) {
+        unsigned start, last, length;
+        if (sscanf(value, "bytes %u-%u/%u", &start, &last, &length) == 3) {
+            download->range_start = start;
+            download->length = length;
+        }
+    } else if (strcasecmp(key, "Content-Length") == 0 && download->status_code == 200) {
+        download->length = strtoul(value, NULL, 10);
+    } else if (strcasecmp(key, "ETag") == 0 && strlen(value) < OTA_ETAG_LENGTH) {
+        strcpy(download->etag, value);
+    }
+}
 
-    if (firmware_update != NULL) {
-        cJSON *url_json = cJSON_GetObjectItem(firmware_update, "url");
-        cJSON *cert_json = cJSON_GetObjectItem(firmware_update, "cert");
+static esp_err_t read_running_image(void *user_data, uint32_t offset, uint8_t *data, size_t length) {
+    return esp_partition_read(esp_ota_get_running_partition(), offset, data, length);
+}
 
-        char *url = url_json->valuestring;
-        char *cert = cert_json->valuestring;
-        replace_char(cert, ' ', '\n');
-        replace_char(cert, '_', ' ');
+static esp_err_t write_image(void *user_data, const uint8_t *data, size_t length) {
+    ota_download_t *download = user_data;
 
-        ESP_LOGI(TAG, "Firmware is out of date, getting new firmware from %s with cert %s", url, cert);
-        
-        esp_http_client_config_t config = {
-            .url = url,
-            .cert_pem = cert
-        };
+    uint32_t end = download->image_written + length;
+    if (end > download->partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
 
-        esp_err_t ota_err = esp_https_ota(&config);
+    while (download->erased < end) {
+        esp_err_t err = esp_partition_erase_range(download->partition, download->erased, OTA_SECTOR_SIZE);
+        if (err != ESP_OK) {
+            return err;
+        }
 
-        cJSON_Delete(firmware_update);
+        download->erased += OTA_SECTOR_SIZE;
+    }
 
-        if (ota_err == ESP_OK) {
-            ESP_LOGI(TAG, "Firmware update successfully applied, restarting system");
-            esp_restart();
+    esp_err_t err = esp_partition_write(download->partition, download->image_written, data, length);
+    if (err == ESP_OK) {
+        download->image_written = end;
+    }
+
+    return err;
+}
+
+// The first body chunk: a 206 continues the download, a 200 starts it over
+static esp_err_t ota_start(ota_download_t *download) {
+    if (download->status_code == 200) {
+        if (ota_progress.written > 0) {
+            ESP_LOGI(TAG, "Server sent the whole download; starting over");
         }
+
+        ota_progress.written = 0;
+        delta_patcher_begin(&ota_progress.patcher);
+    } else if (download->range_start != ota_progress.written) {
+        ESP_LOGE(TAG, "Server resumed at %u instead of %u", download->range_start, ota_progress.written);
+
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    ota_progress.length = download->length;
+    strcpy(ota_progress.etag, download->etag);
+
+    // The sector holding the next byte was erased when the image first reached it
+    download->image_written = ota_progress.patch ? ota_progress.patcher.target_written : ota_progress.written;
+    download->erased = (download->image_written + OTA_SECTOR_SIZE - 1) & ~(OTA_SECTOR_SIZE - 1);
+    download->started = true;
+
+    return ESP_OK;
+}
+
+static esp_err_t ota_data(void *user_data, const char *data, size_t length) {
+    ota_download_t *download = user_data;
+
+    // An error page is not part of the download
+    if (download->status_code != 200 && download->status_code != 206) {
+        return ESP_OK;
+    }
+
+    esp_err_t err = download->started ? ESP_OK : ota_start(download);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (ota_progress.patch) {
+        err = delta_patcher_feed(&ota_progress.patcher, &download->io, (const uint8_t *) data, length);
     } else {
-        ESP_LOGI(TAG, "Firmware is the latest version");
+        err = write_image(download, (const uint8_t *) data, length);
     }
 
-    ESP_ERROR_CHECK(esp_event_loop_delete_default());
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    ota_progress.written += length;
+
+    // Stop the transfer once this wake's budget is spent or it is told to, unless the download is complete
+    if (ota_progress.written != ota_progress.length &&
+        (background_stop || hal_clock_monotonic_us() >= download->deadline_us)) {
+        download->paused = true;
+
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
 
-    xEventGroupSetBits(firmware_sync_event_group, firmware_sync_completed);
+/* Streams the image, or a patch against the running image, into the update
+ * partition through hal_http_perform, continuing a download an earlier wake
+ * left unfinished. Returns ESP_ERR_TIMEOUT when the budget ran out first and
+ * ESP_ERR_NOT_SUPPORTED for a patch that cannot be used. */
+static esp_err_t download_firmware(const char *url, const uint8_t *cert, size_t cert_length, bool patch,
+                                   int64_t deadline_us) {
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t url_crc = checksum_crc32(CHECKSUM_CRC32_INIT, url, strlen(url));
+    if (ota_progress.crc != ota_progress_crc() || ota_progress.url_crc != url_crc ||
+        ota_progress.partition_address != partition->address || ota_progress.patch != patch) {
+        memset(&ota_progress, 0, sizeof(ota_progress_t));
+        ota_progress.url_crc = url_crc;
+        ota_progress.partition_address = partition->address;
+        ota_progress.patch = patch;
+        delta_patcher_begin(&ota_progress.patcher);
+    }
+
+    // Without an ETag for If-Range a changed download could be spliced onto the old one
+    bool resume = ota_progress.written > 0 && ota_progress.etag[0] != '\0';
+    if (resume) {
+        ESP_LOGI(TAG, "Resuming the firmware %s at %u of %u bytes", patch ? "patch" : "download",
+                 ota_progress.written, ota_progress.length);
+    }
+
+    ota_download_t download = {
+        .partition = partition,
+        .deadline_us = deadline_us
+    };
+
+    download.io = (delta_io_t) {
+        .read_source = read_running_image,
+        .write_target = write_image,
+        .user_data = &download
+    };
+
+    hal_http_request_t request = {
+        .url = url,
+        .post = false,
+        .range_start = resume ? ota_progress.written : 0,
+        .if_range = resume ? ota_progress.etag : NULL,
+        .cert_der = cert,
+        .cert_der_length = cert_length,
+        .timeout_ms = 10000,
+        .on_status = ota_status,
+        .on_header = ota_header,
+        .on_data = ota_data,
+        .user_data = &download
+    };
+
+    int status_code = 0;
+    esp_err_t ota_err = hal_http_perform(&request, &status_code);
+
+    if (ota_err == ESP_OK && status_code == 416) {
+        ESP_LOGE(TAG, "Server rejected the resume point; starting over next time");
+        memset(&ota_progress, 0, sizeof(ota_progress_t));
+        ota_err = ESP_ERR_INVALID_RESPONSE;
+    } else if (ota_err == ESP_OK && status_code != 200 && status_code != 206) {
+        ESP_LOGE(TAG, "Firmware download returned status %d", status_code);
+        ota_err = ESP_ERR_INVALID_RESPONSE;
+    } else if (ota_err == ESP_OK && ota_progress.length != 0 && ota_progress.written != ota_progress.length) {
+        ota_err = ESP_ERR_INVALID_SIZE;
+    }
+
+    // A patch that does not fit the running image, is malformed or builds the wrong image is dropped
+    if (patch && (ota_err == ESP_OK || ota_progress.patcher.err != ESP_OK)) {
+        esp_err_t patch_err = delta_patcher_end(&ota_progress.patcher);
+        if (patch_err != ESP_OK) {
+            ESP_LOGE(TAG, "Firmware patch rejected: %s", esp_err_to_name(patch_err));
+            rejected_patch_crc = url_crc;
+            memset(&ota_progress, 0, sizeof(ota_progress_t));
+
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+
+    if (ota_err != ESP_OK) {
+        if (download.paused) {
+            ESP_LOGI(TAG, "Firmware download paused at %u of %u bytes", ota_progress.written, ota_progress.length);
+        }
+
+        ota_progress.crc = ota_progress_crc();
+
+        return ota_err;
+    }
+
+    // Checks the image, including its appended SHA-256, before booting it
+    ota_err = esp_ota_set_boot_partition(partition);
+
+    // Done, or a corrupt image that has to be fetched afresh
+    memset(&ota_progress, 0, sizeof(ota_progress_t));
+
+    return ota_err;
+}
+
+/* Fetches the CA and downloads the patch or the whole image until
+ * `deadline_us`, remembering a paused download for the next wakes */
+static esp_err_t update_firmware(const api_firmware_update_t *firmware_update, int64_t deadline_us) {
+    const char *url = firmware_update->url;
+    const char *patch_url = firmware_update->patch_url;
+
+    static uint8_t cert[API_FIRMWARE_CERT_LENGTH];
+    size_t cert_length = sizeof(cert);
+    esp_err_t ota_err = api_get_firmware_cert(firmware_update, cert, &cert_length);
+    if (ota_err != ESP_OK) {
+        ESP_LOGE(TAG, "No CA for the firmware host: %s", esp_err_to_name(ota_err));
+
+        return ota_err;
+    }
+
+    ota_err = ESP_ERR_NOT_SUPPORTED;
+
+    // A patch against the running image is a fraction of the whole; the whole image is the fallback
+    if (patch_url[0] != '\0' && checksum_crc32(CHECKSUM_CRC32_INIT, patch_url, strlen(patch_url)) != rejected_patch_crc) {
+        ESP_LOGI(TAG, "Firmware is out of date, patching it from %s", patch_url);
+        ota_err = download_firmware(patch_url, cert, cert_length, true, deadline_us);
+    }
+
+    if (ota_err == ESP_ERR_NOT_SUPPORTED) {
+        ESP_LOGI(TAG, "Firmware is out of date, getting new firmware from %s", url);
+        ota_err = download_firmware(url, cert, cert_length, false, deadline_us);
+    }
+
+    if (ota_err == ESP_ERR_TIMEOUT) {
+        memcpy(&pending_update.firmware_update, firmware_update, sizeof(api_firmware_update_t));
+        pending_update.crc = pending_update_crc();
+    } else {
+        memset(&pending_update, 0, sizeof(pending_update_t));
+    }
+
+    return ota_err;
+}
+
+void network_update_firmware(api_firmware_update_t *firmware_update) {
+    profile_phase_start(PROFILE_PHASE_FIRMWARE_SYNC);
+
+    int64_t deadline_us = hal_clock_monotonic_us() + (int64_t) OTA_WAKE_BUDGET_MS * 1000;
+    esp_err_t ota_err = update_firmware(firmware_update, deadline_us);
+
+    if (ota_err == ESP_OK) {
+        ESP_LOGI(TAG, "Firmware update successfully applied, restarting system");
+        esp_restart();
+    } else if (ota_err == ESP_ERR_TIMEOUT) {
+        ESP_LOGI(TAG, "Firmware download continues on the next online or irrigation wake");
+    } else {
+        ESP_LOGE(TAG, "Firmware update failed: %s", esp_err_to_name(ota_err));
+    }
+
+    profile_phase_end(PROFILE_PHASE_FIRMWARE_SYNC);
+}
+
+/* Background download on irrigation wakes */
+
+// Below the main task, which has the valve to close, and on the core it does not run on
+#define BACKGROUND_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#define BACKGROUND_TASK_CORE 1
+#define BACKGROUND_TASK_STACK 8192
+
+static SemaphoreHandle_t background_done = NULL;
+static int64_t background_deadline_us;
+
+static void background_update_task(void *arg) {
+    // The pending update is cleared or rewritten as the download ends
+    static api_firmware_update_t firmware_update;
+    memcpy(&firmware_update, &pending_update.firmware_update, sizeof(api_firmware_update_t));
+
+    // Connecting can take most of the valve's open time
+    if (network_start_provision_connect_wifi() && !background_stop) {
+        int64_t deadline_us = hal_clock_monotonic_us() + (int64_t) OTA_WAKE_BUDGET_MS * 1000;
+        if (deadline_us > background_deadline_us) {
+            deadline_us = background_deadline_us;
+        }
+
+        esp_err_t ota_err = update_firmware(&firmware_update, deadline_us);
+
+        // A restart now would look like a power-on, which closes the valve; the next full boot switches instead
+        if (ota_err == ESP_OK) {
+            ESP_LOGI(TAG, "Firmware update downloaded in the background; it runs from the next full boot");
+        } else if (ota_err == ESP_ERR_TIMEOUT) {
+            ESP_LOGI(TAG, "Background firmware download paused at the valve's close");
+        } else {
+            ESP_LOGE(TAG, "Background firmware update failed: %s", esp_err_to_name(ota_err));
+        }
+    }
+
+    network_disconnect_wifi();
+
+    xSemaphoreGive(background_done);
     vTaskDelete(NULL);
 }
 
+bool network_background_update_pending() {
+    return pending_update.crc == pending_update_crc() && pending_update.firmware_update.available;
+}
+
+bool network_start_background_update(int64_t deadline_us) {
+    if (!network_background_update_pending()) {
+        return false;
+    }
+
+    if (background_done == NULL) {
+        background_done = xSemaphoreCreateBinary();
+    }
+
+    background_deadline_us = deadline_us;
+    background_stop = false;
+
+    ESP_LOGI(TAG, "Continuing the firmware download in the background");
+
+    return xTaskCreatePinnedToCore(background_update_task, "ota_background", BACKGROUND_TASK_STACK, NULL,
+                                   BACKGROUND_TASK_PRIORITY, NULL, BACKGROUND_TASK_CORE) == pdPASS;
+}
+
+void network_stop_background_update() {
+    background_stop = true;
+}
+
+bool network_wait_background_update(int64_t until_us) {
+    int64_t wait_us = until_us - hal_clock_monotonic_us();
+    TickType_t ticks = wait_us > 0 ? (TickType_t) (wait_us / 1000 / portTICK_PERIOD_MS) : 0;
+
+    return xSemaphoreTake(background_done, ticks) == pdTRUE;
+}
+
 bool network_start_provision_connect_wifi() {
+    /* Wi-Fi keeps its calibration and credentials in NVS */
+    storage_init_nvs();
+
+    profile_phase_start(PROFILE_PHASE_WIFI_CONNECT);
+
     /* Initialize TCP/IP */
     ESP_ERROR_CHECK(esp_netif_init());
 
-    /* Initialize the event loop */
+    /* The default event loop serves the whole online session; network_disconnect_wifi deletes it */
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     wifi_event_group = xEventGroupCreate();
 
@@ -231,7 +734,7 @@ bool network_start_provision_connect_wifi() {
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL));
 
     /* Initialize Wi-Fi including netif with default config */
-    esp_netif_create_default_wifi_sta();
+    sta_netif = esp_netif_create_default_wifi_sta();
     esp_netif_create_default_wifi_ap();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
@@ -314,30 +817,40 @@ bool network_start_provision_connect_wifi() {
         wifi_init_sta();
     }
 
-    /* Wait for Wi-Fi connection */
-    xEventGroupWaitBits(wifi_event_group, WIFI_STATUS_EVENT, false, false, portMAX_DELAY);
+    /* Wait for association, then for an IP address; the connection is usable as soon as it has one */
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group, WIFI_ASSOCIATED_EVENT | WIFI_DISCONNECTED_EVENT,
+                                           false, false, portMAX_DELAY);
 
-    ESP_ERROR_CHECK(esp_event_loop_delete_default());
+    profile_phase_end(PROFILE_PHASE_WIFI_CONNECT);
 
-    if (xEventGroupGetBits(wifi_event_group) == WIFI_DISCONNECTED_EVENT) {
+    if ((bits & WIFI_ASSOCIATED_EVENT) != 0) {
+        profile_phase_start(PROFILE_PHASE_WIFI_SETTLE);
+        bits = xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_EVENT | WIFI_DISCONNECTED_EVENT,
+                                   false, false, portMAX_DELAY);
+        profile_phase_end(PROFILE_PHASE_WIFI_SETTLE);
+    }
+
+    if ((bits & WIFI_CONNECTED_EVENT) == 0) {
         return false;
     }
 
-    ESP_LOGI(TAG, "Just connected to WIFI - starting sleep to allow proper configuration");
-    vTaskDelay(1000 / portTICK_RATE_MS);
-    ESP_LOGI(TAG, "Just connected to WIFI - ending sleep to use for API calls");
+    return true;
+}
 
-    network_sync_time();
+void network_disconnect_wifi() {
+    // Stopping Wi-Fi raises a disconnect event, which must not be answered with a reconnect
+    esp_event_handler_unregister(WIFI_PROV_EVENT, ESP_EVENT_ANY_ID, &event_handler);
+    esp_event_handler_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler);
+    esp_event_handler_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler);
 
-    firmware_sync_event_group = xEventGroupCreate();
-    xTaskCreate(&network_firmware_sync, "network_firmware_sync", 8192, NULL, 5, NULL);
-    xEventGroupWaitBits(firmware_sync_event_group, firmware_sync_completed, false, true, portMAX_DELAY);
+    hal_wifi_stop();
 
-    return true;
+    ESP_ERROR_CHECK(esp_event_loop_delete_default());
 }
 
-void network_disconnect_wifi() {
-    ESP_ERROR_CHECK(esp_wifi_stop());
-    ESP_ERROR_CHECK(esp_wifi_deinit());
-    esp_netif_deinit();
+void network_reset_caches() {
+    memset(&wifi_cache, 0, sizeof(wifi_cache_t));
+    memset(&ota_progress, 0, sizeof(ota_progress_t));
+    memset(&pending_update, 0, sizeof(pending_update_t));
+    rejected_patch_crc = 0;
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define PROFILE_RING_LENGTH 16
+#define PROFILE_HISTOGRAM_BUCKETS 16
+
+typedef enum {
+    PROFILE_PHASE_NVS_INIT = 0,
+    PROFILE_PHASE_WIFI_CONNECT,
+    PROFILE_PHASE_WIFI_SETTLE, // association to IP address
+    PROFILE_PHASE_TIME_SYNC,
+    PROFILE_PHASE_FIRMWARE_SYNC,
+    PROFILE_PHASE_SETTINGS_FETCH,
+    PROFILE_PHASE_SLEEP_TIME,
+    PROFILE_PHASE_COUNT
+} profile_phase_t;
+
+/*
+ * Timings of one full boot. Phases that did not run on that wake have
+ * their bit clear in `phases_run`.
+ */
+typedef struct {
+    uint8_t wakeup_cause;
+    uint8_t phases_run;
+    uint32_t awake_us;
+    uint32_t phase_us[PROFILE_PHASE_COUNT];
+} profile_wake_t;
+
+/*
+ * Phase timestamps for the current wake, kept in an RTC memory ring of the
+ * last PROFILE_RING_LENGTH wakes so they survive deep sleep.
+ */
+void profile_begin_wake(uint8_t wakeup_cause);
+
+void profile_phase_start(profile_phase_t phase);
+
+void profile_phase_end(profile_phase_t phase);
+
+void profile_end_wake();
+
+size_t profile_get_wakes(profile_wake_t *wakes, size_t max_wakes);
+
+void profile_reset();
+
+/*
+ * Decoder for the ring: log2 millisecond buckets, where bucket i holds
+ * durations in [2^(i-1), 2^i) ms and bucket 0 holds anything under 1 ms.
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t buckets[PROFILE_HISTOGRAM_BUCKETS];
+} profile_histogram_t;
+
+const char *profile_phase_name(profile_phase_t phase);
+
+void profile_build_histogram(const profile_wake_t *wakes, size_t wakes_length, profile_phase_t phase, profile_histogram_t *histogram);
+
+void profile_print_histograms(const profile_wake_t *wakes, size_t wakes_length);
+
+#endif
@@ -0,0 +1,118 @@
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+// Host builds keep the "RTC" region in ordinary memory
+#define RTC_DATA_ATTR
+#endif
+
+#include "checksum.h"
+#include "hal.h"
+#include "profile.h"
+
+typedef struct {
+    uint8_t head;
+    uint8_t length;
+    profile_wake_t wakes[PROFILE_RING_LENGTH];
+    uint32_t crc;
+} profile_ring_t;
+
+static RTC_DATA_ATTR profile_ring_t ring;
+
+static profile_wake_t current;
+static int64_t phase_start_us[PROFILE_PHASE_COUNT];
+
+/* Only the task that began the wake is timed. The background firmware
+ * download connects Wi-Fi and opens NVS on core 1 while the main task runs
+ * the valve, and its phases would race `current` and belong to no wake. */
+#ifdef ESP_PLATFORM
+static TaskHandle_t wake_task = NULL;
+
+static void set_wake_task() {
+    wake_task = xTaskGetCurrentTaskHandle();
+}
+
+static bool on_wake_task() {
+    return xTaskGetCurrentTaskHandle() == wake_task;
+}
+#else
+// The host backend runs everything on one thread
+static void set_wake_task() {
+}
+
+static bool on_wake_task() {
+    return true;
+}
+#endif
+
+static int64_t get_time_us() {
+    return hal_clock_monotonic_us();
+}
+
+static uint32_t ring_crc() {
+    return checksum_crc32(CHECKSUM_CRC32_INIT, &ring, offsetof(profile_ring_t, crc));
+}
+
+void profile_begin_wake(uint8_t wakeup_cause) {
+    set_wake_task();
+
+    memset(&current, 0, sizeof(profile_wake_t));
+    current.wakeup_cause = wakeup_cause;
+}
+
+void profile_phase_start(profile_phase_t phase) {
+    if (!on_wake_task()) {
+        return;
+    }
+
+    phase_start_us[phase] = get_time_us();
+}
+
+void profile_phase_end(profile_phase_t phase) {
+    if (!on_wake_task()) {
+        return;
+    }
+
+    // Phases entered more than once in a wake accumulate
+    current.phase_us[phase] += (uint32_t) (get_time_us() - phase_start_us[phase]);
+    current.phases_run |= 1 << phase;
+}
+
+void profile_end_wake() {
+    current.awake_us = (uint32_t) get_time_us();
+
+    if (ring.crc != ring_crc() || ring.head >= PROFILE_RING_LENGTH) {
+        memset(&ring, 0, sizeof(profile_ring_t));
+    }
+
+    ring.wakes[ring.head] = current;
+    ring.head = (ring.head + 1) % PROFILE_RING_LENGTH;
+    if (ring.length < PROFILE_RING_LENGTH) {
+        ring.length += 1;
+    }
+
+    ring.crc = ring_crc();
+}
+
+size_t profile_get_wakes(profile_wake_t *wakes, size_t max_wakes) {
+    if (ring.crc != ring_crc() || ring.head >= PROFILE_RING_LENGTH) {
+        return 0;
+    }
+
+    size_t length = ring.length < max_wakes ? ring.length : max_wakes;
+
+    // Oldest first
+    size_t oldest = (ring.head + PROFILE_RING_LENGTH - ring.length) % PROFILE_RING_LENGTH;
+    for (size_t i = 0; i < length; i++) {
+        wakes[i] = ring.wakes[(oldest + ring.length - length + i) % PROFILE_RING_LENGTH];
+    }
+
+    return length;
+}
+
+void profile_reset() {
+    memset(&ring, 0, sizeof(profile_ring_t));
+}
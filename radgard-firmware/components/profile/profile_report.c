@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "profile.h"
+
+static const char *PHASE_NAMES[PROFILE_PHASE_COUNT] = {
+    "nvs_init",
+    "wifi_connect",
+    "wifi_settle",
+    "time_sync",
+    "firmware_sync",
+    "settings_fetch",
+    "sleep_time"
+};
+
+const char *profile_phase_name(profile_phase_t phase) {
+    return PHASE_NAMES[phase];
+}
+
+static uint8_t bucket_for(uint32_t duration_us) {
+    uint32_t duration_ms = duration_us / 1000;
+    uint8_t bucket = 0;
+
+    while (duration_ms > 0 && bucket < PROFILE_HISTOGRAM_BUCKETS - 1) {
+        duration_ms >>= 1;
+        bucket += 1;
+    }
+
+    return bucket;
+}
+
+void profile_build_histogram(const profile_wake_t *wakes, size_t wakes_length, profile_phase_t phase, profile_histogram_t *histogram) {
+    memset(histogram, 0, sizeof(profile_histogram_t));
+
+    for (size_t i = 0; i < wakes_length; i++) {
+        if (!(wakes[i].phases_run & (1 << phase))) {
+            continue;
+        }
+
+        uint32_t duration_us = wakes[i].phase_us[phase];
+
+        if (histogram->count == 0 || duration_us < histogram->min_us) {
+            histogram->min_us = duration_us;
+        }
+        if (duration_us > histogram->max_us) {
+            histogram->max_us = duration_us;
+        }
+
+        histogram->count += 1;
+        histogram->total_us += duration_us;
+        histogram->buckets[bucket_for(duration_us)] += 1;
+    }
+}
+
+void profile_print_histograms(const profile_wake_t *wakes, size_t wakes_length) {
+    printf("Wake profile over %u wakes\n", (unsigned) wakes_length);
+
+    for (int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+        profile_histogram_t histogram;
+        profile_build_histogram(wakes, wakes_length, phase, &histogram);
+
+        if (histogram.count == 0) {
+            continue;
+        }
+
+        printf("  %-15s n=%-3u min=%u.%03u max=%u.%03u avg=%u.%03u ms\n",
+               profile_phase_name(phase),
+               (unsigned) histogram.count,
+               (unsigned) (histogram.min_us / 1000), (unsigned) (histogram.min_us % 1000),
+               (unsigned) (histogram.max_us / 1000), (unsigned) (histogram.max_us % 1000),
+               (unsigned) (histogram.total_us / histogram.count / 1000), (unsigned) (histogram.total_us / histogram.count % 1000));
+
+        for (int bucket = 0; bucket < PROFILE_HISTOGRAM_BUCKETS; bucket++) {
+            if (histogram.buckets[bucket] == 0) {
+                continue;
+            }
+
+            uint32_t upper_ms = 1u << bucket;
+            printf("    %s%6u ms | %u\n", bucket == PROFILE_HISTOGRAM_BUCKETS - 1 ? ">=" : "< ",
+                   (unsigned) (bucket == PROFILE_HISTOGRAM_BUCKETS - 1 ? upper_ms >> 1 : upper_ms),
+                   (unsigned) histogram.buckets[bucket]);
+        }
+    }
+}
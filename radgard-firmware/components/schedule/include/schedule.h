@@ -0,0 +1,91 @@
+#ifndef __SCHEDULE_H__
+#define __SCHEDULE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "timezone.h"
+
+#define SCHEDULE_DAYS 7
+#define SCHEDULE_MAX_DAY_TIMES 16
+#define SCHEDULE_MAX_EVENTS (SCHEDULE_DAYS * SCHEDULE_MAX_DAY_TIMES)
+
+#define SCHEDULE_MINUTES_PER_DAY 1440
+#define SCHEDULE_MINUTES_PER_WEEK (SCHEDULE_DAYS * SCHEDULE_MINUTES_PER_DAY)
+
+// Compiled events are a minute of the local week (Sunday 00:00 is 0) plus an action bit
+#define SCHEDULE_EVENT_MINUTE_MASK 0x3fff
+#define SCHEDULE_EVENT_OPEN 0x8000
+
+typedef enum {
+    SCHEDULE_ACTION_NONE = 0,
+    SCHEDULE_ACTION_OPEN,
+    SCHEDULE_ACTION_CLOSE
+} schedule_action_t;
+
+/*
+ * Compiled week of irrigation settings. `events` is sorted by minute of
+ * week so the next event is found with a binary search.
+ */
+typedef struct {
+    timezone_t timezone;
+    uint8_t sig_rains[SCHEDULE_DAYS];
+    uint8_t events_length;
+    uint16_t events[SCHEDULE_MAX_EVENTS];
+} schedule_t;
+
+/*
+ * A wake-up at `time` (UTC epoch seconds). SCHEDULE_ACTION_NONE marks the
+ * daily irrigation fetch, which needs a full boot.
+ */
+typedef struct {
+    uint32_t time;
+    schedule_action_t action;
+} schedule_event_t;
+
+/*
+ * Outcome of a timer wake. When `full_boot` is false the wake stub performs
+ * `action` and sleeps until `next_event`; otherwise app_main handles the wake.
+ */
+typedef struct {
+    bool full_boot;
+    schedule_action_t action;
+    schedule_event_t next_event;
+} schedule_wake_t;
+
+void schedule_init(schedule_t *schedule, const timezone_t *timezone);
+
+/*
+ * Replaces one day's events with server day times (seconds since local
+ * midnight, truncated to the minute). Even indices open the solenoid and
+ * odd indices close it.
+ */
+bool schedule_set_day_times(schedule_t *schedule, uint8_t day, const uint32_t *times, size_t length);
+
+uint8_t schedule_get_day(const schedule_t *schedule, uint32_t now);
+
+bool schedule_in_fetch_window(const schedule_t *schedule, uint32_t now);
+
+void schedule_next_event(const schedule_t *schedule, uint32_t now, schedule_event_t *event);
+
+void schedule_decide_wake(const schedule_t *schedule, const schedule_event_t *pending, uint32_t now, schedule_wake_t *wake);
+
+/*
+ * RTC memory copy of the schedule. It survives deep sleep but not power
+ * loss; reads only succeed when the stored CRC matches. Storing a new
+ * schedule clears the pending event.
+ */
+void schedule_cache_store(const schedule_t *schedule);
+
+bool schedule_cache_load(schedule_t *schedule);
+
+const schedule_t *schedule_cache_peek();
+
+void schedule_cache_set_next_event(const schedule_event_t *event);
+
+bool schedule_cache_get_next_event(schedule_event_t *event);
+
+void schedule_cache_invalidate();
+
+#endif
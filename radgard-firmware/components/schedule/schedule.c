@@ -0,0 +1,145 @@
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define RTC_IRAM_ATTR
+#endif
+
+#include "schedule.h"
+
+// Everything reachable from the deep sleep wake stub lives in RTC fast memory
+
+#define SECONDS_PER_DAY 86400
+#define EPOCH_WEEKDAY 4             // 1970-01-01 was a Thursday
+#define FETCH_TIME 5400             // 01:30
+#define FETCH_WINDOW_END 9060       // 02:30:59
+#define EVENT_MARGIN 5
+
+static uint32_t RTC_IRAM_ATTR local_time(const schedule_t *schedule, uint32_t now) {
+    return timezone_to_local(&schedule->timezone, now);
+}
+
+void schedule_init(schedule_t *schedule, const timezone_t *timezone) {
+    memset(schedule, 0, sizeof(schedule_t));
+    schedule->timezone = *timezone;
+}
+
+// First index in [start, end) whose minute of week is >= minute
+static size_t RTC_IRAM_ATTR lower_bound(const schedule_t *schedule, size_t start, size_t end, uint16_t minute) {
+    while (start < end) {
+        size_t middle = start + (end - start) / 2;
+
+        if ((schedule->events[middle] & SCHEDULE_EVENT_MINUTE_MASK) < minute) {
+            start = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+
+    return start;
+}
+
+bool schedule_set_day_times(schedule_t *schedule, uint8_t day, const uint32_t *times, size_t length) {
+    if (day >= SCHEDULE_DAYS || length > SCHEDULE_MAX_DAY_TIMES) {
+        return false;
+    }
+
+    uint16_t day_minute = day * SCHEDULE_MINUTES_PER_DAY;
+    size_t start = lower_bound(schedule, 0, schedule->events_length, day_minute);
+    size_t end = lower_bound(schedule, start, schedule->events_length, day_minute + SCHEDULE_MINUTES_PER_DAY);
+
+    if (schedule->events_length - (end - start) + length > SCHEDULE_MAX_EVENTS) {
+        return false;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        if (times[i] >= SECONDS_PER_DAY) {
+            return false;
+        }
+    }
+
+    // Make room for the new day in place of the old one
+    memmove(&schedule->events[start + length], &schedule->events[end], (schedule->events_length - end) * sizeof(uint16_t));
+    schedule->events_length = schedule->events_length - (end - start) + length;
+
+    for (size_t i = 0; i < length; i++) {
+        uint16_t event = (day_minute + times[i] / 60) | ((i % 2 == 0) ? SCHEDULE_EVENT_OPEN : 0);
+
+        // Insertion sort; server times are normally already in order
+        size_t j = start + i;
+        while (j > start && (schedule->events[j - 1] & SCHEDULE_EVENT_MINUTE_MASK) > (event & SCHEDULE_EVENT_MINUTE_MASK)) {
+            schedule->events[j] = schedule->events[j - 1];
+            j--;
+        }
+        schedule->events[j] = event;
+    }
+
+    return true;
+}
+
+uint8_t RTC_IRAM_ATTR schedule_get_day(const schedule_t *schedule, uint32_t now) {
+    return (local_time(schedule, now) / SECONDS_PER_DAY + EPOCH_WEEKDAY) % SCHEDULE_DAYS;
+}
+
+bool RTC_IRAM_ATTR schedule_in_fetch_window(const schedule_t *schedule, uint32_t now) {
+    return local_time(schedule, now) % SECONDS_PER_DAY < FETCH_WINDOW_END;
+}
+
+void RTC_IRAM_ATTR schedule_next_event(const schedule_t *schedule, uint32_t now, schedule_event_t *event) {
+    uint32_t local_now = local_time(schedule, now);
+    uint32_t day_seconds = local_now % SECONDS_PER_DAY;
+    uint32_t local_day_start = local_now - day_seconds;
+    uint8_t day = schedule_get_day(schedule, now);
+
+    if (!schedule->sig_rains[day]) {
+        // Events must be more than EVENT_MARGIN seconds away to be scheduled
+        uint16_t day_minute = day * SCHEDULE_MINUTES_PER_DAY;
+        uint16_t minute = day_minute + (day_seconds + EVENT_MARGIN) / 60 + 1;
+
+        size_t index = lower_bound(schedule, 0, schedule->events_length, minute);
+
+        if (index < schedule->events_length) {
+            uint16_t next = schedule->events[index];
+            uint16_t next_minute = next & SCHEDULE_EVENT_MINUTE_MASK;
+
+            if (next_minute < day_minute + SCHEDULE_MINUTES_PER_DAY) {
+                event->time = timezone_to_utc(&schedule->timezone, local_day_start + (next_minute - day_minute) * 60);
+                event->action = (next & SCHEDULE_EVENT_OPEN) ? SCHEDULE_ACTION_OPEN : SCHEDULE_ACTION_CLOSE;
+
+                return;
+            }
+        }
+    }
+
+    // Nothing left to actuate today; wake up at 01:30 for irrigation fetch
+    uint32_t local_fetch_time = local_day_start + FETCH_TIME;
+    if (day_seconds >= FETCH_TIME) {
+        local_fetch_time += SECONDS_PER_DAY;
+    }
+
+    event->time = timezone_to_utc(&schedule->timezone, local_fetch_time);
+    event->action = SCHEDULE_ACTION_NONE;
+}
+
+void RTC_IRAM_ATTR schedule_decide_wake(const schedule_t *schedule, const schedule_event_t *pending, uint32_t now, schedule_wake_t *wake) {
+    wake->full_boot = true;
+    wake->action = SCHEDULE_ACTION_NONE;
+    wake->next_event.time = 0;
+    wake->next_event.action = SCHEDULE_ACTION_NONE;
+
+    // Fetches and unknown wakes need Wi-Fi and NVS
+    if (pending->action == SCHEDULE_ACTION_NONE || schedule_in_fetch_window(schedule, now)) {
+        return;
+    }
+
+    schedule_next_event(schedule, now, &wake->next_event);
+
+    // Consuming a sig_rains flag is persisted to NVS by app_main
+    if (wake->next_event.action == SCHEDULE_ACTION_NONE && schedule->sig_rains[schedule_get_day(schedule, now)]) {
+        return;
+    }
+
+    wake->full_boot = false;
+    wake->action = pending->action;
+}
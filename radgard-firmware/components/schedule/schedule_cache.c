@@ -0,0 +1,72 @@
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+// Host builds keep the "RTC" region in ordinary memory
+#define RTC_DATA_ATTR
+#define RTC_IRAM_ATTR
+#endif
+
+#include "checksum.h"
+#include "schedule.h"
+
+typedef struct {
+    schedule_t schedule;
+    schedule_event_t next_event;
+    uint32_t crc;
+} schedule_cache_t;
+
+static RTC_DATA_ATTR schedule_cache_t cache;
+
+static uint32_t RTC_IRAM_ATTR cache_crc() {
+    return checksum_crc32(CHECKSUM_CRC32_INIT, &cache, offsetof(schedule_cache_t, crc));
+}
+
+void schedule_cache_store(const schedule_t *schedule) {
+    memcpy(&cache.schedule, schedule, sizeof(schedule_t));
+    cache.next_event.time = 0;
+    cache.next_event.action = SCHEDULE_ACTION_NONE;
+    cache.crc = cache_crc();
+}
+
+bool schedule_cache_load(schedule_t *schedule) {
+    if (cache.crc != cache_crc()) {
+        return false;
+    }
+
+    memcpy(schedule, &cache.schedule, sizeof(schedule_t));
+
+    return true;
+}
+
+const schedule_t * RTC_IRAM_ATTR schedule_cache_peek() {
+    if (cache.crc != cache_crc()) {
+        return NULL;
+    }
+
+    return &cache.schedule;
+}
+
+void RTC_IRAM_ATTR schedule_cache_set_next_event(const schedule_event_t *event) {
+    if (cache.crc != cache_crc()) {
+        return;
+    }
+
+    cache.next_event = *event;
+    cache.crc = cache_crc();
+}
+
+bool RTC_IRAM_ATTR schedule_cache_get_next_event(schedule_event_t *event) {
+    if (cache.crc != cache_crc()) {
+        return false;
+    }
+
+    *event = cache.next_event;
+
+    return true;
+}
+
+void schedule_cache_invalidate() {
+    memset(&cache, 0, sizeof(schedule_cache_t));
+}
@@ -0,0 +1,52 @@
+#ifndef __SETTINGS_H__
+#define __SETTINGS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "schedule.h"
+
+#define SETTINGS_SCHEMA_VERSION 2
+#define SETTINGS_ID_LENGTH 64
+#define SETTINGS_ETAG_LENGTH 48
+
+// The running build's version, recorded in `firmware_version` and reported to the server
+#define SETTINGS_FIRMWARE_VERSION 11
+
+/* `crc` covers the `size - sizeof(header)` bytes that follow the header */
+typedef struct {
+    uint16_t schema_version;
+    uint16_t size;
+    uint32_t crc;
+} radgard_settings_header_t;
+
+/* Everything the device persists, stored and loaded as a single NVS blob.
+ * New fields go at the end with a schema version bump; shorter records
+ * from older schemas load with the new fields zeroed. */
+typedef struct {
+    radgard_settings_header_t header;
+    uint8_t firmware_version;
+    uint8_t manual_on;
+    uint8_t has_schedule;
+    char user_id[SETTINGS_ID_LENGTH];
+    char zone_id[SETTINGS_ID_LENGTH];
+    schedule_t schedule;
+    // ETag of the response `schedule` came from; empty once the device has changed it
+    char schedule_etag[SETTINGS_ETAG_LENGTH];
+} radgard_settings_t;
+
+void settings_init(radgard_settings_t *settings);
+
+/* Loads the record, migrating the legacy per-key layout on first use.
+ * On failure `settings` is left initialized to defaults. */
+esp_err_t settings_load(radgard_settings_t *settings);
+
+/* Whether a record settings_load returned with `load_err` may be changed and
+ * saved back: it loaded, or none was stored yet. After any other error the
+ * record holds defaults, and saving it would overwrite the stored one. */
+bool settings_can_save(esp_err_t load_err);
+
+esp_err_t settings_save(radgard_settings_t *settings);
+
+#endif
@@ -1,19 +1,32 @@
 
-const char *STORAGE_VERSION;
+extern const char *STORAGE_SETTINGS;
 
-const char *STORAGE_USER_ID;
-const char *STORAGE_ZONE_ID;
+// DER of the firmware host's CA, see api_get_firmware_cert
+extern const char *STORAGE_OTA_CERT;
 
-const char *STORAGE_TIME_ZONE;
-const char *STORAGE_TIME_BASE;
-const char *STORAGE_SIG_RAINS;
+/* Legacy per-value keys, migrated into STORAGE_SETTINGS on first load */
+extern const char *STORAGE_VERSION;
 
-const char *STORAGE_SOLENOID_OPEN;
-const char *STORAGE_MANUAL_ON;
+extern const char *STORAGE_USER_ID;
+extern const char *STORAGE_ZONE_ID;
+
+extern const char *STORAGE_TIME_ZONE;
+extern const char *STORAGE_UTC_OFFSETS;
+extern const char *STORAGE_TIME_BASE;
+extern const char *STORAGE_SIG_RAINS;
+
+extern const char *STORAGE_SOLENOID_OPEN;
+extern const char *STORAGE_MANUAL_ON;
 
 void storage_init_nvs();
 void storage_deinit_nvs();
 
+/* Batch storage calls on one NVS handle with a single commit at the end.
+ * Calls may nest; only the outermost commit reaches flash. */
+esp_err_t storage_txn_begin();
+
+esp_err_t storage_txn_commit();
+
 esp_err_t storage_set_str(const char *key, const char *value);
 
 esp_err_t storage_set_u8(const char *key, uint8_t value);
@@ -36,4 +49,14 @@ esp_err_t storage_get_blob_size(const char *key, size_t *size);
 
 esp_err_t storage_remove(const char *key);
 
+/* Writes that reached NVS and writes skipped because the stored value already
+ * matched, counted since power-on */
+void storage_get_write_counts(uint32_t *performed, uint32_t *skipped);
+
+/* RTC-resident state of components above storage, which a factory reset drops
+ * along with NVS since RTC memory survives the restart */
+typedef void (*storage_reset_hook_t)();
+
+void storage_add_reset_hook(storage_reset_hook_t hook);
+
 void storage_reset();
\ No newline at end of file
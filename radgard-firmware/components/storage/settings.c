@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "hal.h"
+
+#include "storage.h"
+#include "settings.h"
+#include "checksum.h"
+
+static const char *TAG = "settings";
+
+static uint32_t settings_crc(const radgard_settings_t *settings, size_t size) {
+    const uint8_t *body = (const uint8_t *) settings + sizeof(radgard_settings_header_t);
+
+    return checksum_crc32(CHECKSUM_CRC32_INIT, body, size - sizeof(radgard_settings_header_t));
+}
+
+void settings_init(radgard_settings_t *settings) {
+    memset(settings, 0, sizeof(radgard_settings_t));
+}
+
+static bool settings_valid(const radgard_settings_t *settings, size_t size) {
+    const radgard_settings_header_t *header = &settings->header;
+
+    if (size < sizeof(radgard_settings_header_t) || header->size != size) {
+        return false;
+    }
+
+    if (header->schema_version == 0 || header->schema_version > SETTINGS_SCHEMA_VERSION) {
+        return false;
+    }
+
+    return header->crc == settings_crc(settings, size);
+}
+
+static bool load_legacy_schedule(schedule_t *schedule) {
+    timezone_t timezone;
+    size_t timezone_size = sizeof(timezone_t);
+    esp_err_t get_err = storage_get_blob(STORAGE_UTC_OFFSETS, &timezone, &timezone_size);
+
+    if (get_err != ESP_OK || timezone_size != sizeof(timezone_t)) {
+        // Settings stored before UTC offset tables only have whole hours behind UTC
+        uint32_t time_zone;
+        get_err = storage_get_u32(STORAGE_TIME_ZONE, &time_zone);
+        if (get_err != ESP_OK) {
+            return false;
+        }
+
+        timezone_init_fixed(&timezone, -(int32_t) time_zone * 3600);
+    }
+
+    schedule_init(schedule, &timezone);
+
+    char day_times_key[16];
+    uint32_t day_times[SCHEDULE_MAX_DAY_TIMES];
+
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        sprintf(day_times_key, STORAGE_TIME_BASE, day);
+
+        size_t day_times_size = 0;
+        get_err = storage_get_blob_size(day_times_key, &day_times_size);
+
+        if (get_err == ESP_OK && day_times_size <= sizeof(day_times)) {
+            get_err = storage_get_blob(day_times_key, day_times, &day_times_size);
+        }
+
+        if (get_err == ESP_OK) {
+            schedule_set_day_times(schedule, day, day_times, day_times_size / sizeof(uint32_t));
+        } else if (get_err != ESP_ERR_NVS_NOT_FOUND) {
+            return false;
+        }
+    }
+
+    size_t sig_rains_size = sizeof(schedule->sig_rains);
+    get_err = storage_get_blob(STORAGE_SIG_RAINS, schedule->sig_rains, &sig_rains_size);
+
+    if (get_err == ESP_ERR_NVS_NOT_FOUND) {
+        // Without sig_rains only the irrigation fetch is scheduled
+        memset(schedule->sig_rains, 1, sizeof(schedule->sig_rains));
+    } else if (get_err != ESP_OK) {
+        return false;
+    }
+
+    return true;
+}
+
+static void remove_legacy_keys() {
+    const char *keys[] = {
+        STORAGE_VERSION, STORAGE_USER_ID, STORAGE_ZONE_ID, STORAGE_TIME_ZONE, STORAGE_UTC_OFFSETS,
+        STORAGE_SIG_RAINS, STORAGE_SOLENOID_OPEN, STORAGE_MANUAL_ON
+    };
+
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        storage_remove(keys[i]);
+    }
+
+    char day_times_key[16];
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        sprintf(day_times_key, STORAGE_TIME_BASE, day);
+        storage_remove(day_times_key);
+    }
+}
+
+static esp_err_t migrate_legacy_keys(radgard_settings_t *settings) {
+    bool found = false;
+
+    if (storage_get_u8(STORAGE_VERSION, &settings->firmware_version) == ESP_OK) {
+        found = true;
+    }
+
+    size_t size = SETTINGS_ID_LENGTH;
+    if (storage_get_str(STORAGE_USER_ID, settings->user_id, &size) == ESP_OK) {
+        found = true;
+    }
+
+    size = SETTINGS_ID_LENGTH;
+    if (storage_get_str(STORAGE_ZONE_ID, settings->zone_id, &size) == ESP_OK) {
+        found = true;
+    }
+
+    if (storage_get_u8(STORAGE_MANUAL_ON, &settings->manual_on) == ESP_OK) {
+        found = true;
+    }
+
+    if (load_legacy_schedule(&settings->schedule)) {
+        settings->has_schedule = 1;
+        found = true;
+    }
+
+    if (!found) {
+        settings_init(settings);
+
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    ESP_LOGI(TAG, "Migrating legacy NVS keys to settings record");
+
+    esp_err_t save_err = settings_save(settings);
+    if (save_err == ESP_OK) {
+        remove_legacy_keys();
+    }
+
+    return save_err;
+}
+
+esp_err_t settings_load(radgard_settings_t *settings) {
+    settings_init(settings);
+
+    storage_txn_begin();
+
+    size_t size = sizeof(radgard_settings_t);
+    esp_err_t get_err = storage_get_blob(STORAGE_SETTINGS, settings, &size);
+
+    if (get_err == ESP_ERR_NVS_NOT_FOUND) {
+        get_err = migrate_legacy_keys(settings);
+    } else if (get_err == ESP_OK && !settings_valid(settings, size)) {
+        ESP_LOGE(TAG, "Settings record is corrupt or from a newer schema; ignoring it");
+
+        settings_init(settings);
+        get_err = ESP_ERR_INVALID_CRC;
+    } else if (get_err != ESP_OK) {
+        ESP_LOGE(TAG, "Error loading settings record: %s", esp_err_to_name(get_err));
+
+        settings_init(settings);
+    }
+
+    storage_txn_commit();
+
+    return get_err;
+}
+
+bool settings_can_save(esp_err_t load_err) {
+    return load_err == ESP_OK || load_err == ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t settings_save(radgard_settings_t *settings) {
+    settings->header.schema_version = SETTINGS_SCHEMA_VERSION;
+    settings->header.size = sizeof(radgard_settings_t);
+    settings->header.crc = settings_crc(settings, sizeof(radgard_settings_t));
+
+    esp_err_t set_err = storage_set_blob(STORAGE_SETTINGS, settings, sizeof(radgard_settings_t));
+    if (set_err != ESP_OK) {
+        ESP_LOGE(TAG, "Error saving settings record: %s", esp_err_to_name(set_err));
+    }
+
+    return set_err;
+}
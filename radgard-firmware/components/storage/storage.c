@@ -1,52 +1,150 @@
 #include <stdio.h>
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <esp_log.h>
-#include "esp_system.h"
 
-#include "nvs_flash.h"
-#include "nvs.h"
+#ifdef ESP_PLATFORM
+#include <esp_attr.h>
+#else
+// Host builds keep the "RTC" region in ordinary memory
+#define RTC_DATA_ATTR
+#endif
 
+#include "hal.h"
 #include "storage.h"
+#include "profile.h"
+#include "checksum.h"
+#include "schedule.h"
 
 static const char *TAG = "storage";
 
 static const char *HANDLE_NAME = "storage";
 
+const char *STORAGE_SETTINGS = "settings";
+
+const char *STORAGE_OTA_CERT = "ota_cert";
+
 const char *STORAGE_VERSION = "version";
 
 const char *STORAGE_USER_ID = "user_id";
 const char *STORAGE_ZONE_ID = "zone_id";
 
 const char *STORAGE_TIME_ZONE = "time_zone";
+const char *STORAGE_UTC_OFFSETS = "utc_offsets";
 const char *STORAGE_TIME_BASE = "time_%d";
 const char *STORAGE_SIG_RAINS = "sig_rains";
 
 const char *STORAGE_SOLENOID_OPEN = "solenoid_open";
 const char *STORAGE_MANUAL_ON = "manual_on";
 
+/* Content hashes of values known to be in NVS, so unchanged writes can be
+ * skipped without reading flash back. Kept in RTC memory across deep sleep. */
+#define DIGEST_TABLE_LENGTH 16
+
+typedef enum {
+    STORED_U8,
+    STORED_U32,
+    STORED_STR,
+    STORED_BLOB
+} stored_type_t;
+
+typedef struct {
+    uint32_t key_hash;
+    uint32_t value_hash;
+} storage_digest_t;
+
+typedef struct {
+    storage_digest_t digests[DIGEST_TABLE_LENGTH];
+    uint8_t next;
+    uint32_t writes_performed;
+    uint32_t writes_skipped;
+    uint32_t crc;
+} storage_digest_table_t;
+
+static RTC_DATA_ATTR storage_digest_table_t digest_table;
+
+/* Digests of the open transaction's writes. They only reach the table once
+ * it commits, since until then NVS may still end up with the old values. */
+typedef struct {
+    storage_digest_t digests[DIGEST_TABLE_LENGTH];
+    uint8_t length;
+} storage_txn_digests_t;
+
+static storage_txn_digests_t txn_digests;
+
+static bool nvs_initialized = false;
+
+#define RESET_HOOKS_MAX 4
+
+static storage_reset_hook_t reset_hooks[RESET_HOOKS_MAX];
+static size_t reset_hooks_length = 0;
+
+/* The background firmware download uses storage while the main task closes
+ * the valve, so every access holds hal_kv_lock; a transaction holds it from
+ * begin to commit, so txn_handle and the digest tables have one user at a time. */
+
 void storage_init_nvs() {
+    hal_kv_lock();
+
+    /* NVS is brought up lazily so wakes served from RTC memory never touch flash */
+    if (nvs_initialized) {
+        hal_kv_unlock();
+        return;
+    }
+
+    profile_phase_start(PROFILE_PHASE_NVS_INIT);
+
     /* Initialize NVS partition */
-    esp_err_t err = nvs_flash_init();
+    esp_err_t err = hal_kv_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES) {
         /* NVS partition was truncated
          * and needs to be erased */
-        ESP_ERROR_CHECK(nvs_flash_erase());
+        ESP_ERROR_CHECK(hal_kv_erase_all());
+        memset(&digest_table, 0, sizeof(storage_digest_table_t));
 
-        /* Retry nvs_flash_init */
-        ESP_ERROR_CHECK(nvs_flash_init());
+        /* Retry hal_kv_init */
+        ESP_ERROR_CHECK(hal_kv_init());
     }
+
+    nvs_initialized = true;
+
+    profile_phase_end(PROFILE_PHASE_NVS_INIT);
+
+    hal_kv_unlock();
 }
 
 void storage_deinit_nvs() {
-    ESP_ERROR_CHECK(nvs_flash_deinit());
+    // Waits out any write or transaction in progress on another task
+    hal_kv_lock();
+
+    if (nvs_initialized) {
+        ESP_ERROR_CHECK(hal_kv_deinit());
+        nvs_initialized = false;
+    }
+
+    hal_kv_unlock();
 }
 
-static nvs_handle get_write_handle() {
-    nvs_handle handle;
-    esp_err_t open_err = nvs_open(HANDLE_NAME, NVS_READWRITE, &handle);
+/* Open transaction: one handle shared by every call until commit */
+static hal_kv_handle_t txn_handle;
+static int txn_depth = 0;
+
+static void end_txn_digests(bool committed);
+
+// Every get_*_handle is paired with a release_*_handle, which holds the lock in between
+static hal_kv_handle_t get_write_handle() {
+    hal_kv_lock();
+
+    if (txn_depth > 0) {
+        return txn_handle;
+    }
+
+    storage_init_nvs();
+
+    hal_kv_handle_t handle;
+    esp_err_t open_err = hal_kv_open(HANDLE_NAME, true, &handle);
 
     if (open_err != ESP_OK) {
         ESP_LOGE(TAG, "Could not open NVS handle %s; Error: %s", HANDLE_NAME, esp_err_to_name(open_err));
@@ -57,9 +155,17 @@ static nvs_handle get_write_handle() {
     return handle;
 }
 
-static nvs_handle get_read_handle() {
-    nvs_handle handle;
-    esp_err_t open_err = nvs_open(HANDLE_NAME, NVS_READONLY, &handle);
+static hal_kv_handle_t get_read_handle() {
+    hal_kv_lock();
+
+    if (txn_depth > 0) {
+        return txn_handle;
+    }
+
+    storage_init_nvs();
+
+    hal_kv_handle_t handle;
+    esp_err_t open_err = hal_kv_open(HANDLE_NAME, false, &handle);
 
     if (open_err != ESP_OK) {
         ESP_LOGE(TAG, "Could not open NVS handle %s; Error: %s", HANDLE_NAME, esp_err_to_name(open_err));
@@ -70,12 +176,314 @@ static nvs_handle get_read_handle() {
     return handle;
 }
 
+static esp_err_t release_write_handle(hal_kv_handle_t handle) {
+    if (txn_depth > 0) {
+        hal_kv_unlock();
+
+        return ESP_OK;
+    }
+
+    esp_err_t commit_err = hal_kv_commit(handle);
+
+    hal_kv_close(handle);
+
+    hal_kv_unlock();
+
+    return commit_err;
+}
+
+static void release_read_handle(hal_kv_handle_t handle) {
+    if (txn_depth == 0) {
+        hal_kv_close(handle);
+    }
+
+    hal_kv_unlock();
+}
+
+esp_err_t storage_txn_begin() {
+    // Held until the matching commit
+    hal_kv_lock();
+
+    if (txn_depth > 0) {
+        txn_depth += 1;
+
+        return ESP_OK;
+    }
+
+    storage_init_nvs();
+
+    esp_err_t open_err = hal_kv_open(HANDLE_NAME, true, &txn_handle);
+
+    if (open_err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not open NVS handle %s; Error: %s", HANDLE_NAME, esp_err_to_name(open_err));
+        hal_kv_unlock();
+
+        return open_err;
+    }
+
+    txn_depth = 1;
+    txn_digests.length = 0;
+
+    return ESP_OK;
+}
+
+esp_err_t storage_txn_commit() {
+    if (txn_depth == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    txn_depth -= 1;
+    if (txn_depth > 0) {
+        hal_kv_unlock();
+
+        return ESP_OK;
+    }
+
+    esp_err_t commit_err = hal_kv_commit(txn_handle);
+
+    hal_kv_close(txn_handle);
+
+    end_txn_digests(commit_err == ESP_OK);
+
+    hal_kv_unlock();
+
+    if (commit_err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not commit NVS handle %s; Error: %s", HANDLE_NAME, esp_err_to_name(commit_err));
+    }
+
+    return commit_err;
+}
+
+static uint32_t key_digest(const char *key) {
+    return checksum_crc32(CHECKSUM_CRC32_INIT, key, strlen(key));
+}
+
+static uint32_t value_digest(stored_type_t type, const void *value, size_t size) {
+    uint32_t hash = checksum_crc32(CHECKSUM_CRC32_INIT, &type, sizeof(type));
+    hash = checksum_crc32(hash, &size, sizeof(size));
+
+    return checksum_crc32(hash, value, size);
+}
+
+static uint32_t digest_table_crc() {
+    return checksum_crc32(CHECKSUM_CRC32_INIT, &digest_table, offsetof(storage_digest_table_t, crc));
+}
+
+static void check_digest_table() {
+    if (digest_table.crc != digest_table_crc()) {
+        memset(&digest_table, 0, sizeof(storage_digest_table_t));
+        digest_table.crc = digest_table_crc();
+    }
+}
+
+static storage_digest_t *find_digest(uint32_t key_hash) {
+    check_digest_table();
+
+    for (int i = 0; i < DIGEST_TABLE_LENGTH; i++) {
+        if (digest_table.digests[i].key_hash == key_hash) {
+            return &digest_table.digests[i];
+        }
+    }
+
+    return NULL;
+}
+
+static storage_digest_t *find_txn_digest(uint32_t key_hash) {
+    for (int i = 0; i < txn_digests.length; i++) {
+        if (txn_digests.digests[i].key_hash == key_hash) {
+            return &txn_digests.digests[i];
+        }
+    }
+
+    return NULL;
+}
+
+// The value NVS holds for a key as far as this wake knows, uncommitted writes included
+static storage_digest_t *find_current_digest(uint32_t key_hash) {
+    storage_digest_t *digest = txn_depth > 0 ? find_txn_digest(key_hash) : NULL;
+
+    return digest != NULL ? digest : find_digest(key_hash);
+}
+
+static void store_digest(uint32_t key_hash, uint32_t value_hash) {
+    storage_digest_t *digest = find_digest(key_hash);
+
+    if (digest == NULL) {
+        digest = &digest_table.digests[digest_table.next];
+        digest_table.next = (digest_table.next + 1) % DIGEST_TABLE_LENGTH;
+    }
+
+    digest->key_hash = key_hash;
+    digest->value_hash = value_hash;
+    digest_table.crc = digest_table_crc();
+}
+
+static void drop_digest(uint32_t key_hash) {
+    storage_digest_t *digest = find_digest(key_hash);
+
+    if (digest != NULL) {
+        memset(digest, 0, sizeof(storage_digest_t));
+        digest_table.crc = digest_table_crc();
+    }
+}
+
+static void remember_digest(const char *key, uint32_t value_hash) {
+    uint32_t key_hash = key_digest(key);
+
+    if (txn_depth == 0) {
+        store_digest(key_hash, value_hash);
+        return;
+    }
+
+    storage_digest_t *digest = find_txn_digest(key_hash);
+    if (digest == NULL && txn_digests.length < DIGEST_TABLE_LENGTH) {
+        digest = &txn_digests.digests[txn_digests.length++];
+    }
+
+    if (digest != NULL) {
+        digest->key_hash = key_hash;
+        digest->value_hash = value_hash;
+    } else {
+        // No room to queue it, and the table's digest is about to go stale
+        drop_digest(key_hash);
+    }
+}
+
+static void forget_digest(const char *key) {
+    uint32_t key_hash = key_digest(key);
+
+    storage_digest_t *digest = txn_depth > 0 ? find_txn_digest(key_hash) : NULL;
+    if (digest != NULL) {
+        memset(digest, 0, sizeof(storage_digest_t));
+    }
+
+    drop_digest(key_hash);
+}
+
+static void end_txn_digests(bool committed) {
+    if (!committed) {
+        // Which of the transaction's writes reached flash is unknown
+        check_digest_table();
+        memset(digest_table.digests, 0, sizeof(digest_table.digests));
+        digest_table.crc = digest_table_crc();
+    } else {
+        for (int i = 0; i < txn_digests.length; i++) {
+            if (txn_digests.digests[i].key_hash != 0) {
+                store_digest(txn_digests.digests[i].key_hash, txn_digests.digests[i].value_hash);
+            }
+        }
+    }
+
+    txn_digests.length = 0;
+}
+
+static void count_write(bool performed) {
+    check_digest_table();
+
+    if (performed) {
+        digest_table.writes_performed += 1;
+    } else {
+        digest_table.writes_skipped += 1;
+    }
+
+    digest_table.crc = digest_table_crc();
+}
+
+static bool stored_value_matches(hal_kv_handle_t handle, const char *key, stored_type_t type, const void *value, size_t size) {
+    uint8_t stored_u8;
+    uint32_t stored_u32;
+    size_t stored_size = 0;
+
+    switch (type) {
+        case STORED_U8:
+            return hal_kv_get_u8(handle, key, &stored_u8) == ESP_OK && stored_u8 == *(const uint8_t *) value;
+        case STORED_U32:
+            return hal_kv_get_u32(handle, key, &stored_u32) == ESP_OK && stored_u32 == *(const uint32_t *) value;
+        case STORED_STR:
+            if (hal_kv_get_str(handle, key, NULL, &stored_size) != ESP_OK) {
+                return false;
+            }
+            break;
+        case STORED_BLOB:
+            if (hal_kv_get_blob(handle, key, NULL, &stored_size) != ESP_OK) {
+                return false;
+            }
+            break;
+    }
+
+    if (stored_size != size) {
+        return false;
+    }
+
+    void *stored = malloc(stored_size);
+    if (stored == NULL) {
+        return false;
+    }
+
+    esp_err_t get_err = (type == STORED_STR) ?
+        hal_kv_get_str(handle, key, stored, &stored_size) :
+        hal_kv_get_blob(handle, key, stored, &stored_size);
+
+    bool matches = get_err == ESP_OK && memcmp(stored, value, size) == 0;
+
+    free(stored);
+
+    return matches;
+}
+
+/* Checks the RTC digest first and only reads the stored value back on a miss */
+static bool value_unchanged(hal_kv_handle_t handle, const char *key, stored_type_t type, const void *value, size_t size) {
+    uint32_t value_hash = value_digest(type, value, size);
+    storage_digest_t *digest = find_current_digest(key_digest(key));
+
+    bool unchanged = (digest != NULL && digest->value_hash == value_hash) ||
+        stored_value_matches(handle, key, type, value, size);
+
+    if (unchanged) {
+        remember_digest(key, value_hash);
+        count_write(false);
+
+        ESP_LOGI(TAG, "Skipped writing unchanged value to key (%s)", key);
+    }
+
+    return unchanged;
+}
+
+static void written(const char *key, stored_type_t type, const void *value, size_t size, esp_err_t set_err) {
+    if (set_err == ESP_OK) {
+        remember_digest(key, value_digest(type, value, size));
+    } else {
+        forget_digest(key);
+    }
+
+    count_write(true);
+}
+
+void storage_get_write_counts(uint32_t *performed, uint32_t *skipped) {
+    hal_kv_lock();
+
+    check_digest_table();
+
+    *performed = digest_table.writes_performed;
+    *skipped = digest_table.writes_skipped;
+
+    hal_kv_unlock();
+}
+
 esp_err_t storage_set_str(const char *key, const char *value) {
-    nvs_handle handle = get_write_handle();
+    hal_kv_handle_t handle = get_write_handle();
 
-    esp_err_t set_err = nvs_set_str(handle, key, value);
+    if (value_unchanged(handle, key, STORED_STR, value, strlen(value) + 1)) {
+        return release_write_handle(handle);
+    }
 
-    nvs_close(handle);
+    esp_err_t set_err = hal_kv_set_str(handle, key, value);
+    written(key, STORED_STR, value, strlen(value) + 1, set_err);
+
+    esp_err_t commit_err = release_write_handle(handle);
+    if (set_err == ESP_OK) {
+        set_err = commit_err;
+    }
 
     ESP_LOGI(TAG, "Attempted to set value (%s) to key (%s)", value, key);
 
@@ -83,11 +491,19 @@ esp_err_t storage_set_str(const char *key, const char *value) {
 }
 
 esp_err_t storage_set_u8(const char *key, uint8_t value) {
-    nvs_handle handle = get_write_handle();
+    hal_kv_handle_t handle = get_write_handle();
 
-    esp_err_t set_err = nvs_set_u8(handle, key, value);
+    if (value_unchanged(handle, key, STORED_U8, &value, sizeof(value))) {
+        return release_write_handle(handle);
+    }
 
-    nvs_close(handle);
+    esp_err_t set_err = hal_kv_set_u8(handle, key, value);
+    written(key, STORED_U8, &value, sizeof(value), set_err);
+
+    esp_err_t commit_err = release_write_handle(handle);
+    if (set_err == ESP_OK) {
+        set_err = commit_err;
+    }
 
     ESP_LOGI(TAG, "Attempted to set value (%d) to key (%s)", value, key);
 
@@ -95,11 +511,19 @@ esp_err_t storage_set_u8(const char *key, uint8_t value) {
 }
 
 esp_err_t storage_set_u32(const char *key, uint32_t value) {
-    nvs_handle handle = get_write_handle();
+    hal_kv_handle_t handle = get_write_handle();
+
+    if (value_unchanged(handle, key, STORED_U32, &value, sizeof(value))) {
+        return release_write_handle(handle);
+    }
 
-    esp_err_t set_err = nvs_set_u32(handle, key, value);
+    esp_err_t set_err = hal_kv_set_u32(handle, key, value);
+    written(key, STORED_U32, &value, sizeof(value), set_err);
 
-    nvs_close(handle);
+    esp_err_t commit_err = release_write_handle(handle);
+    if (set_err == ESP_OK) {
+        set_err = commit_err;
+    }
 
     ESP_LOGI(TAG, "Attempted to set value (%d) to key (%s)", value, key);
 
@@ -107,11 +531,19 @@ esp_err_t storage_set_u32(const char *key, uint32_t value) {
 }
 
 esp_err_t storage_set_blob(const char *key, const void *value, size_t size) {
-    nvs_handle handle = get_write_handle();
+    hal_kv_handle_t handle = get_write_handle();
 
-    esp_err_t set_err = nvs_set_blob(handle, key, value, size);
+    if (value_unchanged(handle, key, STORED_BLOB, value, size)) {
+        return release_write_handle(handle);
+    }
 
-    nvs_close(handle);
+    esp_err_t set_err = hal_kv_set_blob(handle, key, value, size);
+    written(key, STORED_BLOB, value, size, set_err);
+
+    esp_err_t commit_err = release_write_handle(handle);
+    if (set_err == ESP_OK) {
+        set_err = commit_err;
+    }
 
     ESP_LOGI(TAG, "Attempted to set blob to key (%s)", key);
 
@@ -119,11 +551,11 @@ esp_err_t storage_set_blob(const char *key, const void *value, size_t size) {
 }
 
 esp_err_t storage_get_str(const char *key, char *value, size_t *size) {
-    nvs_handle handle = get_read_handle();
+    hal_kv_handle_t handle = get_read_handle();
 
-    esp_err_t get_err = nvs_get_str(handle, key, value, size);
+    esp_err_t get_err = hal_kv_get_str(handle, key, value, size);
 
-    nvs_close(handle);
+    release_read_handle(handle);
 
     if (value != NULL) {
         ESP_LOGI(TAG, "Attempted to get value (%s) from key (%s)", value, key);
@@ -133,11 +565,11 @@ esp_err_t storage_get_str(const char *key, char *value, size_t *size) {
 }
 
 esp_err_t storage_get_u8(const char *key, uint8_t *value) {
-    nvs_handle handle = get_read_handle();
+    hal_kv_handle_t handle = get_read_handle();
 
-    esp_err_t get_err = nvs_get_u8(handle, key, value);
+    esp_err_t get_err = hal_kv_get_u8(handle, key, value);
 
-    nvs_close(handle);
+    release_read_handle(handle);
 
     ESP_LOGI(TAG, "Attempted to get value (%d) from key (%s)", *value, key);
 
@@ -145,11 +577,11 @@ esp_err_t storage_get_u8(const char *key, uint8_t *value) {
 }
 
 esp_err_t storage_get_u32(const char *key, uint32_t *value) {
-    nvs_handle handle = get_read_handle();
+    hal_kv_handle_t handle = get_read_handle();
 
-    esp_err_t get_err = nvs_get_u32(handle, key, value);
+    esp_err_t get_err = hal_kv_get_u32(handle, key, value);
 
-    nvs_close(handle);
+    release_read_handle(handle);
 
     ESP_LOGI(TAG, "Attempted to get value (%d) from key (%s)", *value, key);
 
@@ -157,11 +589,11 @@ esp_err_t storage_get_u32(const char *key, uint32_t *value) {
 }
 
 esp_err_t storage_get_blob(const char *key, void *value, size_t *size) {
-    nvs_handle handle = get_read_handle();
+    hal_kv_handle_t handle = get_read_handle();
 
-    esp_err_t get_err = nvs_get_blob(handle, key, value, size);
+    esp_err_t get_err = hal_kv_get_blob(handle, key, value, size);
 
-    nvs_close(handle);
+    release_read_handle(handle);
 
     ESP_LOGI(TAG, "Attempted to get blob from key (%s)", key);
 
@@ -177,18 +609,52 @@ esp_err_t storage_get_blob_size(const char *key, size_t *size) {
 }
 
 esp_err_t storage_remove(const char *key) {
-    nvs_handle handle = get_write_handle();
+    hal_kv_handle_t handle = get_write_handle();
 
-    esp_err_t erase_err = nvs_erase_key(handle, key);
+    esp_err_t erase_err = hal_kv_erase_key(handle, key);
+    forget_digest(key);
 
-    nvs_close(handle);
+    esp_err_t commit_err = release_write_handle(handle);
+    if (erase_err == ESP_OK) {
+        erase_err = commit_err;
+    }
 
     ESP_LOGI(TAG, "Attempted to remove key (%s)", key);
 
     return erase_err;
 }
 
+void storage_add_reset_hook(storage_reset_hook_t hook) {
+    for (size_t i = 0; i < reset_hooks_length; i++) {
+        if (reset_hooks[i] == hook) {
+            return;
+        }
+    }
+
+    if (reset_hooks_length == RESET_HOOKS_MAX) {
+        ESP_LOGE(TAG, "No room for another reset hook");
+
+        return;
+    }
+
+    reset_hooks[reset_hooks_length++] = hook;
+}
+
 void storage_reset() {
-    nvs_flash_erase();
-    esp_restart();
+    hal_kv_lock();
+
+    memset(&digest_table, 0, sizeof(storage_digest_table_t));
+    hal_kv_erase_all();
+
+    hal_kv_unlock();
+
+    // Without this the wake stub and timer wakes would keep running the erased schedule
+    schedule_cache_invalidate();
+    hal_http_forget_sessions();
+
+    for (size_t i = 0; i < reset_hooks_length; i++) {
+        reset_hooks[i]();
+    }
+
+    hal_restart();
 }
\ No newline at end of file
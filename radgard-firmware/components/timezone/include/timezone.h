@@ -0,0 +1,37 @@
+#ifndef __TIMEZONE_H__
+#define __TIMEZONE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMEZONE_MAX_TRANSITIONS 8
+
+/*
+ * From `start` (UTC epoch seconds) onwards, local time is UTC + `offset`
+ * seconds. Covers negative, half-hour and DST offsets alike.
+ */
+typedef struct {
+    uint32_t start;
+    int32_t offset;
+} timezone_transition_t;
+
+/*
+ * Transitions sorted by start. The first entry also applies to any time
+ * before its start.
+ */
+typedef struct {
+    uint8_t length;
+    timezone_transition_t transitions[TIMEZONE_MAX_TRANSITIONS];
+} timezone_t;
+
+void timezone_init_fixed(timezone_t *timezone, int32_t offset);
+
+bool timezone_add_transition(timezone_t *timezone, uint32_t start, int32_t offset);
+
+int32_t timezone_get_offset(const timezone_t *timezone, uint32_t utc);
+
+uint32_t timezone_to_local(const timezone_t *timezone, uint32_t utc);
+
+uint32_t timezone_to_utc(const timezone_t *timezone, uint32_t local);
+
+#endif
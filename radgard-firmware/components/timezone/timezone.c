@@ -0,0 +1,69 @@
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define RTC_IRAM_ATTR
+#endif
+
+#include "timezone.h"
+
+// Lookups are reachable from the deep sleep wake stub and live in RTC fast memory
+
+void timezone_init_fixed(timezone_t *timezone, int32_t offset) {
+    timezone->length = 1;
+    timezone->transitions[0].start = 0;
+    timezone->transitions[0].offset = offset;
+}
+
+bool timezone_add_transition(timezone_t *timezone, uint32_t start, int32_t offset) {
+    if (timezone->length >= TIMEZONE_MAX_TRANSITIONS) {
+        return false;
+    }
+
+    if (timezone->length > 0 && timezone->transitions[timezone->length - 1].start >= start) {
+        return false;
+    }
+
+    timezone->transitions[timezone->length].start = start;
+    timezone->transitions[timezone->length].offset = offset;
+    timezone->length += 1;
+
+    return true;
+}
+
+int32_t RTC_IRAM_ATTR timezone_get_offset(const timezone_t *timezone, uint32_t utc) {
+    if (timezone->length == 0) {
+        return 0;
+    }
+
+    // Last transition starting at or before utc
+    uint8_t start = 1;
+    uint8_t end = timezone->length;
+    while (start < end) {
+        uint8_t middle = start + (end - start) / 2;
+
+        if (timezone->transitions[middle].start <= utc) {
+            start = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+
+    return timezone->transitions[start - 1].offset;
+}
+
+uint32_t RTC_IRAM_ATTR timezone_to_local(const timezone_t *timezone, uint32_t utc) {
+    return utc + timezone_get_offset(timezone, utc);
+}
+
+uint32_t RTC_IRAM_ATTR timezone_to_utc(const timezone_t *timezone, uint32_t local) {
+    uint32_t utc = local - timezone_get_offset(timezone, local);
+    int32_t offset = timezone_get_offset(timezone, utc);
+    uint32_t candidate = local - offset;
+
+    // Local times skipped by a forward transition keep the first guess, which lands just past it
+    if (timezone_get_offset(timezone, candidate) != offset) {
+        return utc;
+    }
+
+    return candidate;
+}
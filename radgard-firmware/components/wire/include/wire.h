@@ -0,0 +1,152 @@
+#ifndef __WIRE_H__
+#define __WIRE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <esp_err.h>
+
+#include "schedule.h"
+#include "timezone.h"
+
+/*
+ * Decoders for the settings in the syncDevice response. They are fed the body
+ * chunk by chunk as it arrives and compile it straight into a schedule_t,
+ * using only the decoder struct itself: no heap and no response buffer.
+ */
+
+#define WIRE_CONTENT_TYPE_JSON "application/json"
+#define WIRE_CONTENT_TYPE_BINARY "application/vnd.radgard.schedule"
+
+// Sent as Accept; servers that only speak JSON ignore it and answer as before
+#define WIRE_ACCEPT WIRE_CONTENT_TYPE_BINARY ", " WIRE_CONTENT_TYPE_JSON ";q=0.5"
+
+#define WIRE_JSON_MAX_DEPTH 8
+#define WIRE_JSON_TOKEN_LENGTH 24
+
+typedef struct {
+    schedule_t *schedule;
+
+    // Tokenizer
+    uint8_t state;
+    bool in_key;
+    uint8_t depth;
+    uint8_t frames[WIRE_JSON_MAX_DEPTH];
+    uint8_t keys[WIRE_JSON_MAX_DEPTH];
+    char token[WIRE_JSON_TOKEN_LENGTH];
+    uint8_t token_length;
+
+    // Fields being assembled
+    uint8_t day;
+    uint8_t day_times_length;
+    bool day_overflowed;
+    uint32_t day_times[SCHEDULE_MAX_DAY_TIMES];
+    uint8_t sig_rains_length;
+    bool has_time_zone;
+    int32_t time_zone;
+    bool utc_offsets_valid;
+    timezone_t utc_offsets;
+    uint8_t utc_offset_fields;
+    uint32_t utc_offset_start;
+    int32_t utc_offset;
+
+    // False when a day has more times than a schedule_t can hold
+    bool schedule_valid;
+    esp_err_t err;
+} wire_json_t;
+
+void wire_json_begin(wire_json_t *decoder, schedule_t *schedule);
+
+// Stops consuming input once an error is hit; the error is reported again by wire_json_end
+esp_err_t wire_json_feed(wire_json_t *decoder, const char *data, size_t length);
+
+/*
+ * Finishes the schedule. ESP_OK means a complete document with a time zone;
+ * `schedule_valid` then says whether every day fit.
+ */
+esp_err_t wire_json_end(wire_json_t *decoder);
+
+/*
+ * Binary encoding, WIRE_CONTENT_TYPE_BINARY. Numbers are LEB128 varints;
+ * signed ones are zigzag encoded first.
+ *
+ *   'R'                    magic
+ *   1                      version
+ *   zigzag time_zone       whole hours behind UTC
+ *   byte sig_rains         bit n set for day n
+ *   7 x day:
+ *     count
+ *     count x zigzag       time minus the day's previous time (the first minus 0)
+ *   count utc_offsets
+ *     count x { start      minus the previous start (the first minus 0)
+ *               zigzag offset }
+ */
+
+#define WIRE_BINARY_MAGIC 'R'
+#define WIRE_BINARY_VERSION 1
+
+typedef struct {
+    schedule_t *schedule;
+
+    uint8_t field;
+    uint32_t varint;
+    uint8_t varint_shift;
+    uint32_t remaining;
+    uint32_t previous;
+
+    uint8_t day;
+    uint8_t day_times_length;
+    bool day_overflowed;
+    uint32_t day_times[SCHEDULE_MAX_DAY_TIMES];
+    int32_t time_zone;
+    bool utc_offsets_valid;
+    timezone_t utc_offsets;
+
+    bool schedule_valid;
+    esp_err_t err;
+} wire_binary_t;
+
+void wire_binary_begin(wire_binary_t *decoder, schedule_t *schedule);
+
+esp_err_t wire_binary_feed(wire_binary_t *decoder, const char *data, size_t length);
+
+esp_err_t wire_binary_end(wire_binary_t *decoder);
+
+/*
+ * Either decoder, picked by the response's Content-Type. It starts out as
+ * JSON, which is also what any unrecognised type is decoded as.
+ */
+
+typedef enum {
+    WIRE_FORMAT_JSON,
+    WIRE_FORMAT_BINARY
+} wire_format_t;
+
+typedef struct {
+    wire_format_t format;
+    schedule_t *schedule;
+    union {
+        wire_json_t json;
+        wire_binary_t binary;
+    } decoder;
+} wire_decoder_t;
+
+void wire_decoder_begin(wire_decoder_t *decoder, schedule_t *schedule);
+
+// Must be called before the first wire_decoder_feed
+void wire_decoder_set_content_type(wire_decoder_t *decoder, const char *content_type);
+
+esp_err_t wire_decoder_feed(wire_decoder_t *decoder, const char *data, size_t length);
+
+esp_err_t wire_decoder_end(wire_decoder_t *decoder);
+
+// After a successful wire_decoder_end, whether every day fit in the schedule
+bool wire_decoder_schedule_valid(const wire_decoder_t *decoder);
+
+/* The response's Date header, in the IMF-fixdate form every HTTP/1.1 server
+ * sends: "Sun, 06 Nov 1994 08:49:37 GMT". */
+esp_err_t wire_parse_http_date(const char *value, time_t *utc);
+
+#endif
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "wire.h"
+
+// Matches `content_type` up to any parameters, e.g. "; charset=utf-8"
+static bool is_content_type(const char *content_type, const char *expected) {
+    size_t length = strlen(expected);
+    if (strncasecmp(content_type, expected, length) != 0) {
+        return false;
+    }
+
+    char next = content_type[length];
+
+    return next == '\0' || next == ';' || next == ' ';
+}
+
+void wire_decoder_begin(wire_decoder_t *decoder, schedule_t *schedule) {
+    decoder->format = WIRE_FORMAT_JSON;
+    decoder->schedule = schedule;
+    wire_json_begin(&decoder->decoder.json, schedule);
+}
+
+void wire_decoder_set_content_type(wire_decoder_t *decoder, const char *content_type) {
+    if (is_content_type(content_type, WIRE_CONTENT_TYPE_BINARY)) {
+        decoder->format = WIRE_FORMAT_BINARY;
+        wire_binary_begin(&decoder->decoder.binary, decoder->schedule);
+    } else {
+        decoder->format = WIRE_FORMAT_JSON;
+        wire_json_begin(&decoder->decoder.json, decoder->schedule);
+    }
+}
+
+esp_err_t wire_decoder_feed(wire_decoder_t *decoder, const char *data, size_t length) {
+    if (decoder->format == WIRE_FORMAT_BINARY) {
+        return wire_binary_feed(&decoder->decoder.binary, data, length);
+    }
+
+    return wire_json_feed(&decoder->decoder.json, data, length);
+}
+
+esp_err_t wire_decoder_end(wire_decoder_t *decoder) {
+    if (decoder->format == WIRE_FORMAT_BINARY) {
+        return wire_binary_end(&decoder->decoder.binary);
+    }
+
+    return wire_json_end(&decoder->decoder.json);
+}
+
+bool wire_decoder_schedule_valid(const wire_decoder_t *decoder) {
+    if (decoder->format == WIRE_FORMAT_BINARY) {
+        return decoder->decoder.binary.schedule_valid;
+    }
+
+    return decoder->decoder.json.schedule_valid;
+}
+
+// Days from 1970-01-01 to a Gregorian calendar date
+static int64_t days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+    return (int64_t) era * 146097 + day_of_era - 719468;
+}
+
+esp_err_t wire_parse_http_date(const char *value, time_t *utc) {
+    static const char *MONTHS = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    char weekday[4], month_name[4], zone[4];
+    int day, year, hour, minute, second;
+    if (sscanf(value, "%3s, %d %3s %d %d:%d:%d %3s", weekday, &day, month_name, &year, &hour, &minute, &second,
+               zone) != 8) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const char *month = strstr(MONTHS, month_name);
+    if (strlen(month_name) != 3 || month == NULL || (month - MONTHS) % 3 != 0 || strcmp(zone, "GMT") != 0 ||
+        day < 1 || day > 31 || year < 1970 || hour > 23 || minute > 59 || second > 60 ||
+        hour < 0 || minute < 0 || second < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // The day must exist in its month: no 31 Apr and only leap years have 29 Feb
+    static const uint8_t MONTH_DAYS[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    int month_number = (month - MONTHS) / 3 + 1;
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (day > MONTH_DAYS[month_number - 1] || (month_number == 2 && day == 29 && !leap)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t days = days_from_civil(year, month_number, day);
+    *utc = (time_t) (days * 86400 + hour * 3600 + minute * 60 + second);
+
+    return ESP_OK;
+}
@@ -0,0 +1,184 @@
+#include <string.h>
+
+#include "wire.h"
+
+/*
+ * The binary encoding is a fixed sequence of fields, so decoding is a walk
+ * along it: one byte or one varint per field, carried over between chunks
+ * in `varint`/`varint_shift`.
+ */
+
+typedef enum {
+    FIELD_MAGIC,
+    FIELD_VERSION,
+    FIELD_TIME_ZONE,
+    FIELD_SIG_RAINS,
+    FIELD_DAY_LENGTH,
+    FIELD_DAY_TIME,
+    FIELD_UTC_OFFSETS_LENGTH,
+    FIELD_UTC_OFFSET_START,
+    FIELD_UTC_OFFSET,
+    FIELD_DONE
+} field_t;
+
+static int32_t unzigzag(uint32_t value) {
+    return (int32_t) ((value >> 1) ^ -(value & 1));
+}
+
+static void fail(wire_binary_t *decoder, esp_err_t err) {
+    if (decoder->err == ESP_OK) {
+        decoder->err = err;
+    }
+}
+
+static void day_start(wire_binary_t *decoder, uint32_t length) {
+    decoder->remaining = length;
+    decoder->previous = 0;
+    decoder->day_times_length = 0;
+    decoder->day_overflowed = length > SCHEDULE_MAX_DAY_TIMES;
+}
+
+static void day_done(wire_binary_t *decoder) {
+    if (decoder->day_overflowed ||
+        !schedule_set_day_times(decoder->schedule, decoder->day, decoder->day_times, decoder->day_times_length)) {
+        decoder->schedule_valid = false;
+    }
+
+    decoder->day += 1;
+    decoder->field = decoder->day == SCHEDULE_DAYS ? FIELD_UTC_OFFSETS_LENGTH : FIELD_DAY_LENGTH;
+}
+
+static void varint_done(wire_binary_t *decoder, uint32_t value) {
+    switch (decoder->field) {
+        case FIELD_TIME_ZONE:
+            decoder->time_zone = unzigzag(value);
+            decoder->field = FIELD_SIG_RAINS;
+            break;
+        case FIELD_DAY_LENGTH:
+            day_start(decoder, value);
+            if (value == 0) {
+                day_done(decoder);
+            } else {
+                decoder->field = FIELD_DAY_TIME;
+            }
+
+            break;
+        case FIELD_DAY_TIME:
+            decoder->previous += unzigzag(value);
+            if (decoder->day_times_length < SCHEDULE_MAX_DAY_TIMES) {
+                decoder->day_times[decoder->day_times_length++] = decoder->previous;
+            }
+
+            if (--decoder->remaining == 0) {
+                day_done(decoder);
+            }
+
+            break;
+        case FIELD_UTC_OFFSETS_LENGTH:
+            decoder->remaining = value;
+            decoder->previous = 0;
+            decoder->utc_offsets.length = 0;
+            decoder->utc_offsets_valid = true;
+            decoder->field = value == 0 ? FIELD_DONE : FIELD_UTC_OFFSET_START;
+            break;
+        case FIELD_UTC_OFFSET_START:
+            decoder->previous += value;
+            decoder->field = FIELD_UTC_OFFSET;
+            break;
+        case FIELD_UTC_OFFSET:
+            if (!timezone_add_transition(&decoder->utc_offsets, decoder->previous, unzigzag(value))) {
+                decoder->utc_offsets_valid = false;
+            }
+
+            decoder->field = --decoder->remaining == 0 ? FIELD_DONE : FIELD_UTC_OFFSET_START;
+            break;
+        default:
+            break;
+    }
+}
+
+void wire_binary_begin(wire_binary_t *decoder, schedule_t *schedule) {
+    memset(decoder, 0, sizeof(wire_binary_t));
+
+    timezone_t timezone;
+    timezone_init_fixed(&timezone, 0);
+    schedule_init(schedule, &timezone);
+
+    decoder->schedule = schedule;
+    decoder->field = FIELD_MAGIC;
+    decoder->schedule_valid = true;
+    decoder->err = ESP_OK;
+}
+
+esp_err_t wire_binary_feed(wire_binary_t *decoder, const char *data, size_t length) {
+    for (size_t i = 0; i < length && decoder->err == ESP_OK; i++) {
+        uint8_t byte = (uint8_t) data[i];
+
+        switch (decoder->field) {
+            case FIELD_MAGIC:
+                if (byte != WIRE_BINARY_MAGIC) {
+                    fail(decoder, ESP_ERR_INVALID_RESPONSE);
+                }
+
+                decoder->field = FIELD_VERSION;
+                continue;
+            case FIELD_VERSION:
+                if (byte != WIRE_BINARY_VERSION) {
+                    fail(decoder, ESP_ERR_INVALID_VERSION);
+                }
+
+                decoder->field = FIELD_TIME_ZONE;
+                continue;
+            case FIELD_SIG_RAINS:
+                for (int day = 0; day < SCHEDULE_DAYS; day++) {
+                    decoder->schedule->sig_rains[day] = (byte >> day) & 1;
+                }
+
+                decoder->field = FIELD_DAY_LENGTH;
+                continue;
+            case FIELD_DONE:
+                fail(decoder, ESP_ERR_INVALID_RESPONSE);
+                continue;
+            default:
+                break;
+        }
+
+        // At most 5 bytes, the last carrying the top 4 bits
+        if (decoder->varint_shift == 28 && (byte & 0xf0) != 0) {
+            fail(decoder, ESP_ERR_INVALID_SIZE);
+            continue;
+        }
+
+        decoder->varint |= (uint32_t) (byte & 0x7f) << decoder->varint_shift;
+        if (byte & 0x80) {
+            decoder->varint_shift += 7;
+            continue;
+        }
+
+        uint32_t value = decoder->varint;
+        decoder->varint = 0;
+        decoder->varint_shift = 0;
+        varint_done(decoder, value);
+    }
+
+    return decoder->err;
+}
+
+esp_err_t wire_binary_end(wire_binary_t *decoder) {
+    if (decoder->err != ESP_OK) {
+        return decoder->err;
+    }
+
+    if (decoder->field != FIELD_DONE) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    // Same precedence as the JSON decoder
+    if (decoder->utc_offsets_valid && decoder->utc_offsets.length > 0) {
+        decoder->schedule->timezone = decoder->utc_offsets;
+    } else {
+        timezone_init_fixed(&decoder->schedule->timezone, -decoder->time_zone * 3600);
+    }
+
+    return ESP_OK;
+}
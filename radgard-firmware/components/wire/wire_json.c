@@ -0,0 +1,488 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wire.h"
+
+/*
+ * A single-pass JSON tokenizer that only keeps what it needs: a stack of
+ * container kinds, the key last seen at each level and one short token. The
+ * value being parsed is routed by (container, key) to the schedule field it
+ * fills; everything else is skipped.
+ */
+
+typedef enum {
+    STATE_VALUE,
+    STATE_ARRAY_START,
+    STATE_OBJECT_START,
+    STATE_KEY,
+    STATE_COLON,
+    STATE_AFTER_VALUE,
+    STATE_STRING,
+    STATE_STRING_ESCAPE,
+    STATE_NUMBER,
+    STATE_LITERAL,
+    STATE_DONE
+} state_t;
+
+// Containers; FRAME_OBJECT is or'ed in for objects so brackets can be matched
+typedef enum {
+    FRAME_SKIP,
+    FRAME_ROOT,
+    FRAME_TIMES,
+    FRAME_DAY,
+    FRAME_SIG_RAINS,
+    FRAME_UTC_OFFSETS,
+    FRAME_UTC_OFFSET
+} frame_t;
+
+#define FRAME_OBJECT 0x80
+
+typedef enum {
+    KEY_UNKNOWN,
+    KEY_TIME_ZONE,
+    KEY_TIMES,
+    KEY_SIG_RAINS,
+    KEY_UTC_OFFSETS,
+    KEY_START,
+    KEY_OFFSET
+} field_key_t;
+
+typedef enum {
+    TARGET_IGNORE,
+    TARGET_ROOT,
+    TARGET_TIME_ZONE,
+    TARGET_TIMES,
+    TARGET_DAY,
+    TARGET_DAY_TIME,
+    TARGET_SIG_RAINS,
+    TARGET_SIG_RAIN,
+    TARGET_UTC_OFFSETS,
+    TARGET_UTC_OFFSET,
+    TARGET_START,
+    TARGET_OFFSET
+} target_t;
+
+#define UTC_OFFSET_HAS_START 0x01
+#define UTC_OFFSET_HAS_OFFSET 0x02
+
+static const struct {
+    const char *name;
+    field_key_t key;
+} KEYS[] = {
+    { "time_zone", KEY_TIME_ZONE },
+    { "times", KEY_TIMES },
+    { "sig_rains", KEY_SIG_RAINS },
+    { "utc_offsets", KEY_UTC_OFFSETS },
+    { "start", KEY_START },
+    { "offset", KEY_OFFSET }
+};
+
+static field_key_t lookup_key(const char *name) {
+    for (size_t i = 0; i < sizeof(KEYS) / sizeof(KEYS[0]); i++) {
+        if (strcmp(KEYS[i].name, name) == 0) {
+            return KEYS[i].key;
+        }
+    }
+
+    return KEY_UNKNOWN;
+}
+
+static target_t value_target(const wire_json_t *decoder) {
+    if (decoder->depth == 0) {
+        return TARGET_ROOT;
+    }
+
+    uint8_t top = decoder->depth - 1;
+    field_key_t key = decoder->keys[top];
+
+    switch (decoder->frames[top] & ~FRAME_OBJECT) {
+        case FRAME_ROOT:
+            switch (key) {
+                case KEY_TIME_ZONE:
+                    return TARGET_TIME_ZONE;
+                case KEY_TIMES:
+                    return TARGET_TIMES;
+                case KEY_SIG_RAINS:
+                    return TARGET_SIG_RAINS;
+                case KEY_UTC_OFFSETS:
+                    return TARGET_UTC_OFFSETS;
+                default:
+                    return TARGET_IGNORE;
+            }
+        case FRAME_TIMES:
+            return TARGET_DAY;
+        case FRAME_DAY:
+            return TARGET_DAY_TIME;
+        case FRAME_SIG_RAINS:
+            return TARGET_SIG_RAIN;
+        case FRAME_UTC_OFFSETS:
+            return TARGET_UTC_OFFSET;
+        case FRAME_UTC_OFFSET:
+            if (key == KEY_START) {
+                return TARGET_START;
+            } else if (key == KEY_OFFSET) {
+                return TARGET_OFFSET;
+            }
+
+            return TARGET_IGNORE;
+        default:
+            return TARGET_IGNORE;
+    }
+}
+
+static void fail(wire_json_t *decoder, esp_err_t err) {
+    if (decoder->err == ESP_OK) {
+        decoder->err = err;
+    }
+}
+
+static void value_done(wire_json_t *decoder) {
+    decoder->state = decoder->depth == 0 ? STATE_DONE : STATE_AFTER_VALUE;
+}
+
+static void push(wire_json_t *decoder, bool object) {
+    if (decoder->depth == WIRE_JSON_MAX_DEPTH) {
+        fail(decoder, ESP_ERR_INVALID_SIZE);
+        return;
+    }
+
+    target_t target = value_target(decoder);
+    uint8_t frame = FRAME_SKIP;
+
+    if (object) {
+        if (target == TARGET_ROOT) {
+            frame = FRAME_ROOT;
+        } else if (target == TARGET_UTC_OFFSET) {
+            frame = FRAME_UTC_OFFSET;
+            decoder->utc_offset_fields = 0;
+        }
+    } else {
+        if (target == TARGET_TIMES) {
+            frame = FRAME_TIMES;
+        } else if (target == TARGET_DAY) {
+            frame = FRAME_DAY;
+            decoder->day_times_length = 0;
+            decoder->day_overflowed = false;
+        } else if (target == TARGET_SIG_RAINS) {
+            frame = FRAME_SIG_RAINS;
+        } else if (target == TARGET_UTC_OFFSETS) {
+            frame = FRAME_UTC_OFFSETS;
+            decoder->utc_offsets.length = 0;
+            decoder->utc_offsets_valid = true;
+        }
+    }
+
+    decoder->frames[decoder->depth] = frame | (object ? FRAME_OBJECT : 0);
+    decoder->keys[decoder->depth] = KEY_UNKNOWN;
+    decoder->depth += 1;
+    decoder->state = object ? STATE_OBJECT_START : STATE_ARRAY_START;
+}
+
+static void pop(wire_json_t *decoder, bool object) {
+    if (decoder->depth == 0 || ((decoder->frames[decoder->depth - 1] & FRAME_OBJECT) != 0) != object) {
+        fail(decoder, ESP_ERR_INVALID_RESPONSE);
+        return;
+    }
+
+    decoder->depth -= 1;
+
+    switch (decoder->frames[decoder->depth] & ~FRAME_OBJECT) {
+        case FRAME_DAY:
+            if (decoder->day_overflowed ||
+                !schedule_set_day_times(decoder->schedule, decoder->day, decoder->day_times, decoder->day_times_length)) {
+                decoder->schedule_valid = false;
+            }
+
+            decoder->day += 1;
+            break;
+        case FRAME_UTC_OFFSET:
+            if (decoder->utc_offset_fields != (UTC_OFFSET_HAS_START | UTC_OFFSET_HAS_OFFSET) ||
+                !timezone_add_transition(&decoder->utc_offsets, decoder->utc_offset_start, decoder->utc_offset)) {
+                decoder->utc_offsets_valid = false;
+            }
+
+            break;
+        default:
+            break;
+    }
+
+    value_done(decoder);
+}
+
+static void sig_rain(wire_json_t *decoder, bool value) {
+    if (decoder->sig_rains_length < SCHEDULE_DAYS) {
+        decoder->schedule->sig_rains[decoder->sig_rains_length] = value;
+    }
+
+    decoder->sig_rains_length += 1;
+}
+
+static void number_done(wire_json_t *decoder) {
+    decoder->token[decoder->token_length] = '\0';
+
+    char *end;
+    // Times arrive as JSON numbers and are truncated like the old (uint32_t) valuedouble casts
+    double value = strtod(decoder->token, &end);
+    if (end != decoder->token + decoder->token_length) {
+        fail(decoder, ESP_ERR_INVALID_RESPONSE);
+        return;
+    }
+
+    switch (value_target(decoder)) {
+        case TARGET_TIME_ZONE:
+            decoder->time_zone = (int32_t) value;
+            decoder->has_time_zone = true;
+            break;
+        case TARGET_DAY_TIME:
+            if (decoder->day_times_length < SCHEDULE_MAX_DAY_TIMES) {
+                decoder->day_times[decoder->day_times_length++] = (uint32_t) value;
+            } else {
+                decoder->day_overflowed = true;
+            }
+
+            break;
+        case TARGET_SIG_RAIN:
+            sig_rain(decoder, false);
+            break;
+        case TARGET_START:
+            decoder->utc_offset_start = (uint32_t) value;
+            decoder->utc_offset_fields |= UTC_OFFSET_HAS_START;
+            break;
+        case TARGET_OFFSET:
+            decoder->utc_offset = (int32_t) value;
+            decoder->utc_offset_fields |= UTC_OFFSET_HAS_OFFSET;
+            break;
+        default:
+            break;
+    }
+
+    value_done(decoder);
+}
+
+static void literal_done(wire_json_t *decoder) {
+    decoder->token[decoder->token_length] = '\0';
+
+    bool is_true = strcmp(decoder->token, "true") == 0;
+    if (!is_true && strcmp(decoder->token, "false") != 0 && strcmp(decoder->token, "null") != 0) {
+        fail(decoder, ESP_ERR_INVALID_RESPONSE);
+        return;
+    }
+
+    if (value_target(decoder) == TARGET_SIG_RAIN) {
+        sig_rain(decoder, is_true);
+    }
+
+    value_done(decoder);
+}
+
+static void string_done(wire_json_t *decoder) {
+    if (decoder->in_key) {
+        decoder->token[decoder->token_length] = '\0';
+
+        // Keys longer than the token buffer are none of ours
+        bool truncated = decoder->token_length == WIRE_JSON_TOKEN_LENGTH - 1;
+        decoder->keys[decoder->depth - 1] = truncated ? KEY_UNKNOWN : lookup_key(decoder->token);
+        decoder->state = STATE_COLON;
+
+        return;
+    }
+
+    if (value_target(decoder) == TARGET_SIG_RAIN) {
+        sig_rain(decoder, false);
+    }
+
+    value_done(decoder);
+}
+
+static void token_start(wire_json_t *decoder, state_t state, char c) {
+    decoder->token[0] = c;
+    decoder->token_length = 1;
+    decoder->state = state;
+}
+
+static bool token_append(wire_json_t *decoder, char c) {
+    if (decoder->token_length == WIRE_JSON_TOKEN_LENGTH - 1) {
+        return false;
+    }
+
+    decoder->token[decoder->token_length++] = c;
+
+    return true;
+}
+
+static void string_start(wire_json_t *decoder, bool key) {
+    decoder->in_key = key;
+    decoder->token_length = 0;
+    decoder->state = STATE_STRING;
+}
+
+static void value_start(wire_json_t *decoder, char c) {
+    if (c == '{') {
+        push(decoder, true);
+    } else if (c == '[') {
+        push(decoder, false);
+    } else if (c == '"') {
+        string_start(decoder, false);
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        token_start(decoder, STATE_NUMBER, c);
+    } else if (c >= 'a' && c <= 'z') {
+        token_start(decoder, STATE_LITERAL, c);
+    } else {
+        fail(decoder, ESP_ERR_INVALID_RESPONSE);
+    }
+}
+
+static void structural(wire_json_t *decoder, char c) {
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        return;
+    }
+
+    switch (decoder->state) {
+        case STATE_ARRAY_START:
+            if (c == ']') {
+                pop(decoder, false);
+            } else {
+                value_start(decoder, c);
+            }
+
+            break;
+        case STATE_VALUE:
+            value_start(decoder, c);
+            break;
+        case STATE_OBJECT_START:
+            if (c == '}') {
+                pop(decoder, true);
+            } else if (c == '"') {
+                string_start(decoder, true);
+            } else {
+                fail(decoder, ESP_ERR_INVALID_RESPONSE);
+            }
+
+            break;
+        case STATE_KEY:
+            if (c == '"') {
+                string_start(decoder, true);
+            } else {
+                fail(decoder, ESP_ERR_INVALID_RESPONSE);
+            }
+
+            break;
+        case STATE_COLON:
+            if (c == ':') {
+                decoder->state = STATE_VALUE;
+            } else {
+                fail(decoder, ESP_ERR_INVALID_RESPONSE);
+            }
+
+            break;
+        case STATE_AFTER_VALUE:
+            if (c == ',') {
+                bool object = decoder->frames[decoder->depth - 1] & FRAME_OBJECT;
+                decoder->state = object ? STATE_KEY : STATE_VALUE;
+            } else if (c == '}') {
+                pop(decoder, true);
+            } else if (c == ']') {
+                pop(decoder, false);
+            } else {
+                fail(decoder, ESP_ERR_INVALID_RESPONSE);
+            }
+
+            break;
+        default:
+            // Anything after the closing brace
+            fail(decoder, ESP_ERR_INVALID_RESPONSE);
+            break;
+    }
+}
+
+void wire_json_begin(wire_json_t *decoder, schedule_t *schedule) {
+    memset(decoder, 0, sizeof(wire_json_t));
+
+    // The time zone is only known once the whole document has been seen
+    timezone_t timezone;
+    timezone_init_fixed(&timezone, 0);
+    schedule_init(schedule, &timezone);
+
+    decoder->schedule = schedule;
+    decoder->state = STATE_VALUE;
+    decoder->schedule_valid = true;
+    decoder->err = ESP_OK;
+}
+
+esp_err_t wire_json_feed(wire_json_t *decoder, const char *data, size_t length) {
+    for (size_t i = 0; i < length && decoder->err == ESP_OK; i++) {
+        char c = data[i];
+
+        switch (decoder->state) {
+            case STATE_STRING:
+                if (c == '\\') {
+                    decoder->state = STATE_STRING_ESCAPE;
+                } else if (c == '"') {
+                    string_done(decoder);
+                } else if (decoder->in_key) {
+                    token_append(decoder, c);
+                }
+
+                continue;
+            case STATE_STRING_ESCAPE:
+                if (decoder->in_key) {
+                    token_append(decoder, c);
+                }
+
+                decoder->state = STATE_STRING;
+                continue;
+            case STATE_NUMBER:
+                if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+                    if (!token_append(decoder, c)) {
+                        fail(decoder, ESP_ERR_INVALID_SIZE);
+                    }
+
+                    continue;
+                }
+
+                number_done(decoder);
+                break;
+            case STATE_LITERAL:
+                if (c >= 'a' && c <= 'z') {
+                    if (!token_append(decoder, c)) {
+                        fail(decoder, ESP_ERR_INVALID_RESPONSE);
+                    }
+
+                    continue;
+                }
+
+                literal_done(decoder);
+                break;
+            default:
+                break;
+        }
+
+        if (decoder->err == ESP_OK) {
+            structural(decoder, c);
+        }
+    }
+
+    return decoder->err;
+}
+
+esp_err_t wire_json_end(wire_json_t *decoder) {
+    if (decoder->err != ESP_OK) {
+        return decoder->err;
+    }
+
+    if (decoder->state != STATE_DONE) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    // Upcoming UTC offset transitions (DST, half-hour zones) take precedence over time_zone
+    if (decoder->utc_offsets_valid && decoder->utc_offsets.length > 0) {
+        decoder->schedule->timezone = decoder->utc_offsets;
+    } else if (decoder->has_time_zone) {
+        // time_zone is whole hours behind UTC
+        timezone_init_fixed(&decoder->schedule->timezone, -decoder->time_zone * 3600);
+    } else {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    return ESP_OK;
+}
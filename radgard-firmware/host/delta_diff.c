@@ -0,0 +1,206 @@
+/*
+    Patch generator for the format of components/delta, standing in for the
+    server's: a greedy bsdiff-style matcher that follows the old image's
+    alignment across small changes and re-aligns on an 8 byte hash match
+    when code moves. Shared by delta_tool and the host tests.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "delta.h"
+#include "delta_diff.h"
+
+#define MATCH_LENGTH 8
+// A same run shorter than this costs more as its own run than inside the changed bytes around it
+#define MIN_SAME_RUN 3
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+} patch_t;
+
+static void put_byte(patch_t *patch, uint8_t byte) {
+    patch->data[patch->length++] = byte;
+}
+
+static void put_u32(patch_t *patch, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        put_byte(patch, (uint8_t) (value >> (8 * i)));
+    }
+}
+
+static void put_varint(patch_t *patch, uint32_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        put_byte(patch, value != 0 ? byte | 0x80 : byte);
+    } while (value != 0);
+}
+
+static void put_zigzag(patch_t *patch, int32_t value) {
+    put_varint(patch, ((uint32_t) value << 1) ^ (uint32_t) (value >> 31));
+}
+
+static void put_sha256(patch_t *patch, const uint8_t *data, size_t length) {
+    checksum_sha256_t sha;
+    checksum_sha256_begin(&sha);
+    checksum_sha256_update(&sha, data, length);
+    checksum_sha256_end(&sha, patch->data + patch->length);
+    patch->length += CHECKSUM_SHA256_LENGTH;
+}
+
+static uint32_t hash_at(const uint8_t *data, uint32_t bits) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+
+    return (uint32_t) ((value * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+}
+
+// How far the alignment holds: the length where twice the matching bytes most exceeds the length
+static size_t extend(const uint8_t *source, size_t source_length, const uint8_t *target, size_t target_length) {
+    size_t limit = source_length < target_length ? source_length : target_length;
+    long score = 0, best_score = 0;
+    size_t best = 0;
+
+    for (size_t i = 0; i < limit && score > best_score - 64; i++) {
+        score += source[i] == target[i] ? 1 : -1;
+        if (score > best_score) {
+            best_score = score;
+            best = i + 1;
+        }
+    }
+
+    return best;
+}
+
+static void put_copy(patch_t *patch, const uint8_t *source, const uint8_t *target, size_t length) {
+    size_t i = 0;
+
+    while (i < length) {
+        size_t same = 0;
+        while (i + same < length && source[i + same] == target[i + same]) {
+            same++;
+        }
+
+        size_t changed = 0;
+        for (size_t j = i + same; j < length;) {
+            size_t zeros = 0;
+            while (j + zeros < length && source[j + zeros] == target[j + zeros]) {
+                zeros++;
+            }
+
+            if (zeros >= MIN_SAME_RUN || j + zeros == length) {
+                break;
+            }
+
+            j += zeros + 1;
+            changed = j - i - same;
+        }
+
+        put_varint(patch, same);
+        put_varint(patch, changed);
+        for (size_t j = i + same; j < i + same + changed; j++) {
+            put_byte(patch, (uint8_t) (target[j] - source[j]));
+        }
+
+        i += same + changed;
+    }
+}
+
+static void put_record(patch_t *patch, const uint8_t *source, const uint8_t *target, size_t copy_length,
+                       const uint8_t *extra, size_t extra_length, int32_t seek) {
+    put_varint(patch, copy_length);
+    put_varint(patch, extra_length);
+    put_zigzag(patch, seek);
+    put_copy(patch, source, target, copy_length);
+    memcpy(patch->data + patch->length, extra, extra_length);
+    patch->length += extra_length;
+}
+
+static void diff(const uint8_t *source, size_t source_length, const uint8_t *target, size_t target_length,
+                 patch_t *patch) {
+    uint32_t bits = 16;
+    while ((1u << bits) < 2 * source_length && bits < 26) {
+        bits++;
+    }
+
+    int32_t *index = malloc(sizeof(int32_t) << bits);
+    memset(index, 0xff, sizeof(int32_t) << bits);
+    for (size_t s = 0; s + MATCH_LENGTH <= source_length; s++) {
+        index[hash_at(source + s, bits)] = (int32_t) s;
+    }
+
+    memcpy(patch->data, DELTA_MAGIC, 4);
+    patch->length = 4;
+    put_byte(patch, DELTA_VERSION);
+    put_byte(patch, 0);
+    put_byte(patch, 0);
+    put_byte(patch, 0);
+    put_u32(patch, source_length);
+    put_u32(patch, target_length);
+    put_sha256(patch, source, source_length);
+    put_sha256(patch, target, target_length);
+
+    // The record being built: a copy from (copy_target, copy_source), then extra bytes up to t
+    size_t copy_target = 0, copy_source = 0, copy_length = 0;
+    size_t t = 0;
+
+    while (t < target_length) {
+        size_t s = SIZE_MAX;
+
+        // Keep the previous alignment when it still mostly matches, as after a changed constant
+        size_t aligned = copy_source + (t - copy_target);
+        if (copy_length > 0 && aligned < source_length &&
+            extend(source + aligned, source_length - aligned, target + t, target_length - t) >= 2 * MATCH_LENGTH) {
+            s = aligned;
+        } else if (t + MATCH_LENGTH <= target_length) {
+            int32_t candidate = index[hash_at(target + t, bits)];
+            if (candidate >= 0 && memcmp(source + candidate, target + t, MATCH_LENGTH) == 0) {
+                s = (size_t) candidate;
+            }
+        }
+
+        if (s == SIZE_MAX) {
+            t++;
+            continue;
+        }
+
+        size_t length = extend(source + s, source_length - s, target + t, target_length - t);
+        if (length < MATCH_LENGTH) {
+            t++;
+            continue;
+        }
+
+        size_t extra_start = copy_target + copy_length;
+        put_record(patch, source + copy_source, target + copy_target, copy_length, target + extra_start,
+                   t - extra_start, (int32_t) ((int64_t) s - (int64_t) (copy_source + copy_length)));
+
+        copy_target = t;
+        copy_source = s;
+        copy_length = length;
+        t += length;
+    }
+
+    size_t extra_start = copy_target + copy_length;
+    put_record(patch, source + copy_source, target + copy_target, copy_length, target + extra_start,
+               target_length - extra_start, 0);
+
+    free(index);
+}
+
+
+size_t delta_diff_max_length(size_t target_length) {
+    // Every byte extra, in records of one match length
+    return DELTA_HEADER_LENGTH + 2 * target_length + 64;
+}
+
+size_t delta_diff(const uint8_t *source, size_t source_length, const uint8_t *target, size_t target_length,
+                  uint8_t *patch_data) {
+    patch_t patch = { .data = patch_data, .length = 0 };
+    diff(source, source_length, target, target_length, &patch);
+
+    return patch.length;
+}
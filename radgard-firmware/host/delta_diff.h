@@ -0,0 +1,14 @@
+#ifndef __DELTA_DIFF_H__
+#define __DELTA_DIFF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Room to allocate for the patch of a `target_length` byte image
+size_t delta_diff_max_length(size_t target_length);
+
+// Writes the patch from `source` to `target` into `patch` and returns its length
+size_t delta_diff(const uint8_t *source, size_t source_length, const uint8_t *target, size_t target_length,
+                  uint8_t *patch);
+
+#endif
@@ -0,0 +1,172 @@
+/*
+    Radgard Delta Patch Tool
+
+    Makes and applies firmware patches in the format of components/delta.
+    `diff` runs delta_diff.c, the stand-in for the server's patch generator.
+    `apply` runs the firmware's patcher with files standing in for the
+    running and update partitions, feeding it the patch in network-sized
+    chunks, and checks the result the way the device does.
+
+      delta_tool diff old.bin new.bin patch.bin
+      delta_tool [-c chunk_bytes] apply old.bin patch.bin new.bin
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "delta.h"
+#include "delta_diff.h"
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *read_file(const char *path, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = malloc(*length + 1);
+    if (fread(data, 1, *length, file) != *length) {
+        perror(path);
+        exit(1);
+    }
+
+    fclose(file);
+
+    return data;
+}
+
+static int run_diff(const char *old_path, const char *new_path, const char *patch_path) {
+    size_t source_length, target_length;
+    uint8_t *source = read_file(old_path, &source_length);
+    uint8_t *target = read_file(new_path, &target_length);
+
+    uint8_t *patch = malloc(delta_diff_max_length(target_length));
+
+    double start = now_s();
+    size_t patch_length = delta_diff(source, source_length, target, target_length, patch);
+    double diff_s = now_s() - start;
+
+    FILE *file = fopen(patch_path, "wb");
+    if (file == NULL || fwrite(patch, 1, patch_length, file) != patch_length) {
+        perror(patch_path);
+        return 1;
+    }
+    fclose(file);
+
+    printf("patch: %u bytes for a %u byte image (%.1f%%), made in %.2f s\n", (unsigned) patch_length,
+           (unsigned) target_length, 100.0 * patch_length / target_length, diff_s);
+
+    return 0;
+}
+
+/* apply */
+
+typedef struct {
+    FILE *source;
+    FILE *target;
+} partitions_t;
+
+static esp_err_t read_partition(void *user_data, uint32_t offset, uint8_t *data, size_t length) {
+    partitions_t *partitions = user_data;
+
+    if (fseek(partitions->source, offset, SEEK_SET) != 0 || fread(data, 1, length, partitions->source) != length) {
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t write_partition(void *user_data, const uint8_t *data, size_t length) {
+    partitions_t *partitions = user_data;
+
+    return fwrite(data, 1, length, partitions->target) == length ? ESP_OK : ESP_FAIL;
+}
+
+static int run_apply(const char *old_path, const char *patch_path, const char *new_path, size_t chunk_length) {
+    size_t patch_length;
+    uint8_t *patch = read_file(patch_path, &patch_length);
+
+    partitions_t partitions = { .source = fopen(old_path, "rb"), .target = fopen(new_path, "wb") };
+    if (partitions.source == NULL || partitions.target == NULL) {
+        perror(partitions.source == NULL ? old_path : new_path);
+        return 1;
+    }
+
+    delta_io_t io = { .read_source = read_partition, .write_target = write_partition, .user_data = &partitions };
+
+    double start = now_s();
+
+    delta_patcher_t patcher;
+    delta_patcher_begin(&patcher);
+    for (size_t offset = 0; offset < patch_length; offset += chunk_length) {
+        size_t length = patch_length - offset < chunk_length ? patch_length - offset : chunk_length;
+        if (delta_patcher_feed(&patcher, &io, patch + offset, length) != ESP_OK) {
+            break;
+        }
+    }
+
+    esp_err_t err = delta_patcher_end(&patcher);
+    double apply_s = now_s() - start;
+
+    fclose(partitions.source);
+    fclose(partitions.target);
+
+    if (err != ESP_OK) {
+        fprintf(stderr, "delta_tool: patch rejected: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+
+    printf("applied: %u byte image from a %u byte patch in %.2f ms, %u bytes of patcher state, SHA-256 verified\n",
+           (unsigned) patcher.target_written, (unsigned) patch_length, apply_s * 1e3, (unsigned) sizeof(delta_patcher_t));
+
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: delta_tool diff OLD NEW PATCH\n"
+            "       delta_tool [-c chunk_bytes] apply OLD PATCH NEW\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    size_t chunk_length = 1024;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:")) != -1) {
+        switch (opt) {
+            case 'c':
+                chunk_length = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc == 4 && strcmp(argv[0], "diff") == 0) {
+        return run_diff(argv[1], argv[2], argv[3]);
+    } else if (argc == 4 && strcmp(argv[0], "apply") == 0 && chunk_length > 0) {
+        return run_apply(argv[1], argv[2], argv[3], chunk_length);
+    }
+
+    usage();
+
+    return 2;
+}
@@ -0,0 +1,752 @@
+/*
+    Radgard Fleet Simulator
+
+    Replays simulated devices through months of wake cycles using the real
+    scheduling, settings and storage code on the Linux HAL, whose clock only
+    moves when the firmware waits or sleeps. Each device's RTC runs a little
+    fast or slow over deep sleep, as the RC oscillator does. Each device runs in its own
+    forked process, so one device's RTC-resident state never leaks into the
+    next, and up to --jobs devices run at once.
+
+    The energy model is deliberately simple: a current per activity times the
+    virtual time spent in it, plus a fixed charge per solenoid pulse and per
+    NVS write. It is for comparing firmware changes, not for absolute numbers.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "hal.h"
+#include "hal_linux.h"
+#include "storage.h"
+#include "settings.h"
+#include "schedule.h"
+#include "api.h"
+#include "settings_server.h"
+#include "profile.h"
+#include "clock.h"
+#include "device.h"
+#include "board.h"
+
+#define SIM_START_TIME 1767225600 // 2026-01-01 00:00 UTC
+#define SIM_MAX_OUTAGES 32
+#define SIM_MAX_PRESSES 256
+#define SIM_WIFI_CACHE_IP_MAX_AGE_S (3 * 24 * 3600) // network.c's WIFI_CACHE_IP_MAX_AGE_S
+#define SIM_STUB_MIN_SLEEP_US 100000                // wake_stub.c's MIN_SLEEP_US
+
+#define US_PER_HOUR 3600e6
+
+/* Currents (mA) and durations of what the firmware does not spend its own virtual time on */
+typedef struct {
+    double sleep_ma;
+    double active_ma;
+    double radio_ma;
+    double stub_ma;
+    double solenoid_ma;
+    double nvs_write_mas;       // mA*s per NVS write
+    uint32_t boot_ms;           // ROM, bootloader and app start before app_main
+    uint32_t stub_us;           // wake stub check before sleeping again or booting
+    uint32_t wifi_scan_connect_ms;      // full scan, then association
+    uint32_t wifi_cached_connect_ms;    // association straight to the cached BSSID and channel
+    uint32_t dhcp_ms;
+    uint32_t static_ip_ms;              // reusing the cached lease
+    uint32_t time_sync_ms;      // SNTP fallback
+    uint32_t full_handshake_ms;     // certificate verification and key exchange
+    uint32_t resumed_handshake_ms;  // abbreviated handshake on a cached session
+    uint32_t session_lifetime_s;    // how long the server honours a session ticket
+    uint32_t request_ms;            // one request/response once TLS is up
+    uint32_t rx_bytes_per_ms;   // response body, after TLS record and TCP overheads
+    uint32_t request_timeout_ms;
+} sim_costs_t;
+
+static const sim_costs_t COSTS = {
+    .sleep_ma = 0.015,
+    .active_ma = 40,
+    .radio_ma = 120,
+    .stub_ma = 15,
+    .solenoid_ma = 400,
+    .nvs_write_mas = 0.05,
+    .boot_ms = 300,
+    .stub_us = 1500,
+    .wifi_scan_connect_ms = 2000,
+    .wifi_cached_connect_ms = 250,
+    .dhcp_ms = 500,
+    .static_ip_ms = 10,
+    .time_sync_ms = 400,
+    .full_handshake_ms = 1100,
+    .resumed_handshake_ms = 250,
+    .session_lifetime_s = 28 * 3600,
+    .request_ms = 300,
+    .rx_bytes_per_ms = 50,
+    .request_timeout_ms = 10000
+};
+
+typedef struct {
+    uint32_t devices;
+    uint32_t days;
+    uint32_t jobs;
+    uint64_t seed;
+    double wifi_failure;        // per connection attempt
+    double outages_per_year;
+    double outage_hours;
+    double presses_per_month;   // manual on/off pairs
+    double sig_rain;            // chance a fetched day is flagged for significant rain (no watering)
+    double battery_mah;
+    bool json_only;
+    bool no_tls_resume;
+    bool no_wifi_cache;
+    uint32_t rtc_error_ppm;     // largest RTC error across the fleet
+    bool no_rtc_correction;
+    bool trace;
+} sim_config_t;
+
+typedef struct {
+    uint32_t full_boots;
+    uint32_t stub_wakes;
+    uint32_t online_wakes;
+    uint32_t wifi_failures;     // online wakes that never connected
+    uint32_t wifi_attempt_failures;
+    uint32_t fetch_failures;
+    uint32_t unchanged_fetches;
+    uint32_t sntp_syncs;
+    uint32_t resumed_handshakes;
+    uint32_t settings_bytes;
+    uint32_t solenoid_actions;
+    uint32_t manual_presses;
+    uint32_t nvs_writes;
+    uint32_t valve_error_s;     // worst clock error at a solenoid action, once the clock was set
+    double phase_s[PROFILE_PHASE_COUNT];
+    double awake_s;
+    double radio_s;
+    double mah;
+} sim_result_t;
+
+/* State of the device being simulated in this process */
+
+typedef struct {
+    uint64_t rng;
+    uint64_t rain_seed;
+
+    // What the server hands out
+    int32_t utc_offset;
+    uint32_t day_times[SCHEDULE_DAYS][SCHEDULE_MAX_DAY_TIMES];
+    uint8_t day_times_length[SCHEDULE_DAYS];
+
+    uint32_t outage_start[SIM_MAX_OUTAGES];
+    uint32_t outage_end[SIM_MAX_OUTAGES];
+    uint8_t outages_length;
+
+    uint32_t presses[SIM_MAX_PRESSES];
+    uint16_t presses_length;
+    uint16_t next_press;
+
+    // network.c's RTC cache of the access point, and the true time of the lease it holds
+    bool wifi_cached;
+    uint32_t wifi_lease_time;
+
+    // True time of the last handshake, whose session hal_esp_http.c keeps across deep sleep
+    uint32_t tls_session_time;
+
+    // How much faster than real time the RTC runs over deep sleep
+    int32_t rtc_error_ppm;
+} sim_device_t;
+
+static sim_config_t config;
+static sim_device_t device;
+static sim_result_t *result;
+
+static uint64_t rng_next(uint64_t *state) {
+    // splitmix64
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+static double rng_uniform() {
+    return (rng_next(&device.rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint32_t rng_range(uint32_t low, uint32_t high) {
+    return low + (uint32_t) (rng_uniform() * (high - low));
+}
+
+static double rng_exponential(double mean) {
+    return -mean * log(1.0 - rng_uniform());
+}
+
+static uint32_t true_now() {
+    return (uint32_t) hal_linux_true_time();
+}
+
+static bool server_down(uint32_t now) {
+    for (int i = 0; i < device.outages_length; i++) {
+        if (now >= device.outage_start[i] && now < device.outage_end[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void generate_device(uint32_t id) {
+    memset(&device, 0, sizeof(sim_device_t));
+    device.rng = config.seed ^ ((uint64_t) id * 0xd1b54a32d192ed03ULL);
+    device.rain_seed = rng_next(&device.rng);
+
+    device.utc_offset = ((int32_t) rng_range(0, 14) - 10) * 3600;
+
+    // Most days water in one to three windows between 04:00 and 21:00
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        if (rng_uniform() > 0.6) {
+            continue;
+        }
+
+        uint32_t windows = rng_range(1, 4);
+        uint32_t time = rng_range(4 * 60, 8 * 60) * 60;
+
+        for (uint32_t i = 0; i < windows; i++) {
+            uint32_t duration = rng_range(10, 46) * 60;
+
+            device.day_times[day][device.day_times_length[day]++] = time;
+            device.day_times[day][device.day_times_length[day]++] = time + duration;
+
+            time += duration + rng_range(60, 5 * 60) * 60;
+            if (time + 46 * 60 > 21 * 3600) {
+                break;
+            }
+        }
+    }
+
+    uint32_t end = SIM_START_TIME + config.days * 86400;
+
+    double outage_mean = 365.0 * 86400 / config.outages_per_year;
+    double time = SIM_START_TIME + rng_exponential(outage_mean);
+    while (config.outages_per_year > 0 && time < end && device.outages_length < SIM_MAX_OUTAGES) {
+        device.outage_start[device.outages_length] = (uint32_t) time;
+        device.outage_end[device.outages_length] = (uint32_t) (time + rng_exponential(config.outage_hours * 3600));
+        time = device.outage_end[device.outages_length++] + rng_exponential(outage_mean);
+    }
+
+    // Presses come in pairs: manual mode on, then off again a while later
+    double press_mean = 30.0 * 86400 / config.presses_per_month;
+    time = SIM_START_TIME + rng_exponential(press_mean);
+    while (config.presses_per_month > 0 && time < end && device.presses_length + 2 <= SIM_MAX_PRESSES) {
+        device.presses[device.presses_length++] = (uint32_t) time;
+        time += rng_range(5, 90) * 60;
+        device.presses[device.presses_length++] = (uint32_t) time;
+        time += rng_exponential(press_mean);
+    }
+
+    device.rtc_error_ppm = (int32_t) rng_range(0, 2 * config.rtc_error_ppm + 1) - (int32_t) config.rtc_error_ppm;
+}
+
+/* Server side of the daily fetch: the device's zone served by the stand-in
+ * server behind the Linux HAL, with the connection's costs and outages */
+
+// Rain is decided per local date, so a day's flag holds from fetch to fetch
+static bool sig_rain_on(uint32_t date) {
+    uint64_t state = device.rain_seed ^ ((uint64_t) date << 32);
+
+    return (rng_next(&state) >> 11) * (1.0 / 9007199254740992.0) < config.sig_rain;
+}
+
+static void serve_zone() {
+    settings_server_zone_t zone;
+    memset(&zone, 0, sizeof(settings_server_zone_t));
+
+    // time_zone is whole hours behind UTC
+    zone.time_zone = -device.utc_offset / 3600;
+    memcpy(zone.day_times, device.day_times, sizeof(zone.day_times));
+    memcpy(zone.day_times_length, device.day_times_length, sizeof(zone.day_times_length));
+
+    // sig_rains[n] flags the next weekday n (Sunday is 0), today included
+    uint32_t today = (true_now() + device.utc_offset) / 86400;
+    uint32_t weekday = (today + 4) % 7;
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        zone.sig_rains[day] = sig_rain_on(today + (day + 7 - weekday) % 7);
+    }
+
+    settings_server_set_zone(&zone);
+    settings_server_set_date(true_now());
+}
+
+// A hal_linux_http_handler_t in front of settings_server_handle
+static esp_err_t sim_http_handler(const hal_http_request_t *request, int *status_code) {
+    if (server_down(true_now())) {
+        hal_delay_ms(COSTS.request_timeout_ms);
+        result->fetch_failures += 1;
+
+        return ESP_ERR_TIMEOUT;
+    }
+
+    uint32_t now = true_now();
+    bool resumed = !config.no_tls_resume && device.tls_session_time != 0 &&
+                   now - device.tls_session_time < COSTS.session_lifetime_s;
+
+    if (resumed) {
+        result->resumed_handshakes += 1;
+    }
+
+    hal_delay_ms((resumed ? COSTS.resumed_handshake_ms : COSTS.full_handshake_ms) + COSTS.request_ms);
+    device.tls_session_time = now;
+
+    serve_zone();
+    esp_err_t err = settings_server_handle(request, status_code);
+
+    size_t body_length = settings_server_last_body_length();
+    hal_delay_ms(body_length / COSTS.rx_bytes_per_ms);
+    result->settings_bytes += body_length;
+
+    if (*status_code == 304) {
+        result->unchanged_fetches += 1;
+    }
+
+    return err;
+}
+
+// What provisioning leaves in NVS for api_sync
+static void provision_device(uint32_t id) {
+    radgard_settings_t settings;
+    settings_load(&settings);
+
+    strcpy(settings.user_id, "fleet-sim");
+    snprintf(settings.zone_id, sizeof(settings.zone_id), "zone-%u", id);
+    settings_save(&settings);
+}
+
+/* Stand-in for get_irrigation_settings in main.c: network.c's connect and
+ * settle, then the real api_sync and network.c's time from its Date (the
+ * simulated server never offers firmware) */
+static void sim_go_online() {
+    int64_t radio_start_us = hal_clock_monotonic_us();
+
+    storage_init_nvs();
+    result->online_wakes += 1;
+
+    profile_phase_start(PROFILE_PHASE_WIFI_CONNECT);
+
+    // Initial attempt plus network.c's three reconnects; falling back from the cached access point is not one
+    bool cached = !config.no_wifi_cache && device.wifi_cached;
+    bool connected = false;
+    for (int attempt = 0; attempt < 4 && !connected;) {
+        uint32_t connect_ms = cached ? COSTS.wifi_cached_connect_ms : COSTS.wifi_scan_connect_ms;
+        hal_linux_set_wifi(rng_uniform() >= config.wifi_failure, connect_ms);
+        connected = hal_wifi_connect() == ESP_OK;
+
+        if (!connected) {
+            result->wifi_attempt_failures += 1;
+        }
+
+        if (!connected && cached) {
+            cached = false;
+            device.wifi_cached = false;
+        } else {
+            attempt++;
+        }
+    }
+
+    profile_phase_end(PROFILE_PHASE_WIFI_CONNECT);
+
+    if (connected) {
+        profile_phase_start(PROFILE_PHASE_WIFI_SETTLE);
+        uint32_t now = true_now();
+        if (cached && now - device.wifi_lease_time < SIM_WIFI_CACHE_IP_MAX_AGE_S) {
+            hal_delay_ms(COSTS.static_ip_ms);
+        } else {
+            hal_delay_ms(COSTS.dhcp_ms);
+            device.wifi_lease_time = now;
+        }
+        device.wifi_cached = true;
+        profile_phase_end(PROFILE_PHASE_WIFI_SETTLE);
+
+        static api_firmware_update_t firmware_update;
+        time_t server_time;
+
+        api_open_session();
+
+        profile_phase_start(PROFILE_PHASE_SETTINGS_FETCH);
+        api_sync(&firmware_update, &server_time);
+        profile_phase_end(PROFILE_PHASE_SETTINGS_FETCH);
+
+        // network_set_time: the response's Date, or SNTP once the clock is unset or may have drifted too far
+        profile_phase_start(PROFILE_PHASE_TIME_SYNC);
+        if (server_time == 0 && clock_sync_due()) {
+            hal_delay_ms(COSTS.time_sync_ms);
+            server_time = true_now();
+            result->sntp_syncs += 1;
+        }
+
+        if (server_time != 0) {
+            clock_sync(server_time);
+        }
+        if (config.no_rtc_correction) {
+            hal_clock_set_rtc_correction(0);
+        }
+        profile_phase_end(PROFILE_PHASE_TIME_SYNC);
+
+        api_close_session();
+    } else {
+        result->wifi_failures += 1;
+    }
+
+    hal_wifi_stop();
+
+    result->radio_s += (hal_clock_monotonic_us() - radio_start_us) / 1e6;
+}
+
+/* Mirrors esp_wake_deep_sleep in main/wake_stub.c. Returns false when the
+ * wake needs a full boot. */
+static bool sim_wake_stub(uint64_t *sleep_us) {
+    const schedule_t *schedule = schedule_cache_peek();
+    schedule_event_t pending;
+    if (schedule == NULL || !schedule_cache_get_next_event(&pending)) {
+        return false;
+    }
+
+    uint32_t now = hal_clock_now();
+
+    schedule_wake_t wake;
+    schedule_decide_wake(schedule, &pending, now, &wake);
+    if (wake.full_boot) {
+        return false;
+    }
+
+    hal_delay_ms(2 * BOARD_SOLENOID_PULSE_MS);
+    result->solenoid_actions += 1;
+    schedule_cache_set_next_event(&wake.next_event);
+
+    uint64_t wake_us = (uint64_t) wake.next_event.time * 1000000;
+    uint64_t done_us = (uint64_t) hal_clock_now() * 1000000;
+    if (wake_us < done_us + SIM_STUB_MIN_SLEEP_US) {
+        wake_us = done_us + SIM_STUB_MIN_SLEEP_US;
+    }
+
+    *sleep_us = wake_us - done_us;
+
+    return true;
+}
+
+static void record_valve_error() {
+    clock_drift_t drift;
+    clock_get_drift(&drift);
+    if (drift.last_sync == 0) {
+        return;
+    }
+
+    int64_t error = (int64_t) hal_clock_now() - true_now();
+    uint32_t error_s = (uint32_t) (error < 0 ? -error : error);
+    if (error_s > result->valve_error_s) {
+        result->valve_error_s = error_s;
+    }
+}
+
+static void add_awake(double seconds, double current_ma) {
+    result->awake_s += seconds;
+    result->mah += seconds * current_ma / 3600;
+}
+
+static void simulate_device(uint32_t id) {
+    generate_device(id);
+    hal_linux_set_log_level(config.trace ? ESP_LOG_INFO : ESP_LOG_NONE);
+
+    // A fresh board: clock unset until the first time sync
+    hal_linux_set_true_time(SIM_START_TIME);
+    hal_linux_set_time(0);
+    hal_linux_set_rtc_error_ppm(device.rtc_error_ppm);
+
+    provision_device(id);
+
+    uint32_t end = SIM_START_TIME + config.days * 86400;
+    bool stub_enabled = false;
+    uint32_t solenoid_level = 0;
+
+    while (true_now() < end) {
+        uint64_t sleep_us;
+
+        hal_linux_advance_us(COSTS.stub_us);
+        add_awake(COSTS.stub_us / 1e6, COSTS.stub_ma);
+
+        int64_t awake_start_us = hal_clock_monotonic_us();
+
+        if (hal_sleep_wake_cause() == HAL_WAKE_TIMER && stub_enabled && sim_wake_stub(&sleep_us)) {
+            result->stub_wakes += 1;
+            record_valve_error();
+            add_awake((hal_clock_monotonic_us() - awake_start_us) / 1e6, COSTS.stub_ma);
+            result->mah += 2 * BOARD_SOLENOID_PULSE_MS / 1e3 * COSTS.solenoid_ma / 3600;
+            solenoid_level ^= 1;
+        } else {
+            hal_linux_kv_stats_t kv_before, kv_after;
+            hal_linux_kv_get_stats(&kv_before);
+
+            double radio_before = result->radio_s;
+
+            hal_linux_advance_us((int64_t) COSTS.boot_ms * 1000);
+
+            device_sleep_t sleep;
+            device_wake(sim_go_online, NULL, &sleep);
+            sleep_us = sleep.time_us;
+            stub_enabled = sleep.stub_enabled;
+
+            result->full_boots += 1;
+
+            profile_wake_t wake;
+            if (profile_get_wakes(&wake, 1) == 1) {
+                for (int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+                    result->phase_s[phase] += wake.phase_us[phase] / 1e6;
+                }
+            }
+
+            double awake_s = (hal_clock_monotonic_us() - awake_start_us) / 1e6;
+            double radio_s = result->radio_s - radio_before;
+            add_awake(awake_s - radio_s, COSTS.active_ma);
+            add_awake(radio_s, COSTS.radio_ma);
+
+            hal_linux_kv_get_stats(&kv_after);
+            uint32_t writes = kv_after.writes - kv_before.writes + kv_after.erases - kv_before.erases;
+            result->nvs_writes += writes;
+            result->mah += writes * COSTS.nvs_write_mas / 3600;
+
+            uint8_t level = hal_linux_gpio_level(BOARD_GPIO_S_OPEN);
+            if (level != solenoid_level) {
+                result->solenoid_actions += 1;
+                result->mah += 2 * BOARD_SOLENOID_PULSE_MS / 1e3 * COSTS.solenoid_ma / 3600;
+                solenoid_level = level;
+                record_valve_error();
+            }
+        }
+
+        if (config.trace) {
+            fprintf(stderr, "t=%u boots=%u stub=%u sleep=%llus\n", true_now(), result->full_boots,
+                    result->stub_wakes, (unsigned long long) (sleep_us / 1000000));
+        }
+
+        // A button press that comes before the timer cuts the sleep short
+        uint32_t now = true_now();
+        while (device.next_press < device.presses_length && device.presses[device.next_press] <= now) {
+            device.next_press += 1;
+        }
+
+        if (device.next_press < device.presses_length &&
+            device.presses[device.next_press] < now + sleep_us / 1000000) {
+            sleep_us = (uint64_t) (device.presses[device.next_press++] - now) * 1000000;
+            hal_linux_set_wake(HAL_WAKE_GPIO, 1ULL << BOARD_GPIO_MAN);
+            result->manual_presses += 1;
+        }
+
+        result->mah += sleep_us / US_PER_HOUR * COSTS.sleep_ma;
+        hal_sleep_deep(sleep_us);
+    }
+}
+
+static void run_fleet(sim_result_t *results) {
+    uint32_t running = 0;
+
+    for (uint32_t id = 0; id < config.devices; id++) {
+        if (running == config.jobs) {
+            wait(NULL);
+            running -= 1;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(1);
+        }
+
+        if (pid == 0) {
+            result = &results[id];
+            simulate_device(id);
+            _exit(0);
+        }
+
+        running += 1;
+    }
+
+    while (running > 0) {
+        wait(NULL);
+        running -= 1;
+    }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+// Prints mean, median and 95th percentile across the fleet of one field
+static void print_stat(const char *name, sim_result_t *results, size_t offset, bool is_double) {
+    double *values = malloc(config.devices * sizeof(double));
+    double total = 0;
+
+    for (uint32_t i = 0; i < config.devices; i++) {
+        const char *field = (const char *) &results[i] + offset;
+        values[i] = is_double ? *(const double *) field : *(const uint32_t *) field;
+        total += values[i];
+    }
+
+    qsort(values, config.devices, sizeof(double), compare_doubles);
+
+    printf("%-24s %12.2f %12.2f %12.2f\n", name, total / config.devices,
+           values[config.devices / 2], values[(size_t) (config.devices * 0.95)]);
+
+    free(values);
+}
+
+#define PRINT_COUNT(name, field) print_stat(name, results, offsetof(sim_result_t, field), false)
+#define PRINT_DOUBLE(name, field) print_stat(name, results, offsetof(sim_result_t, field), true)
+
+static void print_report(sim_result_t *results) {
+    printf("%u devices, %u days, seed %llu\n\n", config.devices, config.days, (unsigned long long) config.seed);
+    printf("%-24s %12s %12s %12s\n", "per device", "mean", "p50", "p95");
+
+    PRINT_COUNT("full boots", full_boots);
+    PRINT_COUNT("stub wakes", stub_wakes);
+    PRINT_COUNT("online wakes", online_wakes);
+    PRINT_COUNT("wifi failed wakes", wifi_failures);
+    PRINT_COUNT("wifi failed attempts", wifi_attempt_failures);
+    PRINT_COUNT("fetch failures", fetch_failures);
+    PRINT_COUNT("unchanged fetches", unchanged_fetches);
+    PRINT_COUNT("sntp syncs", sntp_syncs);
+    PRINT_COUNT("resumed handshakes", resumed_handshakes);
+    PRINT_COUNT("settings bytes", settings_bytes);
+    PRINT_COUNT("solenoid actions", solenoid_actions);
+    PRINT_COUNT("manual presses", manual_presses);
+    PRINT_COUNT("nvs writes", nvs_writes);
+    PRINT_COUNT("valve error s", valve_error_s);
+    PRINT_DOUBLE("awake s", awake_s);
+    PRINT_DOUBLE("radio on s", radio_s);
+
+    for (int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+        char name[32];
+        snprintf(name, sizeof(name), "  %s s", profile_phase_name(phase));
+        print_stat(name, results, offsetof(sim_result_t, phase_s) + phase * sizeof(double), true);
+    }
+
+    PRINT_DOUBLE("mAh", mah);
+
+    double total_mah = 0;
+    for (uint32_t i = 0; i < config.devices; i++) {
+        total_mah += results[i].mah;
+    }
+
+    double mah_per_day = total_mah / config.devices / config.days;
+    printf("\nmean %.3f mAh/day: %.0f days on a %.0f mAh battery\n", mah_per_day,
+           config.battery_mah / mah_per_day, config.battery_mah);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n, --devices N         simulated devices (default 1000)\n"
+            "  -d, --days N            simulated days per device (default 365)\n"
+            "  -j, --jobs N            devices simulated at once (default: online CPUs)\n"
+            "  -s, --seed N            fleet seed (default 1)\n"
+            "      --wifi-failure P    chance a Wi-Fi connection attempt fails (default 0.05)\n"
+            "      --outages N         server outages per year (default 6)\n"
+            "      --outage-hours N    mean outage length (default 4)\n"
+            "      --presses N         manual on/off pairs per month (default 2)\n"
+            "      --sig-rain P        chance a fetched day is flagged sig_rain (default 0.2)\n"
+            "      --battery MAH       battery capacity for the life estimate (default 2500)\n"
+            "      --json-only         serve settings as JSON, like a server without the binary encoding\n"
+            "      --no-tls-resume     do a full TLS handshake on every request\n"
+            "      --no-wifi-cache     scan and use DHCP on every connection\n"
+            "      --rtc-error PPM     largest RTC error over deep sleep (default 2000)\n"
+            "      --no-rtc-correction leave the RTC's drift uncorrected\n"
+            "      --trace             log every wake (use with -n 1)\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    config = (sim_config_t) {
+        .devices = 1000,
+        .days = 365,
+        .jobs = sysconf(_SC_NPROCESSORS_ONLN),
+        .seed = 1,
+        .wifi_failure = 0.05,
+        .outages_per_year = 6,
+        .outage_hours = 4,
+        .presses_per_month = 2,
+        .sig_rain = 0.2,
+        .battery_mah = 2500,
+        .rtc_error_ppm = 2000
+    };
+
+    static const struct option options[] = {
+        { "devices", required_argument, NULL, 'n' },
+        { "days", required_argument, NULL, 'd' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "seed", required_argument, NULL, 's' },
+        { "wifi-failure", required_argument, NULL, 'w' },
+        { "outages", required_argument, NULL, 'o' },
+        { "outage-hours", required_argument, NULL, 'h' },
+        { "presses", required_argument, NULL, 'p' },
+        { "sig-rain", required_argument, NULL, 'r' },
+        { "battery", required_argument, NULL, 'b' },
+        { "json-only", no_argument, NULL, 'J' },
+        { "no-tls-resume", no_argument, NULL, 'R' },
+        { "no-wifi-cache", no_argument, NULL, 'W' },
+        { "rtc-error", required_argument, NULL, 'e' },
+        { "no-rtc-correction", no_argument, NULL, 'C' },
+        { "trace", no_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "n:d:j:s:", options, NULL)) != -1) {
+        switch (option) {
+            case 'n': config.devices = strtoul(optarg, NULL, 10); break;
+            case 'd': config.days = strtoul(optarg, NULL, 10); break;
+            case 'j': config.jobs = strtoul(optarg, NULL, 10); break;
+            case 's': config.seed = strtoull(optarg, NULL, 10); break;
+            case 'w': config.wifi_failure = atof(optarg); break;
+            case 'o': config.outages_per_year = atof(optarg); break;
+            case 'h': config.outage_hours = atof(optarg); break;
+            case 'p': config.presses_per_month = atof(optarg); break;
+            case 'r': config.sig_rain = atof(optarg); break;
+            case 'b': config.battery_mah = atof(optarg); break;
+            case 'J': config.json_only = true; break;
+            case 'R': config.no_tls_resume = true; break;
+            case 'W': config.no_wifi_cache = true; break;
+            case 'e': config.rtc_error_ppm = strtoul(optarg, NULL, 10); break;
+            case 'C': config.no_rtc_correction = true; break;
+            case 't': config.trace = true; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (config.devices == 0 || config.days == 0 || config.jobs == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sim_result_t *results = mmap(NULL, config.devices * sizeof(sim_result_t), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    memset(results, 0, config.devices * sizeof(sim_result_t));
+
+    hal_linux_set_http_handler(sim_http_handler);
+    settings_server_set_json_only(config.json_only);
+
+    run_fleet(results);
+    print_report(results);
+
+    munmap(results, config.devices * sizeof(sim_result_t));
+
+    return 0;
+}
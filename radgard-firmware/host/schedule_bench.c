@@ -0,0 +1,115 @@
+/*
+    Radgard Schedule Cache Benchmark
+
+    Times the two ways a timer wake gets its schedule: a hit on the RTC
+    memory copy (CRC check and copy) and a miss that loads the settings
+    record from NVS and refills the cache, as device.c's load_schedule does.
+    The Linux HAL's NVS is in memory, so the miss leaves out flash reads and
+    NVS page lookups, and the real gap on target is wider.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "hal_linux.h"
+#include "schedule.h"
+#include "settings.h"
+#include "storage.h"
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Two cycles a day, every day */
+static void representative_schedule(schedule_t *schedule) {
+    timezone_t timezone;
+    timezone_init_fixed(&timezone, -5 * 3600);
+    schedule_init(schedule, &timezone);
+
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        uint32_t start = 6 * 3600 + day * 300;
+        uint32_t times[] = { start, start + 1200, start + 12 * 3600, start + 12 * 3600 + 900 };
+        schedule_set_day_times(schedule, day, times, 4);
+    }
+}
+
+static double bench_hit(int iterations) {
+    schedule_t schedule;
+
+    double start = now_s();
+    for (int i = 0; i < iterations; i++) {
+        if (!schedule_cache_load(&schedule)) {
+            fprintf(stderr, "schedule_bench: cache missed\n");
+            exit(1);
+        }
+    }
+
+    return (now_s() - start) / iterations;
+}
+
+static double bench_miss(int iterations) {
+    radgard_settings_t settings;
+
+    double start = now_s();
+    for (int i = 0; i < iterations; i++) {
+        schedule_cache_invalidate();
+
+        if (settings_load(&settings) != ESP_OK || !settings.has_schedule) {
+            fprintf(stderr, "schedule_bench: no schedule in NVS\n");
+            exit(1);
+        }
+        schedule_cache_store(&settings.schedule);
+    }
+
+    return (now_s() - start) / iterations;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: schedule_bench [-i iterations]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 100000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:")) != -1) {
+        switch (opt) {
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (iterations <= 0) {
+        usage();
+    }
+
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    radgard_settings_t settings;
+    settings_init(&settings);
+    representative_schedule(&settings.schedule);
+    settings.has_schedule = 1;
+    settings_save(&settings);
+    schedule_cache_store(&settings.schedule);
+
+    printf("%d iterations, %u byte schedule, %u byte settings record\n", iterations,
+           (unsigned) sizeof(schedule_t), (unsigned) sizeof(radgard_settings_t));
+
+    double hit_s = bench_hit(iterations);
+    printf("hit:  %8.3f us/load (RTC copy)\n", hit_s * 1e6);
+
+    double miss_s = bench_miss(iterations);
+    printf("miss: %8.3f us/load (NVS record and cache refill; host NVS is in memory)\n", miss_s * 1e6);
+
+    return 0;
+}
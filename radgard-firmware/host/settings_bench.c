@@ -0,0 +1,223 @@
+/*
+    Radgard Settings Decoder Benchmark
+
+    Fetches a representative zone from the stand-in settings server in both
+    wire formats, decoding each with the firmware's streaming decoder as it
+    arrives in network-sized chunks, and reports body size, time per response
+    and the memory the decoder needs. When cJSON is installed on the host the
+    JSON body is also decoded the way api.c used to (buffer the body,
+    cJSON_Parse, walk the tree), counting cJSON's allocations.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <strings.h>
+#include <getopt.h>
+
+#ifdef HAVE_CJSON
+#include <cJSON.h>
+#endif
+
+#include "schedule.h"
+#include "timezone.h"
+#include "wire.h"
+#include "hal_linux.h"
+#include "settings_server.h"
+
+// The response buffer api.c used before the decoder
+#define OLD_RESPONSE_BUFFER 4096
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Two cycles a day and a DST transition pair */
+static void representative_zone(settings_server_zone_t *zone) {
+    memset(zone, 0, sizeof(settings_server_zone_t));
+    zone->time_zone = 5;
+
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        uint32_t start = 6 * 3600 + day * 300;
+        uint32_t times[] = { start, start + 1200, start + 12 * 3600, start + 12 * 3600 + 900 };
+
+        memcpy(zone->day_times[day], times, sizeof(times));
+        zone->day_times_length[day] = 4;
+        zone->sig_rains[day] = day == 1 || day == 5;
+    }
+
+    timezone_add_transition(&zone->utc_offsets, 1772956800, -14400);
+    timezone_add_transition(&zone->utc_offsets, 1793516400, -18000);
+}
+
+static void decoder_header(void *user_data, const char *key, const char *value) {
+    if (strcasecmp(key, "Content-Type") == 0) {
+        wire_decoder_set_content_type(user_data, value);
+    }
+}
+
+static esp_err_t decoder_data(void *user_data, const char *data, size_t length) {
+    return wire_decoder_feed(user_data, data, length);
+}
+
+/* One fetch the way api.c makes it */
+static double bench_fetch(const char *accept, wire_format_t expected, int iterations) {
+    schedule_t schedule;
+    wire_decoder_t decoder;
+
+    hal_http_request_t request = {
+        .url = "http://localhost/syncDevice",
+        .post = true,
+        .accept = accept,
+        .on_header = decoder_header,
+        .on_data = decoder_data,
+        .user_data = &decoder
+    };
+
+    double start = now_s();
+    for (int i = 0; i < iterations; i++) {
+        wire_decoder_begin(&decoder, &schedule);
+
+        int status_code;
+        hal_http_perform(&request, &status_code);
+
+        if (wire_decoder_end(&decoder) != ESP_OK || !wire_decoder_schedule_valid(&decoder) || decoder.format != expected) {
+            fprintf(stderr, "settings_bench: decoder rejected the %s response\n", accept);
+            exit(1);
+        }
+    }
+
+    return (now_s() - start) / iterations;
+}
+
+#ifdef HAVE_CJSON
+
+static size_t allocations;
+static size_t allocated_bytes;
+
+static void *counting_malloc(size_t size) {
+    allocations += 1;
+    allocated_bytes += size;
+
+    return malloc(size);
+}
+
+/* The decode api.c performed before wire_json */
+static bool cjson_decode(const char *json, schedule_t *schedule) {
+    cJSON *root = cJSON_Parse(json);
+    if (root == NULL) {
+        return false;
+    }
+
+    timezone_t timezone;
+    timezone_init_fixed(&timezone, -(int32_t) cJSON_GetObjectItem(root, "time_zone")->valuedouble * 3600);
+
+    timezone_t utc_offsets = { 0 };
+    cJSON *utc_offset;
+    cJSON_ArrayForEach(utc_offset, cJSON_GetObjectItem(root, "utc_offsets")) {
+        timezone_add_transition(&utc_offsets,
+                                (uint32_t) cJSON_GetObjectItem(utc_offset, "start")->valuedouble,
+                                (int32_t) cJSON_GetObjectItem(utc_offset, "offset")->valuedouble);
+    }
+
+    schedule_init(schedule, utc_offsets.length > 0 ? &utc_offsets : &timezone);
+
+    cJSON *times = cJSON_GetObjectItem(root, "times");
+    cJSON *sig_rains = cJSON_GetObjectItem(root, "sig_rains");
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        cJSON *day_json = cJSON_GetArrayItem(times, day);
+        int length = cJSON_GetArraySize(day_json);
+
+        uint32_t *day_times = malloc(length * sizeof(uint32_t));
+        for (int i = 0; i < length; i++) {
+            day_times[i] = (uint32_t) cJSON_GetArrayItem(day_json, i)->valuedouble;
+        }
+        schedule_set_day_times(schedule, day, day_times, length);
+        free(day_times);
+
+        schedule->sig_rains[day] = cJSON_IsTrue(cJSON_GetArrayItem(sig_rains, day));
+    }
+
+    cJSON_Delete(root);
+
+    return true;
+}
+
+static double bench_cjson(const char *json, int iterations) {
+    cJSON_Hooks hooks = { counting_malloc, free };
+    cJSON_InitHooks(&hooks);
+
+    schedule_t schedule;
+
+    double start = now_s();
+    for (int i = 0; i < iterations; i++) {
+        if (!cjson_decode(json, &schedule)) {
+            fprintf(stderr, "settings_bench: cJSON rejected the response\n");
+            exit(1);
+        }
+    }
+
+    return (now_s() - start) / iterations;
+}
+
+#endif
+
+static void usage() {
+    fprintf(stderr, "usage: settings_bench [-i iterations] [-c chunk_bytes]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 100000;
+    size_t chunk_length = 512;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "i:c:")) != -1) {
+        switch (opt) {
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            case 'c':
+                chunk_length = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (iterations <= 0 || chunk_length == 0) {
+        usage();
+    }
+
+    settings_server_zone_t zone;
+    representative_zone(&zone);
+    settings_server_set_zone(&zone);
+    settings_server_set_chunk_length(chunk_length);
+    hal_linux_set_http_handler(settings_server_handle);
+
+    printf("fed in %u byte chunks, %d iterations, %u bytes of decoder state, no heap (was a %d byte response buffer)\n",
+           (unsigned) chunk_length, iterations, (unsigned) sizeof(wire_decoder_t), OLD_RESPONSE_BUFFER);
+
+    double json_s = bench_fetch(WIRE_CONTENT_TYPE_JSON, WIRE_FORMAT_JSON, iterations);
+    printf("json:      %4u bytes, %8.2f us/response\n", (unsigned) settings_server_last_body_length(), json_s * 1e6);
+
+    double binary_s = bench_fetch(WIRE_ACCEPT, WIRE_FORMAT_BINARY, iterations);
+    printf("binary:    %4u bytes, %8.2f us/response\n", (unsigned) settings_server_last_body_length(), binary_s * 1e6);
+
+#ifdef HAVE_CJSON
+    char json[SETTINGS_SERVER_MAX_BODY];
+    settings_server_format_json(&zone, json, sizeof(json));
+
+    double cjson_s = bench_cjson(json, iterations);
+    printf("cJSON:     %4u bytes, %8.2f us/response, %u allocations and %u bytes of heap per response, plus the buffer\n",
+           (unsigned) strlen(json), cjson_s * 1e6, (unsigned) (allocations / iterations), (unsigned) (allocated_bytes / iterations));
+#else
+    printf("cJSON:     not installed on this host; comparison skipped\n");
+#endif
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "settings_server.h"
+#include "wire.h"
+
+// Both bodies are rendered when the zone is set, so requests only cost the decode
+static char json_body[SETTINGS_SERVER_MAX_BODY];
+static size_t json_body_length = 0;
+static char binary_body[SETTINGS_SERVER_MAX_BODY];
+static size_t binary_body_length = 0;
+static char json_etag[16];
+static char binary_etag[16];
+
+static time_t date = 0;
+static size_t chunk_length = 512;
+static bool json_only = false;
+static size_t last_body_length = 0;
+static int last_status_code = 0;
+
+void settings_server_set_chunk_length(size_t length) {
+    chunk_length = length;
+}
+
+void settings_server_set_date(time_t new_date) {
+    date = new_date;
+}
+
+void settings_server_set_json_only(bool new_json_only) {
+    json_only = new_json_only;
+}
+
+size_t settings_server_format_json(const settings_server_zone_t *zone, char *body, size_t capacity) {
+    size_t length = snprintf(body, capacity, "{\"time_zone\":%d,\"times\":[", (int) zone->time_zone);
+
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        length += snprintf(body + length, capacity - length, day == 0 ? "[" : ",[");
+        for (int i = 0; i < zone->day_times_length[day]; i++) {
+            length += snprintf(body + length, capacity - length, i == 0 ? "%u" : ",%u", zone->day_times[day][i]);
+        }
+        length += snprintf(body + length, capacity - length, "]");
+    }
+
+    length += snprintf(body + length, capacity - length, "],\"sig_rains\":[");
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        const char *sig_rain = zone->sig_rains[day] ? "true" : "false";
+        length += snprintf(body + length, capacity - length, day == 0 ? "%s" : ",%s", sig_rain);
+    }
+
+    length += snprintf(body + length, capacity - length, "],\"utc_offsets\":[");
+    for (int i = 0; i < zone->utc_offsets.length; i++) {
+        const timezone_transition_t *transition = &zone->utc_offsets.transitions[i];
+        length += snprintf(body + length, capacity - length, "%s{\"start\":%u,\"offset\":%d}",
+                           i == 0 ? "" : ",", transition->start, (int) transition->offset);
+    }
+
+    return length + snprintf(body + length, capacity - length, "]}");
+}
+
+static void put_varint(char *body, size_t *length, uint32_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        body[(*length)++] = (char) (value != 0 ? byte | 0x80 : byte);
+    } while (value != 0);
+}
+
+static void put_zigzag(char *body, size_t *length, int32_t value) {
+    put_varint(body, length, ((uint32_t) value << 1) ^ (uint32_t) (value >> 31));
+}
+
+size_t settings_server_format_binary(const settings_server_zone_t *zone, char *body, size_t capacity) {
+    // Worst case: 5 bytes per varint
+    if (capacity < 8 + SCHEDULE_DAYS * (5 + SCHEDULE_MAX_DAY_TIMES * 5) + 5 + TIMEZONE_MAX_TRANSITIONS * 10) {
+        return 0;
+    }
+
+    size_t length = 0;
+    body[length++] = WIRE_BINARY_MAGIC;
+    body[length++] = WIRE_BINARY_VERSION;
+    put_zigzag(body, &length, zone->time_zone);
+
+    uint8_t sig_rains = 0;
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        sig_rains |= zone->sig_rains[day] << day;
+    }
+    body[length++] = (char) sig_rains;
+
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        put_varint(body, &length, zone->day_times_length[day]);
+
+        uint32_t previous = 0;
+        for (int i = 0; i < zone->day_times_length[day]; i++) {
+            put_zigzag(body, &length, (int32_t) (zone->day_times[day][i] - previous));
+            previous = zone->day_times[day][i];
+        }
+    }
+
+    put_varint(body, &length, zone->utc_offsets.length);
+
+    uint32_t previous = 0;
+    for (int i = 0; i < zone->utc_offsets.length; i++) {
+        const timezone_transition_t *transition = &zone->utc_offsets.transitions[i];
+        put_varint(body, &length, transition->start - previous);
+        put_zigzag(body, &length, transition->offset);
+        previous = transition->start;
+    }
+
+    return length;
+}
+
+void settings_server_set_zone(const settings_server_zone_t *zone) {
+    json_body_length = settings_server_format_json(zone, json_body, sizeof(json_body));
+    binary_body_length = settings_server_format_binary(zone, binary_body, sizeof(binary_body));
+
+    // Each representation gets its own strong ETag
+    snprintf(json_etag, sizeof(json_etag), "\"%08x\"", checksum_crc32(CHECKSUM_CRC32_INIT, json_body, json_body_length));
+    snprintf(binary_etag, sizeof(binary_etag), "\"%08x\"",
+             checksum_crc32(CHECKSUM_CRC32_INIT, binary_body, binary_body_length));
+}
+
+esp_err_t settings_server_handle(const hal_http_request_t *request, int *status_code) {
+    bool binary = !json_only && request->accept != NULL && strstr(request->accept, WIRE_CONTENT_TYPE_BINARY) != NULL;
+
+    const char *body = binary ? binary_body : json_body;
+    size_t body_length = binary ? binary_body_length : json_body_length;
+    const char *etag = binary ? binary_etag : json_etag;
+
+    if (request->if_none_match != NULL && strcmp(request->if_none_match, etag) == 0) {
+        body_length = 0;
+        *status_code = 304;
+    } else {
+        *status_code = 200;
+    }
+
+    last_body_length = body_length;
+    last_status_code = *status_code;
+
+    if (request->on_status != NULL) {
+        request->on_status(request->user_data, *status_code);
+    }
+
+    if (request->on_header != NULL) {
+        if (date != 0) {
+            char value[32];
+            strftime(value, sizeof(value), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&date));
+            request->on_header(request->user_data, "Date", value);
+        }
+
+        request->on_header(request->user_data, "ETag", etag);
+        if (*status_code == 200) {
+            request->on_header(request->user_data, "Content-Type",
+                               binary ? WIRE_CONTENT_TYPE_BINARY : WIRE_CONTENT_TYPE_JSON);
+        }
+    }
+
+    for (size_t offset = 0; offset < body_length && request->on_data != NULL; offset += chunk_length) {
+        size_t length = body_length - offset < chunk_length ? body_length - offset : chunk_length;
+        request->on_data(request->user_data, body + offset, length);
+    }
+
+    return ESP_OK;
+}
+
+size_t settings_server_last_body_length() {
+    return last_body_length;
+}
+
+int settings_server_last_status_code() {
+    return last_status_code;
+}
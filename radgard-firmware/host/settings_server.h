@@ -0,0 +1,51 @@
+#ifndef __SETTINGS_SERVER_H__
+#define __SETTINGS_SERVER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "hal.h"
+#include "schedule.h"
+#include "timezone.h"
+
+/* Stand-in for syncDevice behind the Linux HAL. It answers in
+ * the binary encoding when the request accepts it and in JSON otherwise,
+ * streaming the body through on_data in chunks like the real client. Every
+ * response carries an ETag, and a matching If-None-Match gets a bodiless 304.
+ * Responses carry a Date once one is set. */
+
+typedef struct {
+    int32_t time_zone; // whole hours behind UTC
+    uint8_t day_times_length[SCHEDULE_DAYS];
+    uint32_t day_times[SCHEDULE_DAYS][SCHEDULE_MAX_DAY_TIMES];
+    bool sig_rains[SCHEDULE_DAYS];
+    timezone_t utc_offsets; // length 0 when the zone has no transitions
+} settings_server_zone_t;
+
+#define SETTINGS_SERVER_MAX_BODY 2048
+
+void settings_server_set_zone(const settings_server_zone_t *zone);
+
+void settings_server_set_chunk_length(size_t length);
+
+// The server's clock for the next responses' Date header; 0 leaves it out
+void settings_server_set_date(time_t date);
+
+// Ignore Accept and always answer in JSON, like the server before the binary encoding
+void settings_server_set_json_only(bool json_only);
+
+size_t settings_server_format_json(const settings_server_zone_t *zone, char *body, size_t capacity);
+
+size_t settings_server_format_binary(const settings_server_zone_t *zone, char *body, size_t capacity);
+
+// A hal_linux_http_handler_t
+esp_err_t settings_server_handle(const hal_http_request_t *request, int *status_code);
+
+// Body bytes of the last response
+size_t settings_server_last_body_length();
+
+int settings_server_last_status_code();
+
+#endif
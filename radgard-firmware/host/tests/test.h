@@ -0,0 +1,43 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Minimal checks for the host tests. A failed check reports where it failed
+ * and the test goes on; the executable exits nonzero if any check failed, so
+ * ctest counts it as failed. */
+
+static int test_failures = 0;
+
+#define TEST_CHECK(condition)                                                  \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,   \
+                    #condition);                                               \
+            test_failures += 1;                                                \
+        }                                                                      \
+    } while (0)
+
+#define TEST_CHECK_EQUAL(expected, actual)                                     \
+    do {                                                                       \
+        long long expected_value = (long long) (expected);                     \
+        long long actual_value = (long long) (actual);                         \
+        if (expected_value != actual_value) {                                  \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__,    \
+                    __LINE__, #actual, actual_value, expected_value);          \
+            test_failures += 1;                                                \
+        }                                                                      \
+    } while (0)
+
+#define TEST_RUN(test)                                                         \
+    do {                                                                       \
+        int failures_before = test_failures;                                   \
+        test();                                                                \
+        printf("%s %s\n", test_failures == failures_before ? "ok  " : "FAIL",  \
+               #test);                                                         \
+    } while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? 0 : 1)
+
+#endif
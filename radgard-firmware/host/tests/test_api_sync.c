@@ -0,0 +1,214 @@
+/*
+    Tests for api_sync's conditional fetch, run through device_wake's daily
+    fetches with the settings server behind a recording HTTP backend: the
+    first fetch stores the ETag, the next is answered 304 without touching
+    NVS, and consuming a sig_rains flag makes the one after unconditional.
+    The request must also report the running build's version, and a reply
+    whose Date cannot be parsed must leave the clock alone.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "hal_linux.h"
+#include "api.h"
+#include "clock.h"
+#include "device.h"
+#include "settings.h"
+#include "schedule.h"
+#include "settings_server.h"
+
+#include "test.h"
+
+// A Monday in UTC; the zone is on UTC too
+#define MONDAY 1767571200
+#define DAY 86400
+#define FETCH_TIME 5400
+#define RAIN_DAY 2
+
+typedef struct {
+    int requests;
+    bool conditional;
+    char body[256];
+    char if_none_match[SETTINGS_ETAG_LENGTH];
+    char etag[SETTINGS_ETAG_LENGTH];
+    int status_code;
+    const char *date; // replaces the server's Date header when set
+    time_t server_time;
+    hal_linux_kv_stats_t kv_before;
+    hal_linux_kv_stats_t kv_after;
+} backend_t;
+
+static backend_t backend;
+
+static hal_http_header_cb_t client_on_header;
+
+static void record_header(void *user_data, const char *key, const char *value) {
+    if (strcmp(key, "ETag") == 0) {
+        strncpy(backend.etag, value, sizeof(backend.etag) - 1);
+    } else if (strcmp(key, "Date") == 0 && backend.date != NULL) {
+        value = backend.date;
+    }
+
+    client_on_header(user_data, key, value);
+}
+
+static esp_err_t record_request(const hal_http_request_t *request, int *status_code) {
+    backend.requests += 1;
+    backend.conditional = request->if_none_match != NULL;
+    strncpy(backend.if_none_match, backend.conditional ? request->if_none_match : "", sizeof(backend.if_none_match) - 1);
+    if (request->body_length < sizeof(backend.body)) {
+        memcpy(backend.body, request->body, request->body_length);
+    }
+
+    hal_http_request_t forwarded = *request;
+    client_on_header = request->on_header;
+    forwarded.on_header = record_header;
+
+    esp_err_t err = settings_server_handle(&forwarded, status_code);
+    backend.status_code = *status_code;
+
+    return err;
+}
+
+static void sync_online() {
+    hal_linux_kv_get_stats(&backend.kv_before);
+
+    api_firmware_update_t firmware_update;
+    time_t server_time;
+    api_sync(&firmware_update, &server_time);
+    backend.server_time = server_time;
+
+    // As network_set_time does; without a server time it falls back to SNTP, which the host lacks
+    if (server_time != 0) {
+        clock_sync(server_time);
+    }
+
+    hal_linux_kv_get_stats(&backend.kv_after);
+}
+
+// A timer wake at the 01:30 fetch of this week's `weekday`, Sunday being 0
+static void fetch_wake_with_date(int weekday, const char *date) {
+    memset(&backend, 0, sizeof(backend));
+    backend.date = date;
+
+    hal_linux_set_time(MONDAY + (weekday - 1) * DAY + FETCH_TIME);
+    hal_linux_set_wake(HAL_WAKE_TIMER, 0);
+    hal_sleep_deep(0);
+
+    device_sleep_t sleep;
+    device_wake(sync_online, NULL, &sleep);
+
+    TEST_CHECK_EQUAL(1, backend.requests);
+}
+
+static void fetch_wake(int weekday) {
+    fetch_wake_with_date(weekday, NULL);
+}
+
+static void load_settings(radgard_settings_t *settings) {
+    TEST_CHECK_EQUAL(ESP_OK, settings_load(settings));
+}
+
+static void test_conditional_fetch() {
+    settings_server_zone_t zone;
+    memset(&zone, 0, sizeof(zone));
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        zone.day_times_length[day] = 2;
+        zone.day_times[day][0] = 6 * 3600;
+        zone.day_times[day][1] = 6 * 3600 + 1200;
+    }
+    zone.sig_rains[RAIN_DAY] = true;
+    settings_server_set_zone(&zone);
+    hal_linux_set_http_handler(record_request);
+
+    radgard_settings_t settings;
+    settings_init(&settings);
+    strcpy(settings.user_id, "user");
+    strcpy(settings.zone_id, "zone");
+    settings_save(&settings);
+
+    // Monday: nothing to match yet, so the schedule and its ETag are stored
+    fetch_wake(1);
+    TEST_CHECK(!backend.conditional);
+    TEST_CHECK_EQUAL(200, backend.status_code);
+
+    load_settings(&settings);
+    TEST_CHECK(settings.has_schedule);
+    TEST_CHECK(backend.etag[0] != '\0');
+    TEST_CHECK(strcmp(backend.etag, settings.schedule_etag) == 0);
+    TEST_CHECK_EQUAL(1, settings.schedule.sig_rains[RAIN_DAY]);
+
+    // Tuesday: the stored ETag still matches, and a 304 writes nothing
+    fetch_wake(RAIN_DAY);
+    TEST_CHECK(backend.conditional);
+    TEST_CHECK(strcmp(settings.schedule_etag, backend.if_none_match) == 0);
+    TEST_CHECK_EQUAL(304, backend.status_code);
+    TEST_CHECK_EQUAL(backend.kv_before.writes, backend.kv_after.writes);
+    TEST_CHECK_EQUAL(backend.kv_before.erases, backend.kv_after.erases);
+    TEST_CHECK_EQUAL(backend.kv_before.bytes_written, backend.kv_after.bytes_written);
+
+    // The wake then consumed Tuesday's sig_rains flag, so the ETag no longer describes the schedule
+    load_settings(&settings);
+    TEST_CHECK_EQUAL(0, settings.schedule.sig_rains[RAIN_DAY]);
+    TEST_CHECK(settings.schedule_etag[0] == '\0');
+
+    // Wednesday: unconditional, and the server's schedule and ETag are stored again
+    fetch_wake(RAIN_DAY + 1);
+    TEST_CHECK(!backend.conditional);
+    TEST_CHECK_EQUAL(200, backend.status_code);
+
+    load_settings(&settings);
+    TEST_CHECK_EQUAL(1, settings.schedule.sig_rains[RAIN_DAY]);
+    TEST_CHECK(strcmp(backend.etag, settings.schedule_etag) == 0);
+}
+
+// A build booted from a background download reports its own version, not the one before it
+static void test_reports_running_version() {
+    radgard_settings_t settings;
+    load_settings(&settings);
+    settings.firmware_version = SETTINGS_FIRMWARE_VERSION - 1;
+    settings_save(&settings);
+
+    fetch_wake(4);
+
+    char expected[32];
+    snprintf(expected, sizeof(expected), "\"version\":\"%d\"", SETTINGS_FIRMWARE_VERSION);
+    TEST_CHECK(strstr(backend.body, expected) != NULL);
+
+    load_settings(&settings);
+    TEST_CHECK_EQUAL(SETTINGS_FIRMWARE_VERSION, settings.firmware_version);
+}
+
+// A Date that does not parse must not reach the clock as 0, which would set it to 1970
+static void test_malformed_date_keeps_clock() {
+    time_t fetch_time = MONDAY + 4 * DAY + FETCH_TIME;
+
+    // The server's clock runs a minute ahead of the device's
+    settings_server_set_date(fetch_time + 60);
+    fetch_wake(5);
+    TEST_CHECK_EQUAL(fetch_time + 60, backend.server_time);
+    TEST_CHECK(hal_clock_now() >= fetch_time + 60);
+
+    const char *malformed[] = { "Fri, 09 Jan 2026 01:31:00", "Friday, 09-Jan-26 01:31:00 GMT", "" };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++) {
+        fetch_wake_with_date(6, malformed[i]);
+        TEST_CHECK_EQUAL(0, backend.server_time);
+
+        // Only the wake's own running time has passed
+        uint32_t now = hal_clock_now();
+        TEST_CHECK(now >= MONDAY + 5 * DAY + FETCH_TIME && now < MONDAY + 5 * DAY + FETCH_TIME + 60);
+    }
+
+    settings_server_set_date(0);
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_conditional_fetch);
+    TEST_RUN(test_reports_running_version);
+    TEST_RUN(test_malformed_date_keeps_clock);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,221 @@
+/*
+    Round trips through the patch generator and the firmware's patcher, with
+    memory standing in for the partitions: the rebuilt image must match the
+    new one byte for byte and by SHA-256 whatever chunks the patch arrives
+    in, and patches for another image or cut short must be rejected.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal_linux.h"
+#include "checksum.h"
+#include "delta.h"
+#include "delta_diff.h"
+
+#include "test.h"
+
+#define OLD_LENGTH 65536
+#define NEW_MAX_LENGTH (OLD_LENGTH + 4096)
+
+static uint8_t old_image[OLD_LENGTH];
+static uint8_t new_image[NEW_MAX_LENGTH];
+static size_t new_length;
+
+static uint8_t *patch;
+static size_t patch_length;
+
+typedef struct {
+    const uint8_t *source;
+    size_t source_length;
+    uint8_t target[NEW_MAX_LENGTH];
+    size_t target_length;
+} partitions_t;
+
+static partitions_t partitions;
+
+static esp_err_t read_partition(void *user_data, uint32_t offset, uint8_t *data, size_t length) {
+    partitions_t *partitions = user_data;
+
+    if (offset + length > partitions->source_length) {
+        return ESP_FAIL;
+    }
+
+    memcpy(data, partitions->source + offset, length);
+
+    return ESP_OK;
+}
+
+static esp_err_t write_partition(void *user_data, const uint8_t *data, size_t length) {
+    partitions_t *partitions = user_data;
+
+    if (partitions->target_length + length > NEW_MAX_LENGTH) {
+        return ESP_FAIL;
+    }
+
+    memcpy(partitions->target + partitions->target_length, data, length);
+    partitions->target_length += length;
+
+    return ESP_OK;
+}
+
+static void append(const uint8_t *data, size_t length) {
+    memcpy(new_image + new_length, data, length);
+    new_length += length;
+}
+
+static void append_random(size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        new_image[new_length++] = (uint8_t) rand();
+    }
+}
+
+// An update's worth of changes: a moved function, changed constants, inserted and removed code
+static void make_images() {
+    srand(22);
+    for (size_t i = 0; i < OLD_LENGTH; i++) {
+        old_image[i] = (uint8_t) rand();
+    }
+
+    new_length = 0;
+    append(old_image, 10000);
+    append(old_image + 50000, 2000);
+    append(old_image + 10000, 10000);
+    append_random(300);
+    append(old_image + 20000, 20000);
+    append(old_image + 40500, 9500);
+    append(old_image + 52000, OLD_LENGTH - 52000);
+    append_random(1000);
+
+    for (size_t i = 100; i < new_length; i += 997) {
+        new_image[i] += 1;
+    }
+
+    patch = malloc(delta_diff_max_length(new_length));
+    patch_length = delta_diff(old_image, OLD_LENGTH, new_image, new_length, patch);
+}
+
+/* Feeds `length` bytes of `data` in chunks of `chunk_length`, or of 1 to 64
+ * bytes at random when it is 0, and returns the patcher's verdict */
+static esp_err_t apply(const uint8_t *source, const uint8_t *data, size_t length, size_t chunk_length, esp_err_t *feed_err) {
+    partitions.source = source;
+    partitions.source_length = OLD_LENGTH;
+    partitions.target_length = 0;
+
+    delta_io_t io = { .read_source = read_partition, .write_target = write_partition, .user_data = &partitions };
+
+    delta_patcher_t patcher;
+    delta_patcher_begin(&patcher);
+
+    *feed_err = ESP_OK;
+    for (size_t offset = 0; offset < length && *feed_err == ESP_OK;) {
+        size_t take = chunk_length > 0 ? chunk_length : 1 + (size_t) rand() % 64;
+        take = take < length - offset ? take : length - offset;
+
+        *feed_err = delta_patcher_feed(&patcher, &io, data + offset, take);
+        offset += take;
+    }
+
+    return delta_patcher_end(&patcher);
+}
+
+static void check_rebuilt() {
+    TEST_CHECK_EQUAL(new_length, partitions.target_length);
+    TEST_CHECK(memcmp(new_image, partitions.target, new_length) == 0);
+
+    uint8_t expected[CHECKSUM_SHA256_LENGTH], actual[CHECKSUM_SHA256_LENGTH];
+    checksum_sha256_t sha;
+    checksum_sha256_begin(&sha);
+    checksum_sha256_update(&sha, new_image, new_length);
+    checksum_sha256_end(&sha, expected);
+
+    checksum_sha256_begin(&sha);
+    checksum_sha256_update(&sha, partitions.target, partitions.target_length);
+    checksum_sha256_end(&sha, actual);
+
+    TEST_CHECK(memcmp(expected, actual, CHECKSUM_SHA256_LENGTH) == 0);
+}
+
+static void test_round_trip() {
+    esp_err_t feed_err;
+    TEST_CHECK_EQUAL(ESP_OK, apply(old_image, patch, patch_length, 1024, &feed_err));
+    TEST_CHECK_EQUAL(ESP_OK, feed_err);
+    check_rebuilt();
+
+    // The patch carries the changes, not the image
+    TEST_CHECK(patch_length < new_length / 4);
+}
+
+// Varints, the header and byte runs split across chunks carry over to the next one
+static void test_chunk_splits() {
+    const size_t chunk_lengths[] = { 1, 2, 3, 7, DELTA_HEADER_LENGTH - 1, DELTA_HEADER_LENGTH + 1, 4096 };
+
+    for (size_t i = 0; i < sizeof(chunk_lengths) / sizeof(chunk_lengths[0]); i++) {
+        esp_err_t feed_err;
+        TEST_CHECK_EQUAL(ESP_OK, apply(old_image, patch, patch_length, chunk_lengths[i], &feed_err));
+        check_rebuilt();
+    }
+
+    srand(23);
+    for (int round = 0; round < 20; round++) {
+        esp_err_t feed_err;
+        TEST_CHECK_EQUAL(ESP_OK, apply(old_image, patch, patch_length, 0, &feed_err));
+        check_rebuilt();
+    }
+}
+
+static void test_corrupted_source_rejected() {
+    static uint8_t corrupted[OLD_LENGTH];
+    memcpy(corrupted, old_image, OLD_LENGTH);
+    corrupted[OLD_LENGTH / 2] ^= 0x01;
+
+    esp_err_t feed_err;
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_CRC, apply(corrupted, patch, patch_length, 1024, &feed_err));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_CRC, feed_err);
+
+    // Checked before the first record, so nothing was written
+    TEST_CHECK_EQUAL(0, partitions.target_length);
+}
+
+static void test_truncated_patch_rejected() {
+    const size_t lengths[] = { 10, DELTA_HEADER_LENGTH, DELTA_HEADER_LENGTH + 1, patch_length / 2, patch_length - 1 };
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        esp_err_t feed_err;
+        TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, apply(old_image, patch, lengths[i], 1024, &feed_err));
+        TEST_CHECK_EQUAL(ESP_OK, feed_err);
+    }
+}
+
+static void test_corrupted_patch_rejected() {
+    uint8_t *corrupted = malloc(patch_length + 1);
+    memcpy(corrupted, patch, patch_length);
+
+    // Past the end of the records
+    corrupted[patch_length] = 0;
+    esp_err_t feed_err;
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, apply(old_image, corrupted, patch_length + 1, 1024, &feed_err));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, feed_err);
+
+    // A changed byte of new code is only caught by the new image's SHA-256
+    corrupted[patch_length - 1] ^= 0x01;
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_CRC, apply(old_image, corrupted, patch_length, 1024, &feed_err));
+
+    free(corrupted);
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    make_images();
+
+    TEST_RUN(test_round_trip);
+    TEST_RUN(test_chunk_splits);
+    TEST_RUN(test_corrupted_source_rejected);
+    TEST_RUN(test_truncated_patch_rejected);
+    TEST_RUN(test_corrupted_patch_rejected);
+
+    free(patch);
+
+    return TEST_RESULT();
+}
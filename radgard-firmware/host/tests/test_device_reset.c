@@ -0,0 +1,102 @@
+/*
+    Tests that a factory reset from the RST button leaves nothing behind in
+    RTC memory that would keep the valve running: after the reset and the
+    restart's power-on boot, the old schedule's next open is not actuated
+    and neither the wake stub nor timer wakes can find a schedule.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "hal_linux.h"
+#include "settings.h"
+#include "schedule.h"
+#include "device.h"
+#include "board.h"
+
+#include "test.h"
+
+// A Monday in UTC; the zone is on UTC too
+#define MONDAY 1767571200
+#define DAY 86400
+#define OPEN_TIME (6 * 3600)
+#define CLOSE_TIME (6 * 3600 + 1200)
+
+static int online_wakes;
+
+static void go_online() {
+    online_wakes += 1;
+}
+
+static void wake(hal_wake_cause_t cause, uint64_t gpio_mask, uint32_t now) {
+    hal_linux_set_time(now);
+    hal_linux_set_wake(cause, gpio_mask);
+    hal_sleep_deep(0);
+
+    device_sleep_t sleep;
+    device_wake(go_online, NULL, &sleep);
+}
+
+static void store_schedule() {
+    timezone_t timezone;
+    timezone_init_fixed(&timezone, 0);
+
+    radgard_settings_t settings;
+    settings_init(&settings);
+    schedule_init(&settings.schedule, &timezone);
+
+    const uint32_t day_times[] = { OPEN_TIME, CLOSE_TIME };
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        schedule_set_day_times(&settings.schedule, day, day_times, 2);
+    }
+
+    settings.has_schedule = true;
+    settings_save(&settings);
+    schedule_cache_store(&settings.schedule);
+}
+
+static void test_reset_forgets_schedule() {
+    store_schedule();
+
+    // Monday's open and close run from the cached schedule
+    wake(HAL_WAKE_TIMER, 0, MONDAY + 5400);
+    wake(HAL_WAKE_TIMER, 0, MONDAY + OPEN_TIME);
+    TEST_CHECK_EQUAL(1, hal_linux_gpio_level(BOARD_GPIO_S_OPEN));
+    wake(HAL_WAKE_TIMER, 0, MONDAY + CLOSE_TIME);
+    TEST_CHECK_EQUAL(0, hal_linux_gpio_level(BOARD_GPIO_S_OPEN));
+    TEST_CHECK(schedule_cache_peek() != NULL);
+
+    // The reset restarts into a power-on boot, which finds no settings to fetch with
+    wake(HAL_WAKE_GPIO, 1ULL << BOARD_GPIO_RST, MONDAY + CLOSE_TIME + 600);
+    TEST_CHECK_EQUAL(HAL_WAKE_POWER_ON, hal_sleep_wake_cause());
+
+    online_wakes = 0;
+    device_sleep_t sleep;
+    device_wake(go_online, NULL, &sleep);
+    TEST_CHECK(schedule_cache_peek() == NULL);
+
+    // Through Tuesday's open and close, every wake goes online and none actuates
+    int wakes = 0;
+    int opens = 0;
+    while (hal_clock_now() < MONDAY + DAY + CLOSE_TIME + 3600) {
+        hal_sleep_deep(sleep.time_us);
+        device_wake(go_online, NULL, &sleep);
+
+        wakes += 1;
+        opens += hal_linux_gpio_level(BOARD_GPIO_S_OPEN);
+        // Nor could the wake stub, which only runs on a cached schedule
+        TEST_CHECK(schedule_cache_peek() == NULL);
+    }
+
+    TEST_CHECK(wakes > 0);
+    TEST_CHECK_EQUAL(0, opens);
+    TEST_CHECK_EQUAL(wakes + 1, online_wakes);
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_reset_forgets_schedule);
+
+    return TEST_RESULT();
+}
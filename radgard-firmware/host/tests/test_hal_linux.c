@@ -0,0 +1,164 @@
+/*
+    Tests for the Linux HAL backend the host build and its tools run on
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "hal_linux.h"
+
+#include "test.h"
+
+static void test_clock_moves_only_with_delays_and_sleep() {
+    hal_linux_set_time(1700000000);
+    int64_t start_us = hal_clock_monotonic_us();
+
+    TEST_CHECK_EQUAL(1700000000, hal_clock_now());
+
+    hal_delay_ms(2500);
+    TEST_CHECK_EQUAL(start_us + 2500000, hal_clock_monotonic_us());
+    TEST_CHECK_EQUAL(1700000002, hal_clock_now());
+
+    // Deep sleep advances the clock and starts a new boot
+    hal_sleep_deep(60 * 1000000ULL);
+    TEST_CHECK_EQUAL(0, hal_clock_monotonic_us());
+    TEST_CHECK_EQUAL(1700000062, hal_clock_now());
+    TEST_CHECK_EQUAL(60 * 1000000LL, hal_linux_last_sleep_us());
+    TEST_CHECK_EQUAL(HAL_WAKE_TIMER, hal_sleep_wake_cause());
+}
+
+static void test_wake_cause_override_lasts_one_wake() {
+    hal_linux_set_wake(HAL_WAKE_GPIO, 1ULL << 32);
+    hal_sleep_deep(1000);
+    TEST_CHECK_EQUAL(HAL_WAKE_GPIO, hal_sleep_wake_cause());
+    TEST_CHECK(hal_sleep_wake_gpio_mask() == 1ULL << 32);
+
+    hal_sleep_deep(1000);
+    TEST_CHECK_EQUAL(HAL_WAKE_TIMER, hal_sleep_wake_cause());
+    TEST_CHECK(hal_sleep_wake_gpio_mask() == 0);
+
+    hal_restart();
+    TEST_CHECK_EQUAL(HAL_WAKE_POWER_ON, hal_sleep_wake_cause());
+}
+
+static void test_rtc_drift_over_deep_sleep() {
+    hal_linux_set_time(1700000000);
+    hal_linux_set_true_time(1700000000);
+    hal_linux_set_rtc_error_ppm(10000);
+
+    // An RTC 1% fast sleeps 1% short of real time
+    hal_sleep_deep(101 * 1000000ULL);
+    TEST_CHECK_EQUAL(1700000101, hal_clock_now());
+    TEST_CHECK_EQUAL(1700000100, hal_linux_true_time());
+
+    // A matching correction takes the drift out again
+    hal_clock_set_rtc_correction(10000);
+    hal_sleep_deep(100 * 1000000ULL);
+    TEST_CHECK_EQUAL(1700000200, hal_linux_true_time());
+
+    hal_clock_set_rtc_correction(0);
+    hal_linux_set_rtc_error_ppm(0);
+}
+
+static void test_gpio_hold_latches_level() {
+    hal_gpio_set_level(18, 1);
+    TEST_CHECK_EQUAL(1, hal_linux_gpio_level(18));
+
+    hal_gpio_hold(18, true);
+    hal_gpio_set_level(18, 0);
+    TEST_CHECK_EQUAL(1, hal_linux_gpio_level(18));
+
+    hal_gpio_hold(18, false);
+    hal_gpio_set_level(18, 0);
+    TEST_CHECK_EQUAL(0, hal_linux_gpio_level(18));
+}
+
+static void test_kv_values_round_trip() {
+    hal_kv_erase_all();
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_init());
+
+    hal_kv_handle_t handle;
+    TEST_CHECK_EQUAL(ESP_ERR_NVS_NOT_FOUND, hal_kv_open("test", false, &handle));
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_open("test", true, &handle));
+
+    const uint8_t blob[] = { 1, 2, 3, 4, 5 };
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_set_u8(handle, "u8", 7));
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_set_u32(handle, "u32", 123456789));
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_set_str(handle, "str", "radgard"));
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_set_blob(handle, "blob", blob, sizeof(blob)));
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_commit(handle));
+    hal_kv_close(handle);
+
+    // Values survive a deinit, as NVS survives deep sleep
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_deinit());
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_init());
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_open("test", false, &handle));
+
+    uint8_t u8 = 0;
+    uint32_t u32 = 0;
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_get_u8(handle, "u8", &u8));
+    TEST_CHECK_EQUAL(7, u8);
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_get_u32(handle, "u32", &u32));
+    TEST_CHECK_EQUAL(123456789, u32);
+
+    size_t size = 0;
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_get_str(handle, "str", NULL, &size));
+    TEST_CHECK_EQUAL(8, size);
+
+    char str[8];
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_get_str(handle, "str", str, &size));
+    TEST_CHECK(strcmp(str, "radgard") == 0);
+
+    uint8_t small[2];
+    size = sizeof(small);
+    TEST_CHECK_EQUAL(ESP_ERR_NVS_INVALID_LENGTH, hal_kv_get_blob(handle, "blob", small, &size));
+    TEST_CHECK_EQUAL(sizeof(blob), size);
+
+    uint8_t read[sizeof(blob)];
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_get_blob(handle, "blob", read, &size));
+    TEST_CHECK(memcmp(read, blob, sizeof(blob)) == 0);
+
+    // Types are not interchangeable, and a read-only handle cannot write
+    TEST_CHECK_EQUAL(ESP_ERR_NVS_NOT_FOUND, hal_kv_get_u8(handle, "u32", &u8));
+    TEST_CHECK_EQUAL(ESP_ERR_NVS_READ_ONLY, hal_kv_set_u8(handle, "u8", 1));
+    hal_kv_close(handle);
+}
+
+static void test_kv_erase_and_stats() {
+    hal_kv_erase_all();
+    hal_kv_init();
+
+    hal_linux_kv_stats_t before, after;
+    hal_linux_kv_get_stats(&before);
+
+    hal_kv_handle_t handle;
+    hal_kv_open("test", true, &handle);
+    hal_kv_set_u32(handle, "a", 1);
+    hal_kv_set_str(handle, "b", "xyz");
+    TEST_CHECK_EQUAL(ESP_OK, hal_kv_erase_key(handle, "a"));
+    TEST_CHECK_EQUAL(ESP_ERR_NVS_NOT_FOUND, hal_kv_erase_key(handle, "a"));
+    hal_kv_commit(handle);
+    hal_kv_close(handle);
+
+    hal_linux_kv_get_stats(&after);
+    TEST_CHECK_EQUAL(2, after.writes - before.writes);
+    TEST_CHECK_EQUAL(4 + 4, after.bytes_written - before.bytes_written);
+    TEST_CHECK_EQUAL(1, after.erases - before.erases);
+    TEST_CHECK_EQUAL(1, after.commits - before.commits);
+
+    // A closed handle is no longer usable
+    TEST_CHECK_EQUAL(ESP_ERR_NVS_INVALID_HANDLE, hal_kv_commit(handle));
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_clock_moves_only_with_delays_and_sleep);
+    TEST_RUN(test_wake_cause_override_lasts_one_wake);
+    TEST_RUN(test_rtc_drift_over_deep_sleep);
+    TEST_RUN(test_gpio_hold_latches_level);
+    TEST_RUN(test_kv_values_round_trip);
+    TEST_RUN(test_kv_erase_and_stats);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,160 @@
+/*
+    Tests for the wake profile ring and its histogram decoder. The ring is
+    static to profile.c, so it is included here to corrupt it directly.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "hal_linux.h"
+
+#include "../../components/profile/profile.c"
+#include "../../components/profile/profile_report.c"
+
+#include "test.h"
+
+// One wake whose awake time tags it, with the settings fetch taking `fetch_ms`
+static void record_wake(uint32_t tag_ms, uint32_t fetch_ms) {
+    hal_restart();
+    profile_begin_wake(HAL_WAKE_TIMER);
+
+    profile_phase_start(PROFILE_PHASE_SETTINGS_FETCH);
+    hal_delay_ms(fetch_ms);
+    profile_phase_end(PROFILE_PHASE_SETTINGS_FETCH);
+
+    hal_delay_ms(tag_ms - fetch_ms);
+    profile_end_wake();
+}
+
+static void test_ring_wraps_keeping_the_newest() {
+    profile_reset();
+
+    for (uint32_t i = 0; i < PROFILE_RING_LENGTH + 4; i++) {
+        record_wake(100 + i, 10);
+    }
+
+    profile_wake_t wakes[PROFILE_RING_LENGTH];
+    size_t length = profile_get_wakes(wakes, PROFILE_RING_LENGTH);
+
+    TEST_CHECK_EQUAL(PROFILE_RING_LENGTH, length);
+    for (size_t i = 0; i < length; i++) {
+        TEST_CHECK_EQUAL((100 + 4 + i) * 1000, wakes[i].awake_us);
+    }
+}
+
+static void test_get_wakes_is_oldest_first() {
+    profile_reset();
+
+    for (uint32_t i = 0; i < 5; i++) {
+        record_wake(100 + i, 10);
+    }
+
+    profile_wake_t wakes[PROFILE_RING_LENGTH];
+    TEST_CHECK_EQUAL(5, profile_get_wakes(wakes, PROFILE_RING_LENGTH));
+    for (size_t i = 0; i < 5; i++) {
+        TEST_CHECK_EQUAL((100 + i) * 1000, wakes[i].awake_us);
+    }
+
+    // A short buffer gets the newest wakes, still oldest first
+    TEST_CHECK_EQUAL(2, profile_get_wakes(wakes, 2));
+    TEST_CHECK_EQUAL(103000, wakes[0].awake_us);
+    TEST_CHECK_EQUAL(104000, wakes[1].awake_us);
+
+    // Also across the wrap
+    for (uint32_t i = 5; i < PROFILE_RING_LENGTH + 3; i++) {
+        record_wake(100 + i, 10);
+    }
+    TEST_CHECK_EQUAL(3, profile_get_wakes(wakes, 3));
+    TEST_CHECK_EQUAL((100 + PROFILE_RING_LENGTH) * 1000, wakes[0].awake_us);
+    TEST_CHECK_EQUAL((100 + PROFILE_RING_LENGTH + 2) * 1000, wakes[2].awake_us);
+}
+
+static void test_crc_mismatch_resets_the_ring() {
+    profile_reset();
+
+    for (uint32_t i = 0; i < 3; i++) {
+        record_wake(100 + i, 10);
+    }
+
+    // RTC memory that lost power or holds another firmware's layout
+    ring.wakes[1].awake_us ^= 1;
+
+    profile_wake_t wakes[PROFILE_RING_LENGTH];
+    TEST_CHECK_EQUAL(0, profile_get_wakes(wakes, PROFILE_RING_LENGTH));
+
+    record_wake(200, 10);
+    TEST_CHECK_EQUAL(1, profile_get_wakes(wakes, PROFILE_RING_LENGTH));
+    TEST_CHECK_EQUAL(200000, wakes[0].awake_us);
+
+    // A head out of range is rejected even with a matching CRC
+    ring.head = PROFILE_RING_LENGTH;
+    ring.crc = ring_crc();
+    TEST_CHECK_EQUAL(0, profile_get_wakes(wakes, PROFILE_RING_LENGTH));
+}
+
+static void test_phases_accumulate_within_a_wake() {
+    profile_reset();
+    hal_restart();
+    profile_begin_wake(HAL_WAKE_TIMER);
+
+    for (int i = 0; i < 3; i++) {
+        profile_phase_start(PROFILE_PHASE_WIFI_CONNECT);
+        hal_delay_ms(7);
+        profile_phase_end(PROFILE_PHASE_WIFI_CONNECT);
+    }
+    profile_end_wake();
+
+    profile_wake_t wake;
+    TEST_CHECK_EQUAL(1, profile_get_wakes(&wake, 1));
+    TEST_CHECK_EQUAL(21000, wake.phase_us[PROFILE_PHASE_WIFI_CONNECT]);
+    TEST_CHECK_EQUAL(1 << PROFILE_PHASE_WIFI_CONNECT, wake.phases_run);
+}
+
+static void test_histogram_buckets_are_log2_ms() {
+    const uint32_t durations_us[] = { 500, 999, 1000, 1999, 2000, 3999, 4000, 1000000, 4000000000u };
+    const uint8_t expected_buckets[] = { 0, 0, 1, 1, 2, 2, 3, 10, PROFILE_HISTOGRAM_BUCKETS - 1 };
+    const size_t length = sizeof(durations_us) / sizeof(durations_us[0]);
+
+    profile_wake_t wakes[sizeof(durations_us) / sizeof(durations_us[0]) + 1];
+    memset(wakes, 0, sizeof(wakes));
+
+    for (size_t i = 0; i < length; i++) {
+        wakes[i].phases_run = 1 << PROFILE_PHASE_TIME_SYNC;
+        wakes[i].phase_us[PROFILE_PHASE_TIME_SYNC] = durations_us[i];
+    }
+    // A wake that skipped the phase is not counted, whatever its slot holds
+    wakes[length].phase_us[PROFILE_PHASE_TIME_SYNC] = 1;
+
+    profile_histogram_t histogram;
+    profile_build_histogram(wakes, length + 1, PROFILE_PHASE_TIME_SYNC, &histogram);
+
+    uint32_t expected[PROFILE_HISTOGRAM_BUCKETS] = { 0 };
+    uint64_t total_us = 0;
+    for (size_t i = 0; i < length; i++) {
+        expected[expected_buckets[i]] += 1;
+        total_us += durations_us[i];
+    }
+
+    TEST_CHECK_EQUAL(length, histogram.count);
+    TEST_CHECK_EQUAL(500, histogram.min_us);
+    TEST_CHECK_EQUAL(4000000000u, histogram.max_us);
+    TEST_CHECK_EQUAL(total_us, histogram.total_us);
+    for (int bucket = 0; bucket < PROFILE_HISTOGRAM_BUCKETS; bucket++) {
+        TEST_CHECK_EQUAL(expected[bucket], histogram.buckets[bucket]);
+    }
+
+    profile_build_histogram(wakes, length + 1, PROFILE_PHASE_NVS_INIT, &histogram);
+    TEST_CHECK_EQUAL(0, histogram.count);
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_ring_wraps_keeping_the_newest);
+    TEST_RUN(test_get_wakes_is_oldest_first);
+    TEST_RUN(test_crc_mismatch_resets_the_ring);
+    TEST_RUN(test_phases_accumulate_within_a_wake);
+    TEST_RUN(test_histogram_buckets_are_log2_ms);
+
+    return TEST_RESULT();
+}
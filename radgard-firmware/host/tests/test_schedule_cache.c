@@ -0,0 +1,179 @@
+/*
+    Tests for the RTC copy of the compiled schedule, and for the wake's
+    fallback to the NVS settings record when that copy does not check out.
+    schedule_cache.c is included to corrupt the cache directly.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "hal_linux.h"
+#include "settings.h"
+#include "storage.h"
+#include "device.h"
+#include "board.h"
+
+#include "../../components/schedule/schedule_cache.c"
+
+#include "test.h"
+
+// A Monday in UTC
+#define MONDAY 1767571200
+#define OPEN_S (6 * 3600)
+#define CLOSE_S (6 * 3600 + 1200)
+
+static int online_count;
+
+static void count_online() {
+    online_count += 1;
+}
+
+static void week_schedule(schedule_t *schedule) {
+    timezone_t timezone;
+    timezone_init_fixed(&timezone, 0);
+    schedule_init(schedule, &timezone);
+
+    const uint32_t times[] = { OPEN_S, CLOSE_S };
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        schedule_set_day_times(schedule, day, times, 2);
+    }
+}
+
+static void test_store_load_round_trip() {
+    schedule_t schedule, loaded;
+    week_schedule(&schedule);
+    schedule.sig_rains[3] = 1;
+
+    schedule_cache_store(&schedule);
+
+    memset(&loaded, 0xa5, sizeof(loaded));
+    TEST_CHECK(schedule_cache_load(&loaded));
+    TEST_CHECK(memcmp(&schedule, &loaded, sizeof(schedule_t)) == 0);
+    TEST_CHECK(schedule_cache_peek() != NULL);
+    TEST_CHECK(memcmp(schedule_cache_peek(), &schedule, sizeof(schedule_t)) == 0);
+}
+
+static void test_crc_mismatch_misses() {
+    schedule_t schedule, loaded;
+    week_schedule(&schedule);
+    schedule_cache_store(&schedule);
+
+    cache.schedule.events[1] ^= 1;
+
+    TEST_CHECK(!schedule_cache_load(&loaded));
+    TEST_CHECK(schedule_cache_peek() == NULL);
+
+    schedule_event_t event;
+    TEST_CHECK(!schedule_cache_get_next_event(&event));
+
+    schedule_cache_store(&schedule);
+    schedule_cache_invalidate();
+    TEST_CHECK(!schedule_cache_load(&loaded));
+}
+
+static void test_next_event_get_set() {
+    schedule_t schedule;
+    week_schedule(&schedule);
+
+    // Nothing to attach the event to without a valid cache
+    schedule_cache_invalidate();
+    schedule_event_t event = { .time = 1234, .action = SCHEDULE_ACTION_OPEN };
+    schedule_cache_set_next_event(&event);
+    TEST_CHECK(!schedule_cache_get_next_event(&event));
+
+    schedule_cache_store(&schedule);
+    TEST_CHECK(schedule_cache_get_next_event(&event));
+    TEST_CHECK_EQUAL(0, event.time);
+    TEST_CHECK_EQUAL(SCHEDULE_ACTION_NONE, event.action);
+
+    schedule_event_t set = { .time = MONDAY + OPEN_S, .action = SCHEDULE_ACTION_OPEN };
+    schedule_cache_set_next_event(&set);
+    TEST_CHECK(schedule_cache_get_next_event(&event));
+    TEST_CHECK_EQUAL(set.time, event.time);
+    TEST_CHECK_EQUAL(SCHEDULE_ACTION_OPEN, event.action);
+
+    // The event does not disturb the schedule's copy, and storing a new schedule clears it
+    schedule_t loaded;
+    TEST_CHECK(schedule_cache_load(&loaded));
+    TEST_CHECK(memcmp(&schedule, &loaded, sizeof(schedule_t)) == 0);
+
+    schedule_cache_store(&schedule);
+    TEST_CHECK(schedule_cache_get_next_event(&event));
+    TEST_CHECK_EQUAL(SCHEDULE_ACTION_NONE, event.action);
+}
+
+// A timer wake at Monday's open, with the schedule in NVS and in the cache
+static void prepare_open_wake(const schedule_t *schedule) {
+    hal_kv_erase_all();
+    hal_gpio_hold(BOARD_GPIO_S_OPEN, false);
+    hal_gpio_set_level(BOARD_GPIO_S_OPEN, 0);
+
+    radgard_settings_t settings;
+    settings_init(&settings);
+    strcpy(settings.user_id, "user");
+    strcpy(settings.zone_id, "zone");
+    memcpy(&settings.schedule, schedule, sizeof(schedule_t));
+    settings.has_schedule = 1;
+    settings_save(&settings);
+
+    schedule_cache_store(schedule);
+    schedule_event_t open = { .time = MONDAY + OPEN_S, .action = SCHEDULE_ACTION_OPEN };
+    schedule_cache_set_next_event(&open);
+
+    hal_linux_set_time(MONDAY + OPEN_S);
+    hal_linux_set_wake(HAL_WAKE_TIMER, 0);
+    hal_sleep_deep(0);
+    online_count = 0;
+}
+
+static void test_wake_served_from_cache_without_nvs() {
+    schedule_t schedule;
+    week_schedule(&schedule);
+    prepare_open_wake(&schedule);
+
+    // The hit path never reads NVS, so the wake works without it
+    hal_kv_erase_all();
+
+    device_sleep_t sleep;
+    device_wake(count_online, NULL, &sleep);
+
+    TEST_CHECK_EQUAL(0, online_count);
+    TEST_CHECK_EQUAL(1, hal_linux_gpio_level(BOARD_GPIO_S_OPEN));
+    TEST_CHECK_EQUAL(CLOSE_S - OPEN_S, sleep.time_us / 1000000);
+}
+
+static void test_wake_falls_back_to_nvs() {
+    schedule_t schedule;
+    week_schedule(&schedule);
+    prepare_open_wake(&schedule);
+
+    cache.schedule.events[0] ^= 1;
+
+    device_sleep_t sleep;
+    device_wake(count_online, NULL, &sleep);
+
+    // The schedule comes back from NVS into the cache; the pending event was lost with it
+    schedule_t loaded;
+    TEST_CHECK(schedule_cache_load(&loaded));
+    TEST_CHECK(memcmp(&schedule, &loaded, sizeof(schedule_t)) == 0);
+    TEST_CHECK_EQUAL(1, online_count);
+    TEST_CHECK_EQUAL(0, hal_linux_gpio_level(BOARD_GPIO_S_OPEN));
+
+    // The sleep is still timed from the reloaded schedule
+    schedule_event_t next;
+    TEST_CHECK(schedule_cache_get_next_event(&next));
+    TEST_CHECK_EQUAL(SCHEDULE_ACTION_CLOSE, next.action);
+    TEST_CHECK_EQUAL(MONDAY + CLOSE_S, next.time);
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_store_load_round_trip);
+    TEST_RUN(test_crc_mismatch_misses);
+    TEST_RUN(test_next_event_get_set);
+    TEST_RUN(test_wake_served_from_cache_without_nvs);
+    TEST_RUN(test_wake_falls_back_to_nvs);
+
+    return TEST_RESULT();
+}
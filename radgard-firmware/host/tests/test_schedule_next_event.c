@@ -0,0 +1,289 @@
+/*
+    Compares schedule_next_event against the localtime_r/mktime loop it
+    replaced, over randomised schedules and a range of times. Whole-hour
+    zones run the old loop as it was; zones with UTC offset transitions run
+    the same loop on wall-clock times under a POSIX TZ rule.
+*/
+
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hal_linux.h"
+#include "schedule.h"
+
+#include "test.h"
+
+#define SUNDAY_MARCH_1 1772323200       // 2026-03-01 00:00 UTC
+#define SUNDAY_OCTOBER_25 1792886400    // 2026-10-25 00:00 UTC
+#define DST_START 1772953200            // 2026-03-08 07:00 UTC, 02:00 EST
+#define DST_END 1793512800              // 2026-11-01 06:00 UTC, 02:00 EDT
+#define EST (-5 * 3600)
+#define EDT (-4 * 3600)
+
+#define SECONDS_PER_DAY 86400
+#define SAMPLE_STEP 97
+#define SAMPLE_DAYS 9
+
+/* The old per-day layout, as the loop read it from NVS */
+typedef struct {
+    uint32_t day_times[SCHEDULE_DAYS][SCHEDULE_MAX_DAY_TIMES];
+    size_t day_times_length[SCHEDULE_DAYS];
+    uint8_t sig_rains[SCHEDULE_DAYS];
+} legacy_schedule_t;
+
+static void use_tz(const char *tz) {
+    setenv("TZ", tz, 1);
+    tzset();
+}
+
+// Even day times, in whole minutes, none in local minutes [skip_start, skip_end)
+static void random_schedule(legacy_schedule_t *legacy, uint16_t skip_start, uint16_t skip_end) {
+    memset(legacy, 0, sizeof(legacy_schedule_t));
+
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        size_t length = (rand() % 5) * 2;
+        uint16_t minute = 0;
+
+        for (size_t i = 0; i < length; i++) {
+            minute += 1 + rand() % (SCHEDULE_MINUTES_PER_DAY / (length + 1));
+            if (minute >= skip_start && minute < skip_end) {
+                minute = skip_end;
+            }
+            if (minute >= SCHEDULE_MINUTES_PER_DAY) {
+                length = i - i % 2;
+                break;
+            }
+
+            legacy->day_times[day][i] = minute * 60;
+        }
+
+        legacy->day_times_length[day] = length;
+        legacy->sig_rains[day] = rand() % 4 == 0;
+    }
+}
+
+static void compile_schedule(const legacy_schedule_t *legacy, const timezone_t *timezone, schedule_t *schedule) {
+    schedule_init(schedule, timezone);
+
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        schedule_set_day_times(schedule, day, legacy->day_times[day], legacy->day_times_length[day]);
+    }
+
+    memcpy(schedule->sig_rains, legacy->sig_rains, sizeof(schedule->sig_rains));
+}
+
+/* determine_sleep_time's next-event loop before the compiled schedule, with
+ * TZ left at UTC and `time_zone` whole hours behind it */
+static uint32_t legacy_fetch_time(time_t now, uint32_t time_zone) {
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+
+    if (timeinfo.tm_hour > (int) time_zone + 1 || (timeinfo.tm_hour == (int) time_zone + 1 && timeinfo.tm_min >= 30)) {
+        timeinfo.tm_mday += 1;
+    }
+    timeinfo.tm_sec = 0;
+    timeinfo.tm_min = 30;
+    timeinfo.tm_hour = time_zone + 1;
+
+    return (uint32_t) mktime(&timeinfo);
+}
+
+static void legacy_next_event(const legacy_schedule_t *legacy, uint32_t time_zone, time_t now, schedule_event_t *event) {
+    struct tm timeinfo;
+
+    time_t local_now = now - time_zone * 3600;
+    localtime_r(&local_now, &timeinfo);
+    uint8_t day = timeinfo.tm_wday;
+
+    localtime_r(&now, &timeinfo);
+    if (timeinfo.tm_hour < (int) time_zone) {
+        timeinfo.tm_mday -= 1;
+    }
+    timeinfo.tm_sec = 0;
+    timeinfo.tm_min = 0;
+    timeinfo.tm_hour = time_zone;
+
+    uint32_t day_start = (uint32_t) mktime(&timeinfo);
+
+    uint32_t start_up_time = 0;
+    for (size_t i = 0; i < legacy->day_times_length[day]; i++) {
+        if (now + 5 < day_start + legacy->day_times[day][i]) {
+            start_up_time = day_start + legacy->day_times[day][i];
+            event->action = (i % 2 == 0) ? SCHEDULE_ACTION_OPEN : SCHEDULE_ACTION_CLOSE;
+
+            break;
+        }
+    }
+
+    if (start_up_time == 0 || legacy->sig_rains[day]) {
+        start_up_time = legacy_fetch_time(now, time_zone);
+        event->action = SCHEDULE_ACTION_NONE;
+    }
+
+    event->time = start_up_time;
+}
+
+/* The same loop on wall-clock times, for TZ rules with transitions. A
+ * repeated wall-clock time takes its first occurrence, as timezone_to_utc does. */
+static time_t wall_clock(const struct tm *day, uint32_t seconds) {
+    struct tm timeinfo = *day;
+    timeinfo.tm_hour = seconds / 3600;
+    timeinfo.tm_min = seconds / 60 % 60;
+    timeinfo.tm_sec = 0;
+    timeinfo.tm_isdst = -1;
+
+    struct tm wanted = timeinfo;
+    time_t utc = mktime(&timeinfo);
+
+    struct tm earlier;
+    time_t earlier_utc = utc - 3600;
+    localtime_r(&earlier_utc, &earlier);
+    if (earlier.tm_mday == timeinfo.tm_mday && earlier.tm_hour == wanted.tm_hour && earlier.tm_min == wanted.tm_min) {
+        return earlier_utc;
+    }
+
+    return utc;
+}
+
+static void wall_clock_next_event(const legacy_schedule_t *legacy, time_t now, schedule_event_t *event) {
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+    uint8_t day = timeinfo.tm_wday;
+
+    if (!legacy->sig_rains[day]) {
+        for (size_t i = 0; i < legacy->day_times_length[day]; i++) {
+            time_t time = wall_clock(&timeinfo, legacy->day_times[day][i]);
+
+            if (now + 5 < time) {
+                event->time = time;
+                event->action = (i % 2 == 0) ? SCHEDULE_ACTION_OPEN : SCHEDULE_ACTION_CLOSE;
+
+                return;
+            }
+        }
+    }
+
+    if (timeinfo.tm_hour > 1 || (timeinfo.tm_hour == 1 && timeinfo.tm_min >= 30)) {
+        timeinfo.tm_mday += 1;
+    }
+
+    event->time = wall_clock(&timeinfo, 5400);
+    event->action = SCHEDULE_ACTION_NONE;
+}
+
+static int mismatches;
+
+static void check_same(const schedule_t *schedule, uint32_t now, const schedule_event_t *expected) {
+    schedule_event_t event;
+    schedule_next_event(schedule, now, &event);
+
+    // Only the first few are reported, with the time they came from
+    if (event.time != expected->time || event.action != expected->action) {
+        if (mismatches < 5) {
+            fprintf(stderr, "now %u: next event %u/%d, expected %u/%d\n", now, event.time, event.action, expected->time, expected->action);
+        }
+        mismatches += 1;
+    }
+}
+
+static void test_matches_legacy_loop() {
+    const uint32_t time_zones[] = { 0, 3, 5, 8, 11 };
+
+    use_tz("UTC0");
+    srand(3);
+    mismatches = 0;
+
+    for (size_t zone = 0; zone < sizeof(time_zones) / sizeof(time_zones[0]); zone++) {
+        uint32_t time_zone = time_zones[zone];
+
+        timezone_t timezone;
+        timezone_init_fixed(&timezone, -(int32_t) time_zone * 3600);
+
+        for (int round = 0; round < 4; round++) {
+            legacy_schedule_t legacy;
+            schedule_t schedule;
+            random_schedule(&legacy, 0, 0);
+            compile_schedule(&legacy, &timezone, &schedule);
+
+            for (uint32_t now = SUNDAY_MARCH_1; now < SUNDAY_MARCH_1 + SAMPLE_DAYS * SECONDS_PER_DAY; now += SAMPLE_STEP) {
+                schedule_event_t expected;
+                legacy_next_event(&legacy, time_zone, now, &expected);
+                check_same(&schedule, now, &expected);
+            }
+
+            // Either side of the margin ahead of every event
+            for (int day = 0; day < SAMPLE_DAYS; day++) {
+                uint32_t day_start = SUNDAY_MARCH_1 + day * SECONDS_PER_DAY + time_zone * 3600;
+                uint8_t weekday = day % SCHEDULE_DAYS;
+
+                for (size_t i = 0; i < legacy.day_times_length[weekday]; i++) {
+                    for (int before = -1; before <= 7; before++) {
+                        uint32_t now = day_start + legacy.day_times[weekday][i] - before;
+
+                        schedule_event_t expected;
+                        legacy_next_event(&legacy, time_zone, now, &expected);
+                        check_same(&schedule, now, &expected);
+                    }
+                }
+            }
+        }
+    }
+
+    TEST_CHECK_EQUAL(0, mismatches);
+}
+
+static void test_matches_across_transitions() {
+    use_tz("EST5EDT,M3.2.0,M11.1.0");
+    srand(4);
+    mismatches = 0;
+
+    timezone_t timezone;
+    timezone_init_fixed(&timezone, EST);
+    timezone_add_transition(&timezone, DST_START, EDT);
+    timezone_add_transition(&timezone, DST_END, EST);
+
+    const uint32_t weeks[] = { SUNDAY_MARCH_1 - EST, SUNDAY_OCTOBER_25 - EDT };
+
+    for (size_t week = 0; week < sizeof(weeks) / sizeof(weeks[0]); week++) {
+        for (int round = 0; round < 8; round++) {
+            legacy_schedule_t legacy;
+            schedule_t schedule;
+            // Wall-clock times from 01:00 to 03:00 are skipped or repeated on transition days
+            random_schedule(&legacy, 60, 180);
+            compile_schedule(&legacy, &timezone, &schedule);
+
+            for (uint32_t now = weeks[week]; now < weeks[week] + SAMPLE_DAYS * SECONDS_PER_DAY; now += SAMPLE_STEP) {
+                schedule_event_t expected;
+                wall_clock_next_event(&legacy, now, &expected);
+                check_same(&schedule, now, &expected);
+            }
+        }
+
+        // Every second of the transition hours, with no events to find
+        legacy_schedule_t legacy;
+        memset(&legacy, 0, sizeof(legacy));
+        schedule_t schedule;
+        compile_schedule(&legacy, &timezone, &schedule);
+
+        uint32_t transition = week == 0 ? DST_START : DST_END;
+        for (uint32_t now = transition - 2 * 3600; now < transition + 2 * 3600; now++) {
+            schedule_event_t expected;
+            wall_clock_next_event(&legacy, now, &expected);
+            check_same(&schedule, now, &expected);
+        }
+    }
+
+    TEST_CHECK_EQUAL(0, mismatches);
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_matches_legacy_loop);
+    TEST_RUN(test_matches_across_transitions);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,182 @@
+/*
+    Steps schedule_decide_wake through a week the way the wake stub does,
+    sleeping until each decision's next event, and checks every open, close
+    and fetch against a week of events built independently from the day
+    times. Full boots take app_main's part: they pick the next event and
+    consume the day's sig_rains flag.
+*/
+
+#include <stdbool.h>
+
+#include "hal_linux.h"
+#include "schedule.h"
+
+#include "test.h"
+
+// Local time is UTC-4; Sunday 2026-01-04 00:00 local
+#define OFFSET (-4 * 3600)
+#define SUNDAY (1767484800 - OFFSET)
+#define DAY 86400
+
+#define FETCH_TIME (3600 + 1800)
+#define RAIN_DAY 3
+
+#define EXPECTED_MAX 64
+
+static const uint32_t day_times[SCHEDULE_DAYS][4] = {
+    { 6 * 3600, 6 * 3600 + 1200 },
+    { 5 * 3600, 5 * 3600 + 1800, 19 * 3600, 19 * 3600 + 2700 },
+    { 0 },
+    { 6 * 3600, 6 * 3600 + 1200 },
+    // Late in the day, so the close's next event is the next day's fetch
+    { 23 * 3600 + 1800, 23 * 3600 + 3300 },
+    // Just past the fetch window, so the stub handles it
+    { 3 * 3600, 3 * 3600 + 600 },
+    { 12 * 3600, 12 * 3600 + 1800 }
+};
+
+static const size_t day_times_length[SCHEDULE_DAYS] = { 2, 4, 0, 2, 2, 2, 2 };
+
+static void week_schedule(schedule_t *schedule) {
+    timezone_t timezone;
+    timezone_init_fixed(&timezone, OFFSET);
+    schedule_init(schedule, &timezone);
+
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        schedule_set_day_times(schedule, day, day_times[day], day_times_length[day]);
+    }
+
+    schedule->sig_rains[RAIN_DAY] = 1;
+}
+
+// Each day's fetch, then its events unless it rains; ends with the next Sunday's fetch
+static size_t expected_week(schedule_event_t *expected) {
+    size_t length = 0;
+
+    for (int day = 0; day <= SCHEDULE_DAYS; day++) {
+        uint32_t day_start = SUNDAY + day * DAY;
+
+        expected[length++] = (schedule_event_t) { .time = day_start + FETCH_TIME, .action = SCHEDULE_ACTION_NONE };
+
+        if (day == SCHEDULE_DAYS || day == RAIN_DAY) {
+            continue;
+        }
+
+        for (size_t i = 0; i < day_times_length[day]; i++) {
+            expected[length++] = (schedule_event_t) {
+                .time = day_start + day_times[day][i],
+                .action = i % 2 == 0 ? SCHEDULE_ACTION_OPEN : SCHEDULE_ACTION_CLOSE
+            };
+        }
+    }
+
+    return length;
+}
+
+// app_main's choice of the next event after a full boot
+static void full_boot_next_event(schedule_t *schedule, uint32_t now, schedule_event_t *next) {
+    schedule_next_event(schedule, now, next);
+
+    uint8_t day = schedule_get_day(schedule, now);
+    if (next->action == SCHEDULE_ACTION_NONE && schedule->sig_rains[day]) {
+        schedule->sig_rains[day] = 0;
+    }
+}
+
+static void test_week_of_decisions() {
+    schedule_t schedule;
+    week_schedule(&schedule);
+
+    schedule_event_t expected[EXPECTED_MAX];
+    size_t expected_length = expected_week(expected);
+
+    schedule_event_t pending = expected[0];
+    size_t opens = 0;
+    size_t closes = 0;
+    size_t fetches = 0;
+
+    for (size_t i = 0; i < expected_length; i++) {
+        TEST_CHECK_EQUAL(expected[i].time, pending.time);
+        TEST_CHECK_EQUAL(expected[i].action, pending.action);
+
+        schedule_wake_t wake;
+        schedule_decide_wake(&schedule, &pending, pending.time, &wake);
+
+        if (expected[i].action == SCHEDULE_ACTION_NONE) {
+            TEST_CHECK(wake.full_boot);
+            TEST_CHECK_EQUAL(SCHEDULE_ACTION_NONE, wake.action);
+            fetches += 1;
+
+            full_boot_next_event(&schedule, pending.time, &pending);
+        } else {
+            TEST_CHECK(!wake.full_boot);
+            TEST_CHECK_EQUAL(expected[i].action, wake.action);
+
+            if (wake.action == SCHEDULE_ACTION_OPEN) {
+                opens += 1;
+            } else {
+                closes += 1;
+            }
+
+            pending = wake.next_event;
+        }
+    }
+
+    TEST_CHECK_EQUAL(SCHEDULE_DAYS + 1, fetches);
+    TEST_CHECK_EQUAL(6, opens);
+    TEST_CHECK_EQUAL(6, closes);
+
+    // The rainy day's flag was consumed at its fetch
+    TEST_CHECK_EQUAL(0, schedule.sig_rains[RAIN_DAY]);
+}
+
+// The stub leaves the wake to app_main when it would have to consume a sig_rains flag
+static void test_sig_rains_needs_full_boot() {
+    schedule_t schedule;
+    week_schedule(&schedule);
+
+    // Wednesday's open, pending from before the flag was set
+    uint32_t now = SUNDAY + RAIN_DAY * DAY + day_times[RAIN_DAY][0];
+    schedule_event_t pending = { .time = now, .action = SCHEDULE_ACTION_OPEN };
+
+    schedule_wake_t wake;
+    schedule_decide_wake(&schedule, &pending, now, &wake);
+    TEST_CHECK(wake.full_boot);
+
+    schedule.sig_rains[RAIN_DAY] = 0;
+    schedule_decide_wake(&schedule, &pending, now, &wake);
+    TEST_CHECK(!wake.full_boot);
+    TEST_CHECK_EQUAL(SCHEDULE_ACTION_OPEN, wake.action);
+    TEST_CHECK_EQUAL(SCHEDULE_ACTION_CLOSE, wake.next_event.action);
+    TEST_CHECK_EQUAL(SUNDAY + RAIN_DAY * DAY + day_times[RAIN_DAY][1], wake.next_event.time);
+}
+
+// Wakes in the fetch window, up to 02:30:59 local, always boot fully
+static void test_fetch_window_needs_full_boot() {
+    schedule_t schedule;
+    week_schedule(&schedule);
+
+    uint32_t monday = SUNDAY + DAY;
+    schedule_event_t pending = { .action = SCHEDULE_ACTION_CLOSE };
+    schedule_wake_t wake;
+
+    pending.time = monday + 2 * 3600 + 1859;
+    schedule_decide_wake(&schedule, &pending, pending.time, &wake);
+    TEST_CHECK(wake.full_boot);
+
+    pending.time = monday + 2 * 3600 + 1860;
+    schedule_decide_wake(&schedule, &pending, pending.time, &wake);
+    TEST_CHECK(!wake.full_boot);
+    TEST_CHECK_EQUAL(SCHEDULE_ACTION_CLOSE, wake.action);
+    TEST_CHECK_EQUAL(monday + day_times[1][0], wake.next_event.time);
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_week_of_decisions);
+    TEST_RUN(test_sig_rains_needs_full_boot);
+    TEST_RUN(test_fetch_window_needs_full_boot);
+
+    return TEST_RESULT();
+}
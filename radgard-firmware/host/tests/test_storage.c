@@ -0,0 +1,129 @@
+/*
+    Tests for the RTC digest table that lets unchanged writes skip flash,
+    around transactions: a write only counts as stored once its transaction
+    commits, and a failed commit leaves no digest to trust. storage.c is
+    included to look at the table directly.
+*/
+
+#include <string.h>
+
+#include "hal.h"
+#include "hal_linux.h"
+
+#include "../../components/storage/storage.c"
+
+#include "test.h"
+
+static bool has_digest(const char *key, uint32_t value) {
+    storage_digest_t *digest = find_digest(key_digest(key));
+
+    return digest != NULL && digest->value_hash == value_digest(STORED_U32, &value, sizeof(value));
+}
+
+static uint32_t kv_writes() {
+    hal_linux_kv_stats_t stats;
+    hal_linux_kv_get_stats(&stats);
+
+    return stats.writes;
+}
+
+static void reset() {
+    hal_kv_erase_all();
+    memset(&digest_table, 0, sizeof(storage_digest_table_t));
+}
+
+static void test_write_remembered_outside_txn() {
+    reset();
+
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("a", 1));
+    TEST_CHECK(has_digest("a", 1));
+
+    uint32_t writes = kv_writes();
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("a", 1));
+    TEST_CHECK_EQUAL(writes, kv_writes());
+}
+
+static void test_txn_digest_waits_for_commit() {
+    reset();
+
+    storage_txn_begin();
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("a", 1));
+    TEST_CHECK(find_digest(key_digest("a")) == NULL);
+
+    // Nested commits do not reach flash either
+    storage_txn_begin();
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("b", 2));
+    TEST_CHECK_EQUAL(ESP_OK, storage_txn_commit());
+    TEST_CHECK(find_digest(key_digest("b")) == NULL);
+
+    TEST_CHECK_EQUAL(ESP_OK, storage_txn_commit());
+    TEST_CHECK(has_digest("a", 1));
+    TEST_CHECK(has_digest("b", 2));
+}
+
+static void test_failed_commit_clears_table() {
+    reset();
+
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("a", 1));
+    TEST_CHECK(has_digest("a", 1));
+
+    storage_txn_begin();
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("a", 2));
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("b", 3));
+
+    hal_linux_fail_next_kv_commit(ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    TEST_CHECK_EQUAL(ESP_ERR_NVS_NOT_ENOUGH_SPACE, storage_txn_commit());
+
+    for (int i = 0; i < DIGEST_TABLE_LENGTH; i++) {
+        TEST_CHECK_EQUAL(0, digest_table.digests[i].key_hash);
+    }
+}
+
+// Within a transaction its own writes decide whether a value is unchanged
+static void test_txn_sees_its_own_writes() {
+    reset();
+
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("a", 1));
+
+    uint32_t writes = kv_writes();
+    storage_txn_begin();
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("a", 2));
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("a", 1));
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("a", 1));
+    TEST_CHECK_EQUAL(ESP_OK, storage_txn_commit());
+
+    TEST_CHECK_EQUAL(writes + 2, kv_writes());
+    TEST_CHECK(has_digest("a", 1));
+
+    uint32_t value = 0;
+    TEST_CHECK_EQUAL(ESP_OK, storage_get_u32("a", &value));
+    TEST_CHECK_EQUAL(1, value);
+}
+
+static void test_remove_in_txn_forgets() {
+    reset();
+
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("a", 1));
+
+    storage_txn_begin();
+    TEST_CHECK_EQUAL(ESP_OK, storage_set_u32("b", 2));
+    storage_remove("a");
+    storage_remove("b");
+    TEST_CHECK(find_digest(key_digest("a")) == NULL);
+    TEST_CHECK_EQUAL(ESP_OK, storage_txn_commit());
+
+    TEST_CHECK(find_digest(key_digest("a")) == NULL);
+    TEST_CHECK(find_digest(key_digest("b")) == NULL);
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_write_remembered_outside_txn);
+    TEST_RUN(test_txn_digest_waits_for_commit);
+    TEST_RUN(test_failed_commit_clears_table);
+    TEST_RUN(test_txn_sees_its_own_writes);
+    TEST_RUN(test_remove_in_txn_forgets);
+
+    return TEST_RESULT();
+}
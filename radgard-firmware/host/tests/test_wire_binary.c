@@ -0,0 +1,270 @@
+/*
+    Tests for the binary settings decoder. A zone sent in the binary encoding
+    must compile to the same schedule as the JSON a server without it would
+    send, truncated bodies must be rejected, and varints longer than a
+    uint32_t can hold must be rejected before they are shifted past its width.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hal_linux.h"
+#include "wire.h"
+#include "settings_server.h"
+
+#include "test.h"
+
+// Feeds `length` bytes one at a time, so varints also carry over between chunks
+static esp_err_t decode_bytewise(const char *body, size_t length, schedule_t *schedule) {
+    wire_binary_t decoder;
+    wire_binary_begin(&decoder, schedule);
+
+    for (size_t i = 0; i < length; i++) {
+        wire_binary_feed(&decoder, body + i, 1);
+    }
+
+    return wire_binary_end(&decoder);
+}
+
+static esp_err_t decode(const char *body, size_t length, schedule_t *schedule) {
+    wire_binary_t decoder;
+    wire_binary_begin(&decoder, schedule);
+    wire_binary_feed(&decoder, body, length);
+
+    return wire_binary_end(&decoder);
+}
+
+// A document with one UTC offset whose start is the varint `start`
+static size_t offset_start_document(char *body, const char *start, size_t start_length) {
+    size_t length = 0;
+    body[length++] = WIRE_BINARY_MAGIC;
+    body[length++] = WIRE_BINARY_VERSION;
+    body[length++] = 0; // time_zone
+    body[length++] = 0; // sig_rains
+
+    for (int day = 0; day < SCHEDULE_DAYS; day++) {
+        body[length++] = 0;
+    }
+
+    body[length++] = 1;
+    memcpy(body + length, start, start_length);
+    length += start_length;
+    body[length++] = 0; // offset
+
+    return length;
+}
+
+// Through wire_decoder, as api_sync does, picking the decoder from `content_type`
+static esp_err_t decode_as(const char *content_type, const char *body, size_t length, size_t chunk,
+                           schedule_t *schedule, bool *schedule_valid) {
+    wire_decoder_t decoder;
+    wire_decoder_begin(&decoder, schedule);
+    wire_decoder_set_content_type(&decoder, content_type);
+
+    for (size_t i = 0; i < length; i += chunk) {
+        wire_decoder_feed(&decoder, body + i, length - i < chunk ? length - i : chunk);
+    }
+
+    esp_err_t err = wire_decoder_end(&decoder);
+    *schedule_valid = wire_decoder_schedule_valid(&decoder);
+
+    return err;
+}
+
+static bool schedules_equal(const schedule_t *a, const schedule_t *b) {
+    if (a->events_length != b->events_length || a->timezone.length != b->timezone.length ||
+        memcmp(a->sig_rains, b->sig_rains, sizeof(a->sig_rains)) != 0 ||
+        memcmp(a->events, b->events, a->events_length * sizeof(uint16_t)) != 0) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < a->timezone.length; i++) {
+        if (a->timezone.transitions[i].start != b->timezone.transitions[i].start ||
+            a->timezone.transitions[i].offset != b->timezone.transitions[i].offset) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void zone_init(settings_server_zone_t *zone) {
+    memset(zone, 0, sizeof(settings_server_zone_t));
+    zone->time_zone = -3;
+
+    // Monday 6:00-6:20 and 18:00-18:20, Thursday's times out of order
+    const uint32_t monday[] = { 21600, 22800, 64800, 66000 };
+    memcpy(zone->day_times[1], monday, sizeof(monday));
+    zone->day_times_length[1] = 4;
+
+    const uint32_t thursday[] = { 7200, 3600, 86399 };
+    memcpy(zone->day_times[4], thursday, sizeof(thursday));
+    zone->day_times_length[4] = 3;
+
+    zone->sig_rains[0] = true;
+    zone->sig_rains[5] = true;
+}
+
+// Decodes `zone` from both encodings, whole and byte by byte, checking they agree
+static void check_matches_json(const settings_server_zone_t *zone, schedule_t *schedule, bool *schedule_valid) {
+    char json[SETTINGS_SERVER_MAX_BODY];
+    size_t json_length = settings_server_format_json(zone, json, sizeof(json));
+    char binary[SETTINGS_SERVER_MAX_BODY];
+    size_t binary_length = settings_server_format_binary(zone, binary, sizeof(binary));
+    TEST_CHECK(binary_length > 0 && binary_length < json_length);
+
+    // A server that ignores Accept answers in JSON, and unknown types fall back to it too
+    TEST_CHECK_EQUAL(ESP_OK, decode_as(WIRE_CONTENT_TYPE_JSON, json, json_length, json_length, schedule, schedule_valid));
+
+    const struct {
+        const char *content_type;
+        const char *body;
+        size_t length;
+    } decodes[] = {
+        { WIRE_CONTENT_TYPE_JSON "; charset=utf-8", json, json_length },
+        { "text/plain", json, json_length },
+        { WIRE_CONTENT_TYPE_BINARY, binary, binary_length }
+    };
+
+    for (size_t i = 0; i < sizeof(decodes) / sizeof(decodes[0]); i++) {
+        // Byte by byte, then whole
+        const size_t chunks[] = { 1, decodes[i].length };
+
+        for (size_t j = 0; j < 2; j++) {
+            schedule_t other;
+            bool other_valid;
+            TEST_CHECK_EQUAL(ESP_OK, decode_as(decodes[i].content_type, decodes[i].body, decodes[i].length, chunks[j],
+                                               &other, &other_valid));
+            TEST_CHECK_EQUAL(*schedule_valid, other_valid);
+            TEST_CHECK(schedules_equal(schedule, &other));
+        }
+    }
+}
+
+static void test_round_trip_matches_json() {
+    settings_server_zone_t zone;
+    zone_init(&zone);
+
+    schedule_t schedule;
+    bool schedule_valid;
+    check_matches_json(&zone, &schedule, &schedule_valid);
+
+    TEST_CHECK(schedule_valid);
+    TEST_CHECK_EQUAL(7, schedule.events_length);
+    TEST_CHECK_EQUAL((SCHEDULE_MINUTES_PER_DAY + 360) | SCHEDULE_EVENT_OPEN, schedule.events[0]);
+    TEST_CHECK_EQUAL(4 * SCHEDULE_MINUTES_PER_DAY + 60, schedule.events[4]);
+    TEST_CHECK_EQUAL((4 * SCHEDULE_MINUTES_PER_DAY + 120) | SCHEDULE_EVENT_OPEN, schedule.events[5]);
+    TEST_CHECK_EQUAL((5 * SCHEDULE_MINUTES_PER_DAY - 1) | SCHEDULE_EVENT_OPEN, schedule.events[6]);
+    TEST_CHECK_EQUAL(1, schedule.sig_rains[0]);
+    TEST_CHECK_EQUAL(0, schedule.sig_rains[3]);
+    TEST_CHECK_EQUAL(1, schedule.sig_rains[5]);
+    TEST_CHECK_EQUAL(0, schedule.sig_rains[6]);
+    TEST_CHECK_EQUAL(1, schedule.timezone.length);
+    TEST_CHECK_EQUAL(3 * 3600, schedule.timezone.transitions[0].offset);
+
+    // Transitions take precedence over time_zone in both
+    timezone_init_fixed(&zone.utc_offsets, -5 * 3600);
+    zone.utc_offsets.transitions[0].start = 1772953200;
+    timezone_add_transition(&zone.utc_offsets, 1793512800, -6 * 3600);
+    check_matches_json(&zone, &schedule, &schedule_valid);
+
+    TEST_CHECK_EQUAL(2, schedule.timezone.length);
+    TEST_CHECK_EQUAL(1772953200, schedule.timezone.transitions[0].start);
+    TEST_CHECK_EQUAL(-5 * 3600, schedule.timezone.transitions[0].offset);
+    TEST_CHECK_EQUAL(1793512800, schedule.timezone.transitions[1].start);
+    TEST_CHECK_EQUAL(-6 * 3600, schedule.timezone.transitions[1].offset);
+}
+
+static void test_truncated_rejected() {
+    settings_server_zone_t zone;
+    zone_init(&zone);
+    timezone_init_fixed(&zone.utc_offsets, 3600);
+
+    char body[SETTINGS_SERVER_MAX_BODY];
+    size_t length = settings_server_format_binary(&zone, body, sizeof(body));
+
+    schedule_t schedule;
+    TEST_CHECK_EQUAL(ESP_OK, decode(body, length, &schedule));
+    for (size_t prefix = 0; prefix < length; prefix++) {
+        TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode(body, prefix, &schedule));
+        TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_bytewise(body, prefix, &schedule));
+    }
+
+    // Nor may anything follow the document
+    body[length] = 0;
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode(body, length + 1, &schedule));
+}
+
+static void test_overlong_day_invalid() {
+    // One more time than a day holds: the document decodes but the schedule is marked invalid, as in JSON
+    char body[64];
+    size_t length = 0;
+    body[length++] = WIRE_BINARY_MAGIC;
+    body[length++] = WIRE_BINARY_VERSION;
+    body[length++] = 0; // time_zone
+    body[length++] = 0; // sig_rains
+
+    body[length++] = SCHEDULE_MAX_DAY_TIMES + 1;
+    for (int i = 0; i <= SCHEDULE_MAX_DAY_TIMES; i++) {
+        body[length++] = 2; // zigzag 1
+    }
+
+    for (int day = 1; day < SCHEDULE_DAYS; day++) {
+        body[length++] = 0;
+    }
+    body[length++] = 0; // utc_offsets
+
+    schedule_t schedule;
+    bool schedule_valid;
+    TEST_CHECK_EQUAL(ESP_OK, decode_as(WIRE_CONTENT_TYPE_BINARY, body, length, 1, &schedule, &schedule_valid));
+    TEST_CHECK(!schedule_valid);
+
+    char json[256] = "{\"time_zone\":0,\"times\":[[";
+    for (int i = 0; i <= SCHEDULE_MAX_DAY_TIMES; i++) {
+        snprintf(json + strlen(json), sizeof(json) - strlen(json), i == 0 ? "%d" : ",%d", i + 1);
+    }
+    strcat(json, "]]}");
+
+    TEST_CHECK_EQUAL(ESP_OK, decode_as(WIRE_CONTENT_TYPE_JSON, json, strlen(json), 1, &schedule, &schedule_valid));
+    TEST_CHECK(!schedule_valid);
+}
+
+static void test_longest_varint_accepted() {
+    // 0xffffffff: the fifth byte carries the top 4 bits
+    const char start[] = { (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff, 0x0f };
+    char body[32];
+    size_t length = offset_start_document(body, start, sizeof(start));
+
+    schedule_t schedule;
+    TEST_CHECK_EQUAL(ESP_OK, decode(body, length, &schedule));
+    TEST_CHECK_EQUAL(ESP_OK, decode_bytewise(body, length, &schedule));
+    TEST_CHECK_EQUAL(0xffffffff, schedule.timezone.transitions[0].start);
+}
+
+static void test_overlong_varint_rejected() {
+    // A continuation bit on the fifth byte would shift the sixth by 35
+    const char six_bytes[] = { (char) 0x80, (char) 0x80, (char) 0x80, (char) 0x80, (char) 0x80, 0x01 };
+    char body[32];
+    size_t length = offset_start_document(body, six_bytes, sizeof(six_bytes));
+
+    schedule_t schedule;
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, decode(body, length, &schedule));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, decode_bytewise(body, length, &schedule));
+
+    // Bits past the 32nd on the fifth byte
+    const char too_wide[] = { (char) 0xff, (char) 0xff, (char) 0xff, (char) 0xff, 0x10 };
+    length = offset_start_document(body, too_wide, sizeof(too_wide));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, decode(body, length, &schedule));
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_round_trip_matches_json);
+    TEST_RUN(test_truncated_rejected);
+    TEST_RUN(test_overlong_day_invalid);
+    TEST_RUN(test_longest_varint_accepted);
+    TEST_RUN(test_overlong_varint_rejected);
+
+    return TEST_RESULT();
+}
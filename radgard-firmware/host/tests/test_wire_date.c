@@ -0,0 +1,91 @@
+/*
+    Tests for parsing the syncDevice response's Date header, which sets the
+    clock: IMF-fixdates parse to the right second across leap days and year
+    ends, and anything else, the obsolete RFC 850 and asctime forms included,
+    is rejected rather than read as some other time.
+*/
+
+#include <time.h>
+
+#include "hal_linux.h"
+#include "wire.h"
+
+#include "test.h"
+
+static time_t parse(const char *value) {
+    time_t utc = 0;
+    TEST_CHECK_EQUAL(ESP_OK, wire_parse_http_date(value, &utc));
+
+    return utc;
+}
+
+static void check_rejected(const char *value) {
+    time_t utc = 12345;
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_ARG, wire_parse_http_date(value, &utc));
+    // The output is left alone
+    TEST_CHECK_EQUAL(12345, utc);
+}
+
+static void test_imf_fixdate() {
+    TEST_CHECK_EQUAL(784111777, parse("Sun, 06 Nov 1994 08:49:37 GMT"));
+    TEST_CHECK_EQUAL(0, parse("Thu, 01 Jan 1970 00:00:00 GMT"));
+    TEST_CHECK_EQUAL(1767571200, parse("Mon, 05 Jan 2026 00:00:00 GMT"));
+    // A leap second is accepted and lands on the next second
+    TEST_CHECK_EQUAL(1483228800, parse("Sat, 31 Dec 2016 23:59:60 GMT"));
+}
+
+static void test_leap_day() {
+    TEST_CHECK_EQUAL(1709164800, parse("Thu, 29 Feb 2024 00:00:00 GMT"));
+    TEST_CHECK_EQUAL(1709251200, parse("Fri, 01 Mar 2024 00:00:00 GMT"));
+    // 2000 is a leap year, being divisible by 400
+    TEST_CHECK_EQUAL(951782400, parse("Tue, 29 Feb 2000 00:00:00 GMT"));
+
+    check_rejected("Sun, 29 Feb 2026 00:00:00 GMT");
+    check_rejected("Fri, 29 Feb 2100 00:00:00 GMT");
+    check_rejected("Thu, 30 Feb 2024 00:00:00 GMT");
+    check_rejected("Thu, 31 Apr 2026 00:00:00 GMT");
+}
+
+static void test_year_boundary() {
+    time_t last = parse("Thu, 31 Dec 2026 23:59:59 GMT");
+    time_t first = parse("Fri, 01 Jan 2027 00:00:00 GMT");
+
+    TEST_CHECK_EQUAL(1798761599, last);
+    TEST_CHECK_EQUAL(last + 1, first);
+}
+
+static void test_obsolete_formats_rejected() {
+    // RFC 850 and asctime, which HTTP/1.1 recipients may accept but servers no longer send
+    check_rejected("Sunday, 06-Nov-94 08:49:37 GMT");
+    check_rejected("Sun Nov  6 08:49:37 1994");
+}
+
+static void test_malformed_rejected() {
+    check_rejected("");
+    check_rejected("garbage");
+    check_rejected("Sun, 06 Nov 1994 08:49:37");
+    check_rejected("Sun, 06 Nov 1994 08:49:37 UTC");
+    check_rejected("Sun, 06 Nov 1994 08:49 GMT");
+    check_rejected("Sun, 06 November 1994 08:49:37 GMT");
+    check_rejected("Sun, 06 Nox 1994 08:49:37 GMT");
+    check_rejected("Sun, 06 ovD 1994 08:49:37 GMT");
+    check_rejected("Sun, 00 Nov 1994 08:49:37 GMT");
+    check_rejected("Sun, 32 Nov 1994 08:49:37 GMT");
+    check_rejected("Sun, 06 Nov 1969 08:49:37 GMT");
+    check_rejected("Sun, 06 Nov 1994 24:00:00 GMT");
+    check_rejected("Sun, 06 Nov 1994 08:60:00 GMT");
+    check_rejected("Sun, 06 Nov 1994 08:49:61 GMT");
+    check_rejected("Sun, 06 Nov 1994 -1:49:37 GMT");
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_imf_fixdate);
+    TEST_RUN(test_leap_day);
+    TEST_RUN(test_year_boundary);
+    TEST_RUN(test_obsolete_formats_rejected);
+    TEST_RUN(test_malformed_rejected);
+
+    return TEST_RESULT();
+}
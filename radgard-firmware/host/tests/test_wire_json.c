@@ -0,0 +1,214 @@
+/*
+    Tests for the streaming JSON settings decoder. Every document is fed
+    whole, byte by byte and split in two at each offset, so chunk boundaries
+    land inside keys, numbers, literals and escapes; all of them must decode
+    to the same schedule and fail with the same error.
+*/
+
+#include <string.h>
+
+#include "hal_linux.h"
+#include "wire.h"
+
+#include "test.h"
+
+typedef struct {
+    esp_err_t err;
+    bool schedule_valid;
+    schedule_t schedule;
+} result_t;
+
+static void decode_chunks(const char *document, size_t split, size_t chunk, result_t *result) {
+    size_t length = strlen(document);
+
+    wire_json_t decoder;
+    wire_json_begin(&decoder, &result->schedule);
+
+    // The first `split` bytes go in as one chunk and the rest `chunk` at a time
+    wire_json_feed(&decoder, document, split);
+    for (size_t i = split; i < length; i += chunk) {
+        wire_json_feed(&decoder, document + i, length - i < chunk ? length - i : chunk);
+    }
+
+    result->err = wire_json_end(&decoder);
+    result->schedule_valid = decoder.schedule_valid;
+}
+
+static bool schedules_equal(const schedule_t *a, const schedule_t *b) {
+    if (a->events_length != b->events_length || a->timezone.length != b->timezone.length ||
+        memcmp(a->sig_rains, b->sig_rains, sizeof(a->sig_rains)) != 0 ||
+        memcmp(a->events, b->events, a->events_length * sizeof(uint16_t)) != 0) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < a->timezone.length; i++) {
+        if (a->timezone.transitions[i].start != b->timezone.transitions[i].start ||
+            a->timezone.transitions[i].offset != b->timezone.transitions[i].offset) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Decodes `document` whole into `result`, checking that every other chunking agrees
+static void decode(const char *document, result_t *result) {
+    size_t length = strlen(document);
+    decode_chunks(document, length, 1, result);
+
+    result_t other;
+    decode_chunks(document, 0, 1, &other);
+    TEST_CHECK_EQUAL(result->err, other.err);
+
+    for (size_t split = 0; split <= length; split++) {
+        decode_chunks(document, split, length, &other);
+        TEST_CHECK_EQUAL(result->err, other.err);
+
+        if (result->err == ESP_OK) {
+            TEST_CHECK_EQUAL(result->schedule_valid, other.schedule_valid);
+            TEST_CHECK(schedules_equal(&result->schedule, &other.schedule));
+        }
+    }
+}
+
+static esp_err_t decode_err(const char *document) {
+    result_t result;
+    decode(document, &result);
+
+    return result.err;
+}
+
+static void test_settings_decoded() {
+    result_t result;
+    decode("{\"time_zone\": 5, \"times\": [[21600, 22800], [], [], [], [], [], [72000.9, 73800]],\n"
+           " \"sig_rains\": [true, false, null, 1, \"yes\", true, false]}", &result);
+
+    TEST_CHECK_EQUAL(ESP_OK, result.err);
+    TEST_CHECK(result.schedule_valid);
+
+    TEST_CHECK_EQUAL(1, result.schedule.timezone.length);
+    TEST_CHECK_EQUAL(-5 * 3600, result.schedule.timezone.transitions[0].offset);
+
+    // Sunday 6:00-6:20 and Saturday 20:00-20:30, the fraction truncated
+    TEST_CHECK_EQUAL(4, result.schedule.events_length);
+    TEST_CHECK_EQUAL(360 | SCHEDULE_EVENT_OPEN, result.schedule.events[0]);
+    TEST_CHECK_EQUAL(380, result.schedule.events[1]);
+    TEST_CHECK_EQUAL((6 * SCHEDULE_MINUTES_PER_DAY + 1200) | SCHEDULE_EVENT_OPEN, result.schedule.events[2]);
+    TEST_CHECK_EQUAL(6 * SCHEDULE_MINUTES_PER_DAY + 1230, result.schedule.events[3]);
+
+    // Only true counts as a significant rain
+    const uint8_t sig_rains[SCHEDULE_DAYS] = { 1, 0, 0, 0, 0, 1, 0 };
+    TEST_CHECK(memcmp(sig_rains, result.schedule.sig_rains, SCHEDULE_DAYS) == 0);
+}
+
+static void test_utc_offsets_take_precedence() {
+    result_t result;
+    decode("{\"utc_offsets\":[{\"start\":1000,\"offset\":-18000},{\"offset\":-14400,\"start\":2000}],"
+           "\"time_zone\":3,\"times\":[]}", &result);
+
+    TEST_CHECK_EQUAL(ESP_OK, result.err);
+    TEST_CHECK_EQUAL(2, result.schedule.timezone.length);
+    TEST_CHECK_EQUAL(1000, result.schedule.timezone.transitions[0].start);
+    TEST_CHECK_EQUAL(-18000, result.schedule.timezone.transitions[0].offset);
+    TEST_CHECK_EQUAL(2000, result.schedule.timezone.transitions[1].start);
+    TEST_CHECK_EQUAL(-14400, result.schedule.timezone.transitions[1].offset);
+
+    // An offset missing a field falls back to time_zone
+    decode("{\"utc_offsets\":[{\"start\":1000}],\"time_zone\":3}", &result);
+    TEST_CHECK_EQUAL(ESP_OK, result.err);
+    TEST_CHECK_EQUAL(1, result.schedule.timezone.length);
+    TEST_CHECK_EQUAL(-3 * 3600, result.schedule.timezone.transitions[0].offset);
+}
+
+static void test_unknown_fields_skipped() {
+    // Escaped quotes and brackets inside strings must not end the string or change the depth
+    result_t result;
+    decode("{\"name\":\"a \\\"} ]\\\\\",\"nested\":{\"times\":[[1,2]],\"list\":[{}, [], \"\\\"\"]},"
+           "\"ti\\u\":[1e3, -2.5E-1, true],\"time_zone\":-2}", &result);
+
+    TEST_CHECK_EQUAL(ESP_OK, result.err);
+    TEST_CHECK_EQUAL(0, result.schedule.events_length);
+    TEST_CHECK_EQUAL(2 * 3600, result.schedule.timezone.transitions[0].offset);
+
+    // An escaped character in a key is taken literally
+    decode("{\"time_zon\\e\":4}", &result);
+    TEST_CHECK_EQUAL(ESP_OK, result.err);
+    TEST_CHECK_EQUAL(-4 * 3600, result.schedule.timezone.transitions[0].offset);
+}
+
+static void test_depth_limit() {
+    // The root object plus seven arrays fill the stack
+    TEST_CHECK_EQUAL(ESP_OK, decode_err("{\"time_zone\":0,\"x\":[[[[[[[1]]]]]]]}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, decode_err("{\"time_zone\":0,\"x\":[[[[[[[[1]]]]]]]]}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, decode_err("{\"time_zone\":0,\"x\":[[[[[[[{}]]]]]]]}"));
+}
+
+static void test_token_limit() {
+    // 23 characters fit the token buffer with its terminator, 24 do not
+    TEST_CHECK_EQUAL(ESP_OK, decode_err("{\"time_zone\":00000000000000000000005}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_SIZE, decode_err("{\"time_zone\":000000000000000000000005}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"time_zone\":0,\"x\":trueeeeeeeeeeeeeeeeeeeeee}"));
+
+    // A key of the buffer's length is truncated and never mistaken for one of ours
+    result_t result;
+    decode("{\"time_zone\":1,\"time_zone_time_zone_time_zone\":7}", &result);
+    TEST_CHECK_EQUAL(ESP_OK, result.err);
+    TEST_CHECK_EQUAL(-3600, result.schedule.timezone.transitions[0].offset);
+}
+
+static void test_day_overflow() {
+    char document[512] = "{\"time_zone\":0,\"times\":[[";
+    for (int i = 0; i <= SCHEDULE_MAX_DAY_TIMES; i++) {
+        strcat(document, i == 0 ? "60" : ",60");
+    }
+    strcat(document, "]]}");
+
+    result_t result;
+    decode(document, &result);
+    TEST_CHECK_EQUAL(ESP_OK, result.err);
+    TEST_CHECK(!result.schedule_valid);
+}
+
+static void test_truncated_rejected() {
+    const char *document = "{\"time_zone\":5,\"times\":[[21600,22800]],\"sig_rains\":[true]}";
+    char prefix[128];
+
+    for (size_t length = 0; length < strlen(document); length++) {
+        memcpy(prefix, document, length);
+        prefix[length] = '\0';
+
+        TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err(prefix));
+    }
+}
+
+static void test_malformed_rejected() {
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"time_zone\":5,}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"time_zone\":5}x"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"time_zone\":5}{}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"time_zone\" 5}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{time_zone:5}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"time_zone\":5,\"times\":[}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"time_zone\":5]"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"time_zone\":5.5.5}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"time_zone\":5,\"x\":nul}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"time_zone\":+5}"));
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("]"));
+
+    // Well formed, but without a time zone the schedule cannot be placed
+    TEST_CHECK_EQUAL(ESP_ERR_INVALID_RESPONSE, decode_err("{\"times\":[]}"));
+}
+
+int main() {
+    hal_linux_set_log_level(ESP_LOG_NONE);
+
+    TEST_RUN(test_settings_decoded);
+    TEST_RUN(test_utc_offsets_take_precedence);
+    TEST_RUN(test_unknown_fields_skipped);
+    TEST_RUN(test_depth_limit);
+    TEST_RUN(test_token_limit);
+    TEST_RUN(test_day_overflow);
+    TEST_RUN(test_truncated_rejected);
+    TEST_RUN(test_malformed_rejected);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,156 @@
+/*
+    Radgard Wake Stub
+
+    Runs from RTC fast memory straight out of deep sleep, before the
+    bootloader. Timer wakes that only toggle the solenoid are handled here
+    and the chip goes back to sleep; anything else falls through to a full
+    boot and app_main.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#include <esp_sleep.h>
+#include <esp_attr.h>
+
+#include "esp32/rom/ets_sys.h"
+#include "esp32/rom/rtc.h"
+#include "soc/rtc.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/gpio_reg.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/io_mux_reg.h"
+
+#include "board.h"
+#include "schedule.h"
+#include "wake_stub.h"
+
+#define SOLENOID_PINS_MASK (BIT(BOARD_GPIO_SD_IN1) | BIT(BOARD_GPIO_SD_IN2) | BIT(BOARD_GPIO_BSTC) | BIT(BOARD_GPIO_S_OPEN))
+
+// Wakes closer than this to the current time are not worth another sleep
+#define MIN_SLEEP_US 100000
+
+static RTC_DATA_ATTR bool stub_enabled = false;
+static RTC_DATA_ATTR uint64_t base_time_us;
+static RTC_DATA_ATTR uint64_t base_rtc_ticks;
+
+static uint64_t RTC_IRAM_ATTR stub_rtc_ticks() {
+    SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+    while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0) {
+        ets_delay_us(1);
+    }
+    SET_PERI_REG_MASK(RTC_CNTL_INT_CLR_REG, RTC_CNTL_TIME_VALID_INT_CLR);
+
+    uint64_t ticks = READ_PERI_REG(RTC_CNTL_TIME0_REG);
+    ticks |= ((uint64_t) READ_PERI_REG(RTC_CNTL_TIME1_REG)) << 32;
+
+    return ticks;
+}
+
+static void RTC_IRAM_ATTR stub_configure_output(uint32_t io_mux_reg, uint32_t gpio_num) {
+    PIN_FUNC_SELECT(io_mux_reg, PIN_FUNC_GPIO);
+    REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + gpio_num * 4, SIG_GPIO_OUT_IDX);
+}
+
+static void RTC_IRAM_ATTR stub_set_level(uint32_t gpio_num, bool level) {
+    REG_WRITE(level ? GPIO_OUT_W1TS_REG : GPIO_OUT_W1TC_REG, BIT(gpio_num));
+}
+
+// Same pulse sequence as open_solenoid/close_solenoid in main.c
+static void RTC_IRAM_ATTR stub_pulse_solenoid(bool open) {
+    uint32_t drive_pin = open ? BOARD_GPIO_SD_IN1 : BOARD_GPIO_SD_IN2;
+
+    // Digital peripherals were powered down, so the pads only keep their level through the hold
+    REG_WRITE(GPIO_OUT_W1TC_REG, SOLENOID_PINS_MASK);
+    stub_set_level(BOARD_GPIO_S_OPEN, !open);
+
+    stub_configure_output(IO_MUX_GPIO18_REG, BOARD_GPIO_SD_IN1);
+    stub_configure_output(IO_MUX_GPIO19_REG, BOARD_GPIO_SD_IN2);
+    stub_configure_output(IO_MUX_GPIO5_REG, BOARD_GPIO_BSTC);
+    stub_configure_output(IO_MUX_GPIO23_REG, BOARD_GPIO_S_OPEN);
+    REG_WRITE(GPIO_ENABLE_W1TS_REG, SOLENOID_PINS_MASK);
+
+    uint32_t pad_hold = REG_READ(RTC_CNTL_DIG_PAD_HOLD_REG);
+    REG_WRITE(RTC_CNTL_DIG_PAD_HOLD_REG, 0);
+
+    stub_set_level(BOARD_GPIO_BSTC, 1);
+    ets_delay_us(BOARD_SOLENOID_PULSE_MS * 1000);
+
+    stub_set_level(BOARD_GPIO_BSTC, 0);
+    stub_set_level(drive_pin, 1);
+    ets_delay_us(BOARD_SOLENOID_PULSE_MS * 1000);
+
+    stub_set_level(drive_pin, 0);
+    stub_set_level(BOARD_GPIO_S_OPEN, open);
+
+    REG_WRITE(RTC_CNTL_DIG_PAD_HOLD_REG, pad_hold);
+}
+
+static void RTC_IRAM_ATTR stub_deep_sleep(uint64_t wake_ticks) {
+    WRITE_PERI_REG(RTC_CNTL_SLP_TIMER0_REG, wake_ticks & UINT32_MAX);
+    WRITE_PERI_REG(RTC_CNTL_SLP_TIMER1_REG, wake_ticks >> 32);
+
+    REG_WRITE(RTC_ENTRY_ADDR_REG, (uint32_t) &esp_wake_deep_sleep);
+    set_rtc_memory_crc();
+
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+    SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+
+    // Sleep starts within a few cycles
+    while (true) {
+    }
+}
+
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void) {
+    esp_default_wake_deep_sleep();
+
+    if (!stub_enabled) {
+        return;
+    }
+
+    uint32_t wakeup_cause = REG_GET_FIELD(RTC_CNTL_WAKEUP_STATE_REG, RTC_CNTL_WAKEUP_CAUSE);
+    if (!(wakeup_cause & RTC_TIMER_TRIG_EN)) {
+        return;
+    }
+
+    const schedule_t *schedule = schedule_cache_peek();
+    schedule_event_t pending;
+    if (schedule == NULL || !schedule_cache_get_next_event(&pending)) {
+        return;
+    }
+
+    uint32_t slow_clk_cal = REG_READ(RTC_SLOW_CLK_CAL_REG);
+    if (slow_clk_cal == 0) {
+        return;
+    }
+
+    uint64_t now_ticks = stub_rtc_ticks();
+    uint64_t now_us = base_time_us + (((now_ticks - base_rtc_ticks) * slow_clk_cal) >> RTC_CLK_CAL_FRACT);
+
+    schedule_wake_t wake;
+    schedule_decide_wake(schedule, &pending, now_us / 1000000, &wake);
+    if (wake.full_boot) {
+        return;
+    }
+
+    stub_pulse_solenoid(wake.action == SCHEDULE_ACTION_OPEN);
+    schedule_cache_set_next_event(&wake.next_event);
+
+    uint64_t wake_us = (uint64_t) wake.next_event.time * 1000000;
+    uint64_t done_us = base_time_us + (((stub_rtc_ticks() - base_rtc_ticks) * slow_clk_cal) >> RTC_CLK_CAL_FRACT);
+    if (wake_us < done_us + MIN_SLEEP_US) {
+        wake_us = done_us + MIN_SLEEP_US;
+    }
+
+    stub_deep_sleep(base_rtc_ticks + (((wake_us - base_time_us) << RTC_CLK_CAL_FRACT) / slow_clk_cal));
+}
+
+void wake_stub_prepare_sleep(bool enabled) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    base_rtc_ticks = rtc_time_get();
+    base_time_us = (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+    stub_enabled = enabled;
+}
@@ -0,0 +1,13 @@
+#ifndef __WAKE_STUB_H__
+#define __WAKE_STUB_H__
+
+#include <stdbool.h>
+
+/*
+ * Must be called right before esp_deep_sleep. Records the RTC time base the
+ * stub uses to tell the time, and whether the next timer wake may be served
+ * by the stub (false when the wake will need NVS).
+ */
+void wake_stub_prepare_sleep(bool enabled);
+
+#endif